@@ -0,0 +1,328 @@
+#include "asset_loader.h"
+#include "mesh_processing.h"
+// assets file loaders
+#include "OBJ_Loader.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+// STL headers
+#include <iostream>
+#include <fstream>
+
+#define WELD_EPSILON             1E-6    // attribute tolerance for merging duplicated .obj vertices
+
+const string dataPath = "./data/";       // path for data files
+
+// Serializes the import reports printed by the worker threads
+static std::mutex consoleMutex;
+
+// Reorder a freshly loaded mesh for the post-transform vertex cache and report the improvement
+void optimizeMesh(Mesh& mesh, const string& filename) {
+    VertexCacheStats before = analyzeVertexCache(mesh);
+    optimizeVertexCache(mesh);
+    VertexCacheStats after = analyzeVertexCache(mesh);
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    std::cout << filename << ": ACMR " << before.ACMR << " -> " << after.ACMR
+              << ", ATVR " << before.ATVR << " -> " << after.ATVR << std::endl;
+}
+
+// Pack the vertices of a loaded mesh into the quantized GPU format and report the precision loss
+void quantizeMesh(Mesh& mesh, const string& filename) {
+    quantizeVertices(mesh);
+    QuantizationError error = measureQuantizationError(mesh);
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    std::cout << filename << ": quantized to " << sizeof(PackedVertex) << " bytes/vertex, max error: position " 
+              << error.position << " (relative to radius), normal " << error.normal << " deg, texture coords " 
+              << error.texCoords << std::endl;
+}
+
+// Function to read a ".off" mesh data file
+int readMesh(string filename, Mesh& mesh) {
+    try {
+        std::ifstream meshFile((dataPath + filename).c_str());
+        if (!meshFile.good()) {
+            meshFile.close();
+            meshFile.open(("../" + dataPath + filename).c_str());
+        }
+        if (!meshFile.good()) throw 1;
+
+        // Check first line
+        string firstLine;
+        meshFile >> firstLine;
+        if (firstLine != "OFF") throw 1;
+
+        unsigned int nV, nF, nE;
+        meshFile >> nV >> nF >> nE;
+        mesh = Mesh();
+        // read vertices
+        for (unsigned i = 0; i < nV; ++i) {
+            Point vertex;
+            meshFile >> vertex.x >> vertex.y >> vertex.z;
+            mesh.V.push_back(vertex);
+        }
+        // read faces
+        for (unsigned i = 0; i < nF; ++i) {
+            unsigned n;
+            meshFile >> n;
+            Face face;
+            meshFile >> face.a >> face.b >> face.c;
+            mesh.F.push_back(face);
+        }
+        // calculate face normals
+        for (unsigned i = 0; i < nF; ++i) {
+            Vector3f edge1, edge2;
+            edge1 = Vector3f(mesh.V[mesh.F[i].b].x - mesh.V[mesh.F[i].a].x,
+                             mesh.V[mesh.F[i].b].y - mesh.V[mesh.F[i].a].y,
+                             mesh.V[mesh.F[i].b].z - mesh.V[mesh.F[i].a].z);
+            edge2 = Vector3f(mesh.V[mesh.F[i].c].x - mesh.V[mesh.F[i].a].x,
+                             mesh.V[mesh.F[i].c].y - mesh.V[mesh.F[i].a].y,
+                             mesh.V[mesh.F[i].c].z - mesh.V[mesh.F[i].a].z);
+            Vector3f faceNormal = edge1.cross(edge2).normalized();
+            mesh.FN.push_back(Point{faceNormal.x(), faceNormal.y(), faceNormal.z()});
+        }
+        // calculate vertex normals
+        for (unsigned i = 0; i < nV; ++i) {
+            unsigned adjCount = 0;
+            float sumX = 0, sumY = 0, sumZ = 0;
+            for (unsigned j = 0; j < nF; ++j) {
+                if (mesh.F[j].a == i || mesh.F[j].b == i || mesh.F[j].c == i) {
+                    sumX += mesh.FN[j].x;
+                    sumY += mesh.FN[j].y;
+                    sumZ += mesh.FN[j].z;
+                    ++adjCount;
+                }
+            }
+            Vector3f vertexNormal = Vector3f(sumX / adjCount, sumY / adjCount, sumZ / adjCount).normalized();
+            mesh.VN.push_back(Point{vertexNormal.x(), vertexNormal.y(), vertexNormal.z()});
+        }
+        optimizeMesh(mesh, filename);
+        // calculate barycenter
+        float sumX = 0, sumY = 0, sumZ = 0;
+        for (unsigned i = 0; i < nV; ++i) {
+            sumX += mesh.V[i].x;
+            sumY += mesh.V[i].y;
+            sumZ += mesh.V[i].z;
+        }
+        mesh.barycenterX = sumX / nV;
+        mesh.barycenterY = sumY / nV;
+        mesh.barycenterZ = sumZ / nV;
+
+        // calculate radius of containing sphere centered on barycenter
+        float max = 0.0;
+        for (unsigned i = 0; i < mesh.V.size(); ++i) {
+            max = std::max(max, square(mesh.V[i].x - mesh.barycenterX)
+                                + square(mesh.V[i].y - mesh.barycenterZ)
+                                + square(mesh.V[i].z - mesh.barycenterZ));
+        }
+        mesh.maxRadius = std::sqrt(max);
+
+        quantizeMesh(mesh, filename);
+
+        return 0;
+    } catch (...) {
+        std::cerr << "Error opening file." << std::endl;
+        return -1;
+    }
+}
+
+// read a .obj file
+int readObj(string objFilename, Mesh& mesh) {
+    try {
+        objl::Loader loader;
+        std::ifstream testFile((dataPath + objFilename).c_str());
+        if (testFile.good()) {     
+            loader.LoadFile((char*)(dataPath + objFilename).c_str());
+        } else {
+            testFile.close();
+            testFile.open(("../" + dataPath + objFilename).c_str());
+            if (!testFile.good()) throw 1;
+            loader.LoadFile((char*)("../" + dataPath + objFilename).c_str());
+        }
+        testFile.close();
+
+
+        unsigned int nV, nF;
+        nV = loader.LoadedVertices.size();
+        nF = loader.LoadedMeshes[0].Indices.size() / 3;
+        mesh = Mesh();
+        // read vertices
+        for (unsigned i = 0; i < nV; ++i) {
+            Point vertex;
+            vertex.x = loader.LoadedVertices[i].Position.X;
+            vertex.y = loader.LoadedVertices[i].Position.Y;
+            vertex.z = loader.LoadedVertices[i].Position.Z;
+            mesh.V.push_back(vertex);
+        }
+        // read faces
+        for (unsigned i = 0; i < nF; ++i) {
+            Face face;
+            face.a = loader.LoadedMeshes[0].Indices[i * 3];
+            face.b = loader.LoadedMeshes[0].Indices[i * 3 + 1];
+            face.c = loader.LoadedMeshes[0].Indices[i * 3 + 2];
+            mesh.F.push_back(face);
+        }
+        // read vertex normals
+        for (unsigned i = 0; i < nV; ++i) {
+            Point normal;
+            normal.x = loader.LoadedVertices[i].Normal.X;
+            normal.y = loader.LoadedVertices[i].Normal.Y;
+            normal.z = loader.LoadedVertices[i].Normal.Z;
+            mesh.VN.push_back(normal);
+        }
+        // read vertex texture coordinates
+        for (unsigned i = 0; i < nV; ++i) {
+            Point2d texCoords;
+            texCoords.u = loader.LoadedVertices[i].TextureCoordinate.X;
+            texCoords.v = loader.LoadedVertices[i].TextureCoordinate.Y;
+            mesh.texCorrds.push_back(texCoords);
+        }
+        // merge the per-face-corner vertices generated by the loader
+        unsigned nRemoved = weldVertices(mesh, WELD_EPSILON);
+        std::unique_lock<std::mutex> lock(consoleMutex);
+        std::cout << objFilename << ": welded " << nV << " -> " << mesh.V.size() 
+                  << " vertices (" << nRemoved << " removed)" << std::endl;
+        lock.unlock();
+        nV = mesh.V.size();
+        optimizeMesh(mesh, objFilename);
+        // calculate barycenter
+        float sumX = 0, sumY = 0, sumZ = 0;
+        for (unsigned i = 0; i < nV; ++i) {
+            sumX += mesh.V[i].x;
+            sumY += mesh.V[i].y;
+            sumZ += mesh.V[i].z;
+        }
+        mesh.barycenterX = sumX / nV;
+        mesh.barycenterY = sumY / nV;
+        mesh.barycenterZ = sumZ / nV;
+
+        // calculate radius of containing sphere centered on barycenter
+        float max = 0.0;
+        for (unsigned i = 0; i < mesh.V.size(); ++i) {
+            max = std::max(max, square(mesh.V[i].x - mesh.barycenterX)
+                                 + square(mesh.V[i].y - mesh.barycenterZ)
+                                 + square(mesh.V[i].z - mesh.barycenterZ));
+        }
+        mesh.maxRadius = std::sqrt(max);
+
+        quantizeMesh(mesh, objFilename);
+
+        return 0;
+    } catch (...) {
+        std::cerr << "Error opening file." << std::endl;
+        return -1;
+    }
+}
+
+DecodedImage decodeImage(string textureFilename, unsigned mesh) {
+    DecodedImage image = { mesh, 0, 0, 0, NULL };
+    std::ifstream testFile((dataPath + textureFilename).c_str());
+    if (testFile.good()) {     
+        image.data = stbi_load((dataPath + textureFilename).c_str(), 
+                               &image.width, &image.height, &image.nrChannels, 0);
+    } else {
+        testFile.close();
+        testFile.open(("../" + dataPath + textureFilename).c_str());
+        if (!testFile.good()) return image;
+        image.data = stbi_load(("../" + dataPath + textureFilename).c_str(), 
+                               &image.width, &image.height, &image.nrChannels, 0);
+    }
+    return image;
+}
+
+void freeImage(DecodedImage& image) {
+    if (image.data) stbi_image_free(image.data);
+    image.data = NULL;
+}
+
+AssetLoader::~AssetLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for (unsigned i = 0; i < workers.size(); ++i) workers[i].join();
+    for (unsigned i = 0; i < decodedImages.size(); ++i) freeImage(decodedImages[i]);
+}
+
+void AssetLoader::start(unsigned n_threads) {
+    for (unsigned i = 0; i < n_threads; ++i) {
+        workers.push_back(std::thread(&AssetLoader::workerLoop, this));
+    }
+}
+
+void AssetLoader::loadMesh(string filename, unsigned meshIndex) {
+    enqueue([this, filename, meshIndex]() {
+        Mesh mesh;
+        bool isObj = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".obj") == 0;
+        int status = isObj ? readObj(filename, mesh) : readMesh(filename, mesh);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (status != 0) {
+            --pending;
+            return;
+        }
+        loadedMeshes.push_back(std::make_pair(meshIndex, std::move(mesh)));
+    });
+}
+
+void AssetLoader::loadTexture(string textureFilename, unsigned meshIndex) {
+    enqueue([this, textureFilename, meshIndex]() {
+        DecodedImage image = decodeImage(textureFilename, meshIndex);
+        if (!image.data) {
+            {
+                std::lock_guard<std::mutex> lock(consoleMutex);
+                std::cout << "Failed to load texture" << std::endl;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            --pending;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        decodedImages.push_back(image);
+    });
+}
+
+bool AssetLoader::popMesh(unsigned& meshIndex, Mesh& mesh) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (loadedMeshes.empty()) return false;
+    meshIndex = loadedMeshes.front().first;
+    mesh = std::move(loadedMeshes.front().second);
+    loadedMeshes.pop_front();
+    --pending;
+    return true;
+}
+
+bool AssetLoader::popImage(DecodedImage& image) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (decodedImages.empty()) return false;
+    image = decodedImages.front();
+    decodedImages.pop_front();
+    --pending;
+    return true;
+}
+
+unsigned AssetLoader::remaining() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
+
+void AssetLoader::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+        ++pending;
+    }
+    jobAvailable.notify_one();
+}
+
+void AssetLoader::workerLoop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping) return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+        job();
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "common_header.h"
+#include "object_class.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+extern const string dataPath;   // path for data files
+
+// Read a ".off" mesh data file (CPU side only; safe to call from any thread)
+int readMesh(string filename, Mesh& mesh);
+// Read a ".obj" mesh data file (CPU side only; safe to call from any thread)
+int readObj(string objFilename, Mesh& mesh);
+
+// A decoded texture picture waiting to be uploaded to the GPU
+struct DecodedImage {
+    unsigned mesh;          // the mesh the texture belongs to
+    int width, height, nrChannels;
+    unsigned char* data;    // pixels from stb_image; release with freeImage()
+};
+
+// Decode a texture picture (CPU side only; safe to call from any thread). Returns NULL data on failure.
+DecodedImage decodeImage(string textureFilename, unsigned mesh);
+void freeImage(DecodedImage& image);
+
+// Pool of worker threads that parse meshes and decode textures in the background.
+// Finished assets are queued until the main thread (which owns the OpenGL context) collects and uploads them.
+class AssetLoader {
+public:
+    AssetLoader() : stopping(false), pending(0) {}
+    ~AssetLoader();
+
+    // Start the worker threads
+    void start(unsigned n_threads);
+
+    // Queue a mesh file (".off" or ".obj") to be loaded into slot meshIndex
+    void loadMesh(string filename, unsigned meshIndex);
+    // Queue a texture picture to be decoded for the mesh in slot meshIndex
+    void loadTexture(string textureFilename, unsigned meshIndex);
+
+    // Collect one finished asset, if any (main thread)
+    bool popMesh(unsigned& meshIndex, Mesh& mesh);
+    bool popImage(DecodedImage& image);
+
+    // Number of queued assets that have not been collected yet
+    unsigned remaining();
+
+private:
+    vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::deque<pair<unsigned, Mesh>> loadedMeshes;
+    std::deque<DecodedImage> decodedImages;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    bool stopping;
+    unsigned pending;
+
+    void enqueue(std::function<void()> job);
+    void workerLoop();
+};
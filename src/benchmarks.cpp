@@ -0,0 +1,704 @@
+#include "benchmarks.h"
+#include "object_class.h"
+#include "physics.h"
+#include "fft.h"
+#include "octree.h"
+#include "parallel.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <algorithm>
+
+#define ENERGY_SAMPLE_INTERVAL 16   // steps between energy measurements (not included in the timing);
+                                    // a multiple of the RESPA far intervals, so those are measured between outer steps
+#define GRAVITY_REFERENCE_SAMPLE 1000 // bodies whose direct sum accelerations are the reference of the gravity benchmark
+#define GRAVITY_DIRECT_LIMIT   20000 // largest number of bodies for which the full direct sum is timed
+#define BENCHMARK_BODY_RADIUS  1.0   // radius of the bodies of the Plummer sphere and the uniform cube
+#define INDEX_BUILDS           5     // builds of the spatial index timed (the fastest counts)
+#define INDEX_DRIFT_STEPS      100   // steps of the tree maintenance benchmark
+#define INDEX_DRIFT            0.01  // distance the bodies move per step, in sides of their leaves
+#define INDEX_DRIFT_GRAVITY    10    // steps of drift between the tree gravity on a new and on the refitted tree
+#define REPRODUCIBLE_MAX_THREADS 8   // the reproducibility benchmark runs on 1 ~ this many threads (and all of them)
+#define TREEPM_MAX_ERROR       0.05  // largest 99th percentile error of TreePM on the Plummer sphere and the uniform
+                                     // cube (measured: up to 0.024)
+#define FMM_ERROR_SCALE        1.0   // bound of the 99th percentile FMM error there: this times angle^order
+                                     // (measured: up to half that)
+#define TREE_ANGLE_ERROR_SCALE 0.15  // the same for the tree with the opening angle: this times angle^(order + 1)
+                                     // (measured: up to half that)
+#define TREE_BMAX_ERROR_SCALE  0.7   // the same with the b_max angle
+#define TREE_RELATIVE_ERROR_SCALE 10 // with the relative criterion: this times the accuracy (measured: up to 3.8)
+
+extern SlotMap<Object> objects;
+
+// Total (kinetic + potential) energy of objects[start_index ~ end_index).
+// Velocities are (pos - pos_last) / dt; after a position Verlet step that is the velocity half a step back,
+// so it is moved to the current position with the acceleration.
+static double totalEnergy(unsigned start_index, unsigned end_index) {
+    unsigned n = end_index - start_index;
+    vector<Vector3d> pos(n), vel(n), acceleration(n);
+    vector<double> mass(n);
+    for (unsigned k = 0; k < n; ++k) {
+        const Object& object = objects[start_index + k];
+        pos[k] = Vector3d(object.translateX, object.translateY, object.translateZ);
+        vel[k] = (pos[k] - Vector3d(object.translateX_last, object.translateY_last, object.translateZ_last)) / dt;
+        mass[k] = object.mass;
+    }
+    if (last_step_verlet) {
+        directGravity(pos, mass, n, acceleration);
+        for (unsigned k = 0; k < n; ++k) vel[k] += acceleration[k] * (dt / 2);
+    }
+
+    double energy = 0.0;
+    for (unsigned i = 0; i < n; ++i) {
+        energy += 0.5 * mass[i] * vel[i].squaredNorm();
+        for (unsigned j = i + 1; j < n; ++j) {
+            energy -= G_para * mass[i] * mass[j] / (pos[j] - pos[i]).norm();
+        }
+    }
+    return energy;
+}
+
+// Restart from the scene state with step dt, rescaling the stored last positions from the scene step
+static void restartScene(const SlotMap<Object>& initial, double scene_dt, double new_dt) {
+    objects = initial;
+    dt = new_dt;
+    dt_adaptive = new_dt;
+    for (unsigned k = 0; k < objects.size(); ++k) {
+        Object& object = objects[k];
+        double factor = new_dt / scene_dt;
+        object.translateX_last = object.translateX - (object.translateX - object.translateX_last) * factor;
+        object.translateY_last = object.translateY - (object.translateY - object.translateY_last) * factor;
+        object.translateZ_last = object.translateZ - (object.translateZ - object.translateZ_last) * factor;
+    }
+}
+
+// Result of a benchmark run
+struct RunResult {
+    unsigned steps;
+    unsigned long long force_evaluations;   // bodies whose gravity was computed, summed over all passes
+    double milliseconds;                    // time spent in physics()
+    double max_error;                       // largest relative energy error
+    double smallest_dt;
+};
+
+// Simulate the given time from the current state
+static RunResult simulate(double duration) {
+    unsigned end_index = objects.size();
+    last_step_verlet = false;   // the scene velocities are exact
+    double E0 = totalEnergy(0, end_index);
+    std::chrono::duration<double, std::milli> elapsed(0);
+    RunResult result = { 0, 0, 0.0, 0.0, HUGE_VAL };
+    double time = 0.0;
+    while (time < duration * (1 - 1E-9)) {
+        unsigned long long evaluations = n_force_evaluations;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        unsigned long long merged = n_merged_bodies;
+        double step = physics(0, end_index, duration - time);
+        elapsed += std::chrono::high_resolution_clock::now() - t0;
+        end_index -= unsigned(n_merged_bodies - merged);
+        result.force_evaluations += n_force_evaluations - evaluations;
+        time += step;
+        result.smallest_dt = std::min(result.smallest_dt, step);
+        if (++result.steps % ENERGY_SAMPLE_INTERVAL == 0 || time >= duration * (1 - 1E-9)) {
+            double error = std::fabs((totalEnergy(0, end_index) - E0) / E0);
+            if (!(error <= result.max_error)) result.max_error = error;   // keeps NaN
+        }
+    }
+    result.milliseconds = elapsed.count();
+    return result;
+}
+
+static void printHeader(const char* first_column) {
+    printf("%-30s %10s %14s %12s %12s %12s\n", first_column, "steps", "force evals", "time (ms)", "max |dE/E|", "smallest dt");
+}
+
+static void printResult(const string& first_column, const RunResult& result) {
+    printf("%-30s %10u %14llu %12.1f %12.3g %12.3g\n", first_column.c_str(), result.steps, result.force_evaluations,
+           result.milliseconds, result.max_error, result.smallest_dt);
+}
+
+int integratorBenchmark(string sceneFilename, double duration) {
+    SlotMap<Object> initial = objects;
+    integrator_t scene_integrator = integrator;
+    bool scene_adaptive = adaptive_dt;
+    double scene_dt = dt;
+    static const double dt_factors[] = { 8, 4, 2, 1, 0.5 };
+
+    printf("Integrator benchmark: %s, %u bodies, %g time units\n", sceneFilename.c_str(),
+           objects.size(), duration);
+    printHeader("integrator, dt");
+    adaptive_dt = false;
+    for (unsigned i = 0; i < N_INTEGRATORS; ++i) {
+        for (unsigned f = 0; f < sizeof(dt_factors) / sizeof(dt_factors[0]); ++f) {
+            integrator = integrator_t(i);
+            restartScene(initial, scene_dt, scene_dt * dt_factors[f]);
+            char label[64];
+            snprintf(label, sizeof(label), "%s, %g", integratorName(integrator), dt);
+            printResult(label, simulate(duration));
+        }
+    }
+
+    objects = initial;
+    integrator = scene_integrator;
+    adaptive_dt = scene_adaptive;
+    dt = scene_dt;
+    return 0;
+}
+
+int timestepBenchmark(string sceneFilename, double duration) {
+    SlotMap<Object> initial = objects;
+    bool scene_adaptive = adaptive_dt;
+    double scene_dt = dt;
+    double scene_accuracy = dt_accuracy;
+    bool scene_ks = ks_regularization;
+    static const double dt_factors[] = { 1, 0.25, 0.0625 };
+    static const double accuracies[] = { 0.02, 0.01, 0.005, 0.0025 };
+
+    printf("Time step benchmark: %s, %u bodies, %g time units, %s\n", sceneFilename.c_str(),
+           objects.size(), duration, integratorName(integrator));
+    printHeader("time step");
+    // fixed and adaptive steps without and with the KS regularization of binaries
+    for (unsigned ks = 0; ks < 2; ++ks) {
+        ks_regularization = ks == 1;
+        const char* suffix = ks_regularization ? ", KS" : "";
+        for (unsigned f = 0; f < sizeof(dt_factors) / sizeof(dt_factors[0]); ++f) {
+            adaptive_dt = false;
+            restartScene(initial, scene_dt, scene_dt * dt_factors[f]);
+            char label[64];
+            snprintf(label, sizeof(label), "fixed %g%s", dt, suffix);
+            printResult(label, simulate(duration));
+        }
+        for (unsigned a = 0; a < sizeof(accuracies) / sizeof(accuracies[0]); ++a) {
+            adaptive_dt = true;
+            dt_accuracy = accuracies[a];
+            restartScene(initial, scene_dt, scene_dt);
+            char label[64];
+            snprintf(label, sizeof(label), "adaptive, accuracy %g%s", dt_accuracy, suffix);
+            printResult(label, simulate(duration));
+        }
+    }
+    ks_regularization = scene_ks;
+    // hierarchical block steps use the same accuracy parameter for the step of each body
+    integrator_t scene_integrator = integrator;
+    integrator = BLOCK_HERMITE4;
+    for (unsigned a = 0; a < sizeof(accuracies) / sizeof(accuracies[0]); ++a) {
+        adaptive_dt = true;
+        dt_accuracy = accuracies[a];
+        restartScene(initial, scene_dt, scene_dt);
+        char label[64];
+        snprintf(label, sizeof(label), "block steps, accuracy %g", dt_accuracy);
+        printResult(label, simulate(duration));
+    }
+    integrator = scene_integrator;
+
+    objects = initial;
+    adaptive_dt = scene_adaptive;
+    dt_accuracy = scene_accuracy;
+    dt = scene_dt;
+    dt_adaptive = scene_dt;
+    return 0;
+}
+
+int respaBenchmark(string sceneFilename, double duration) {
+    SlotMap<Object> initial = objects;
+    integrator_t scene_integrator = integrator;
+    bool scene_adaptive = adaptive_dt;
+    unsigned scene_interval = respa_far_interval;
+    double scene_radius = respa_split_radius;
+    static const unsigned intervals[] = { 1, 2, 4, 8 };
+    static const double radius_factors[] = { 0.5, 1, 2 };
+
+    printf("RESPA benchmark: %s, %u bodies, %g time units, dt %g\n", sceneFilename.c_str(),
+           objects.size(), duration, dt);
+    printHeader("integrator");
+    adaptive_dt = false;
+    integrator = VERLET;
+    restartScene(initial, dt, dt);
+    printResult(integratorName(integrator), simulate(duration));
+    integrator = RESPA;
+    for (unsigned r = 0; r < sizeof(radius_factors) / sizeof(radius_factors[0]); ++r) {
+        for (unsigned i = 0; i < sizeof(intervals) / sizeof(intervals[0]); ++i) {
+            respa_split_radius = scene_radius * radius_factors[r];
+            respa_far_interval = intervals[i];
+            restartScene(initial, dt, dt);
+            char label[64];
+            snprintf(label, sizeof(label), "RESPA, k %u, split %g", respa_far_interval, respa_split_radius);
+            printResult(label, simulate(duration));
+        }
+    }
+
+    objects = initial;
+    integrator = scene_integrator;
+    adaptive_dt = scene_adaptive;
+    respa_far_interval = scene_interval;
+    respa_split_radius = scene_radius;
+    return 0;
+}
+
+// Bodies of a Plummer sphere (scale radius 100, unit masses), the standard model of a star cluster
+static void plummerSphere(unsigned n, vector<Vector3d>& pos, vector<double>& mass) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    pos.resize(n);
+    mass.assign(n, 1.0);
+    for (unsigned k = 0; k < n; ++k) {
+        double r;
+        do {
+            r = 100.0 / std::sqrt(std::pow(uniform(random), -2.0 / 3.0) - 1.0);
+        } while (!(r < 1000.0));
+        double cos_theta = 2 * uniform(random) - 1, phi = 2 * PI_D * uniform(random);
+        double sin_theta = std::sqrt(1 - cos_theta * cos_theta);
+        pos[k] = r * Vector3d(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+    }
+}
+
+// Direct sum acceleration of one body, for the reference sample
+static Vector3d directAcceleration(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active, unsigned i) {
+    Vector3d acc = Vector3d::Zero();
+    for (unsigned j = 0; j < n_active; ++j) {
+        Vector3d distance = pos[j] - pos[i];
+        double r2 = distance.squaredNorm();
+        if (j == i || r2 == 0.0) continue;
+        acc += distance * (G_para * mass[j] / (r2 * std::sqrt(r2)));
+    }
+    return acc;
+}
+
+// Print the time and the relative acceleration errors of a solver on the reference sample; returns the 99th
+// percentile error
+static double printSolverResult(const string& label, double milliseconds, const vector<Vector3d>& acceleration,
+                              const vector<unsigned>& sample, const vector<Vector3d>& reference) {
+    vector<double> errors(sample.size());
+    for (unsigned s = 0; s < sample.size(); ++s) {
+        errors[s] = (acceleration[sample[s]] - reference[s]).norm() / reference[s].norm();
+    }
+    std::sort(errors.begin(), errors.end());
+    double rms = 0.0;
+    for (unsigned s = 0; s < errors.size(); ++s) rms += errors[s] * errors[s];
+    rms = std::sqrt(rms / errors.size());
+    printf("%-34s %12.1f %12.3g %12.3g %12.3g\n", label.c_str(), milliseconds, errors[errors.size() / 2],
+           rms, errors[errors.size() * 99 / 100]);
+    return errors[errors.size() * 99 / 100];
+}
+
+// Bound of the 99th percentile error of the tree with the given opening criterion, setting and multipole order
+static double treeErrorBound(opening_criterion_t criterion, double value, unsigned order) {
+    switch (criterion) {
+    case OPENING_BMAX: return TREE_BMAX_ERROR_SCALE * std::pow(value, order + 1.0);
+    case OPENING_RELATIVE: return TREE_RELATIVE_ERROR_SCALE * value;
+    default: return TREE_ANGLE_ERROR_SCALE * std::pow(value, order + 1.0);
+    }
+}
+
+// Whether the 99th percentile error of a solver is within its bound; prints a message if not.
+// (A body that feels no pull at all makes the errors NaN, which passes.)
+static bool withinErrorBound(const string& label, double error, double bound) {
+    if (!(error > bound)) return true;
+    fprintf(stderr, "%s: 99%% error %.3g above the bound %.3g\n", label.c_str(), error, bound);
+    return false;
+}
+
+// Bodies spread uniformly over a cube of side 1000 (unit masses), a homogeneous medium like a cosmological box
+static void uniformCube(unsigned n, vector<Vector3d>& pos, vector<double>& mass) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(-500.0, 500.0);
+    pos.resize(n);
+    mass.assign(n, 1.0);
+    for (unsigned k = 0; k < n; ++k) {
+        double x = uniform(random), y = uniform(random);
+        pos[k] = Vector3d(x, y, uniform(random));
+    }
+}
+
+// Bodies of a benchmark: a Plummer sphere, a uniform cube (bodies of radius BENCHMARK_BODY_RADIUS) or the scene
+static void benchmarkBodies(string source, unsigned n_bodies, vector<Vector3d>& pos, vector<double>& mass,
+                            vector<double>& radius) {
+    if (source == "plummer") {
+        plummerSphere(n_bodies, pos, mass);
+    } else if (source == "uniform") {
+        uniformCube(n_bodies, pos, mass);
+    } else {
+        for (unsigned k = 0; k < objects.size(); ++k) {
+            pos.push_back(Vector3d(objects[k].translateX, objects[k].translateY, objects[k].translateZ));
+            mass.push_back(objects[k].mass);
+            radius.push_back(objects[k].collision_radius);
+        }
+    }
+    radius.resize(pos.size(), BENCHMARK_BODY_RADIUS);
+}
+
+int gravityBenchmark(string source, unsigned n_bodies) {
+    vector<Vector3d> pos;
+    vector<double> mass, radius;
+    benchmarkBodies(source, n_bodies, pos, mass, radius);
+    unsigned n = pos.size();
+    if (n < 2) return -1;
+
+    // reference accelerations of an evenly spaced sample of bodies
+    vector<unsigned> sample;
+    for (unsigned k = 0; k < std::min(n, unsigned(GRAVITY_REFERENCE_SAMPLE)); ++k) {
+        sample.push_back(unsigned((unsigned long long)k * n / std::min(n, unsigned(GRAVITY_REFERENCE_SAMPLE))));
+    }
+    vector<Vector3d> reference(sample.size());
+    for (unsigned s = 0; s < sample.size(); ++s) reference[s] = directAcceleration(pos, mass, n, sample[s]);
+
+    printf("Gravity benchmark: %s, %u bodies (errors relative to the direct sum on %u bodies)\n",
+           source.c_str(), n, unsigned(sample.size()));
+    printf("%-34s %12s %12s %12s %12s\n", "solver", "time (ms)", "median err", "rms err", "99% err");
+    vector<Vector3d> acceleration(n);
+    bool scene_mixed = mixed_precision_forces;
+    bool failed = false;
+    // the bounds of the approximate solvers hold on the bodies they were measured on; in a scene, the relative
+    // error of a body whose pulls cancel, or that only feels bodies of negligible mass, can be anything
+    bool bounded = source == "plummer" || source == "uniform";
+    if (n <= GRAVITY_DIRECT_LIMIT) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        directGravity(pos, mass, n, acceleration);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+        printSolverResult("direct sum", elapsed.count(), acceleration, sample, reference);
+        mixed_precision_forces = true;
+        t0 = std::chrono::high_resolution_clock::now();
+        directGravity(pos, mass, n, acceleration);
+        elapsed = std::chrono::high_resolution_clock::now() - t0;
+        mixed_precision_forces = scene_mixed;
+        double error = printSolverResult("direct sum, mixed precision", elapsed.count(), acceleration, sample,
+                                         reference);
+        if (!withinErrorBound("Mixed precision direct sum", error, MIXED_PRECISION_MAX_ERROR)) failed = true;
+    }
+
+    unsigned scene_grid = pm_grid_size;
+    mass_assignment_t scene_assignment = pm_assignment;
+    bool scene_periodic = pm_periodic;
+    pm_periodic = false;
+    static const unsigned grid_sizes[] = { 32, 64, 128 };
+    for (unsigned a = 0; a < N_MASS_ASSIGNMENTS; ++a) {
+        for (unsigned g = 0; g < sizeof(grid_sizes) / sizeof(grid_sizes[0]); ++g) {
+            pm_assignment = mass_assignment_t(a);
+            pm_grid_size = grid_sizes[g];
+            auto t0 = std::chrono::high_resolution_clock::now();
+            particleMeshGravity(pos, mass, n, acceleration);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+            char label[64];
+            snprintf(label, sizeof(label), "particle mesh, %s, %u^3", massAssignmentName(pm_assignment), pm_grid_size);
+            printSolverResult(label, elapsed.count(), acceleration, sample, reference);
+        }
+    }
+
+    // tree: every opening criterion with two settings, for the monopole, quadrupole and octupole
+    double scene_angle = tree_opening_angle, scene_accuracy = tree_force_accuracy;
+    opening_criterion_t scene_criterion = tree_opening_criterion;
+    unsigned scene_multipole = tree_multipole_order;
+    static const char* multipole_names[] = { "", "monopole", "quadrupole", "octupole" };
+    static const struct { opening_criterion_t criterion; const char* name; double value; } tree_settings[] = {
+        { OPENING_ANGLE, "angle", 0.7 }, { OPENING_ANGLE, "angle", 0.5 },
+        { OPENING_BMAX, "b_max angle", 0.7 }, { OPENING_BMAX, "b_max angle", 0.5 },
+        { OPENING_RELATIVE, "accuracy", 0.005 }, { OPENING_RELATIVE, "accuracy", 0.0005 }
+    };
+    for (unsigned t = 0; t < sizeof(tree_settings) / sizeof(tree_settings[0]); ++t) {
+        for (unsigned order = 1; order <= 3; ++order) {
+            tree_opening_criterion = tree_settings[t].criterion;
+            tree_opening_angle = tree_force_accuracy = tree_settings[t].value;
+            tree_multipole_order = order;
+            auto t0 = std::chrono::high_resolution_clock::now();
+            barnesHutGravity(pos, mass, n, acceleration);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+            char label[64];
+            snprintf(label, sizeof(label), "tree, %s, %s %g", multipole_names[order], tree_settings[t].name,
+                     tree_settings[t].value);
+            double error = printSolverResult(label, elapsed.count(), acceleration, sample, reference);
+            double bound = treeErrorBound(tree_settings[t].criterion, tree_settings[t].value, order);
+            if (bounded && !withinErrorBound(label, error, bound)) failed = true;
+        }
+    }
+    // the same with mixed precision leaves, at the opening angle 0.5
+    tree_opening_criterion = OPENING_ANGLE;
+    tree_opening_angle = 0.5;
+    mixed_precision_forces = true;
+    for (unsigned order = 1; order <= 3; order += 2) {
+        tree_multipole_order = order;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        barnesHutGravity(pos, mass, n, acceleration);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+        char label[64];
+        snprintf(label, sizeof(label), "tree, %s, angle 0.5, mixed", multipole_names[order]);
+        double error = printSolverResult(label, elapsed.count(), acceleration, sample, reference);
+        if (bounded && !withinErrorBound(label, error, treeErrorBound(OPENING_ANGLE, 0.5, order))) failed = true;
+    }
+    mixed_precision_forces = scene_mixed;
+    tree_opening_criterion = scene_criterion;
+    tree_force_accuracy = scene_accuracy;
+    tree_multipole_order = scene_multipole;
+
+    // TreePM with the tree opening angle 0.5, for a few mesh sizes and split scales
+    double scene_split = treepm_split_cells;
+    static const double split_scales[] = { 1.25, 2.0, 3.0 };
+    pm_assignment = scene_assignment;
+    tree_opening_angle = 0.5;
+    for (unsigned g = 0; g < 2; ++g) for (unsigned s = 0; s < sizeof(split_scales) / sizeof(split_scales[0]); ++s) {
+        pm_grid_size = grid_sizes[g];
+        treepm_split_cells = split_scales[s];
+        auto t0 = std::chrono::high_resolution_clock::now();
+        treePMGravity(pos, mass, n, acceleration);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+        char label[64];
+        snprintf(label, sizeof(label), "TreePM, %u^3, r_s %g cells", pm_grid_size, treepm_split_cells);
+        double error = printSolverResult(label, elapsed.count(), acceleration, sample, reference);
+        if (bounded && !withinErrorBound(label, error, TREEPM_MAX_ERROR)) failed = true;
+    }
+    treepm_split_cells = scene_split;
+
+    tree_opening_angle = scene_angle;
+
+    unsigned scene_order = fmm_order;
+    double scene_fmm_angle = fmm_opening_angle;
+    static const unsigned orders[] = { 2, 4, 6 };
+    static const double fmm_angles[] = { 0.7, 0.5 };
+    for (unsigned a = 0; a < sizeof(fmm_angles) / sizeof(fmm_angles[0]); ++a) {
+        for (unsigned o = 0; o < sizeof(orders) / sizeof(orders[0]); ++o) {
+            fmm_order = orders[o];
+            fmm_opening_angle = fmm_angles[a];
+            auto t0 = std::chrono::high_resolution_clock::now();
+            fastMultipoleGravity(pos, mass, n, acceleration);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+            char label[64];
+            snprintf(label, sizeof(label), "FMM, order %u, angle %g", fmm_order, fmm_opening_angle);
+            double error = printSolverResult(label, elapsed.count(), acceleration, sample, reference);
+            double bound = FMM_ERROR_SCALE * std::pow(fmm_opening_angle, double(fmm_order));
+            if (bounded && !withinErrorBound(label, error, bound)) failed = true;
+        }
+    }
+    fmm_order = scene_order;
+    fmm_opening_angle = scene_fmm_angle;
+
+    // every variant of the direct sum kernel
+    if (n <= GRAVITY_DIRECT_LIMIT) {
+        printf("\nDirect sum kernels (softening length %g)\n", softening_length);
+        printf("%-34s %12s %12s\n", "softening, precision", "time (ms)", "+ collisions");
+        softening_t scene_softening = softening;
+        vector<unsigned> first_overlap;
+        for (unsigned s = 0; s < N_SOFTENINGS; ++s) for (unsigned mixed = 0; mixed < 2; ++mixed) {
+            softening = softening_t(s);
+            mixed_precision_forces = mixed;
+            auto t0 = std::chrono::high_resolution_clock::now();
+            directGravity(pos, mass, n, acceleration);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            directGravity(pos, mass, n, acceleration, &radius, &first_overlap);
+            auto t2 = std::chrono::high_resolution_clock::now();
+            char label[64];
+            snprintf(label, sizeof(label), "%s, %s", softeningName(softening), mixed ? "mixed" : "double");
+            printf("%-34s %12.1f %12.1f\n", label, std::chrono::duration<double, std::milli>(t1 - t0).count(),
+                   std::chrono::duration<double, std::milli>(t2 - t1).count());
+        }
+        softening = scene_softening;
+        mixed_precision_forces = scene_mixed;
+    }
+
+    // crossover with the direct sum, on the first bodies of the set
+    printf("\nFMM (order %u, angle %g) against the direct sum\n", fmm_order, fmm_opening_angle);
+    printf("%10s %14s %14s\n", "bodies", "direct (ms)", "FMM (ms)");
+    for (unsigned m = 250; m <= std::min(n, 16000u); m *= 2) {
+        vector<Vector3d> part_pos(pos.begin(), pos.begin() + m), part_acceleration(m);
+        vector<double> part_mass(mass.begin(), mass.begin() + m);
+        auto t0 = std::chrono::high_resolution_clock::now();
+        directGravity(part_pos, part_mass, m, part_acceleration);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        fastMultipoleGravity(part_pos, part_mass, m, part_acceleration);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        printf("%10u %14.1f %14.1f\n", m, std::chrono::duration<double, std::milli>(t1 - t0).count(),
+               std::chrono::duration<double, std::milli>(t2 - t1).count());
+    }
+    pm_grid_size = scene_grid;
+    pm_assignment = scene_assignment;
+    pm_periodic = scene_periodic;
+    return failed ? 1 : 0;
+}
+
+int indexBenchmark(string source, unsigned n_bodies) {
+    vector<Vector3d> pos;
+    vector<double> mass, radius;
+    benchmarkBodies(source, n_bodies, pos, mass, radius);
+    unsigned n = pos.size();
+    if (n < 2) return -1;
+    printf("Spatial index benchmark: %s, %u bodies\n", source.c_str(), n);
+
+    // the same work on the bodies as given and after sorting them into Morton order (as sortBodies() does)
+    vector<Vector3d> acceleration(n);
+    for (unsigned sorted = 0; sorted < 2; ++sorted) {
+        const char* order_name = sorted ? "Morton order" : "given order";
+        if (sorted) {
+            vector<unsigned> order;
+            mortonOrder(pos, n, order);
+            vector<Vector3d> sorted_pos(n);
+            vector<double> sorted_mass(n), sorted_radius(n);
+            for (unsigned k = 0; k < n; ++k) {
+                sorted_pos[k] = pos[order[k]];
+                sorted_mass[k] = mass[order[k]];
+                sorted_radius[k] = radius[order[k]];
+            }
+            pos.swap(sorted_pos);
+            mass.swap(sorted_mass);
+            radius.swap(sorted_radius);
+            ++body_generation;
+        }
+
+        // build: Morton codes, radix sort, levels of nodes and their sums
+        Octree tree;
+        double fastest = HUGE_VAL;
+        for (unsigned r = 0; r < INDEX_BUILDS; ++r) {
+            auto t0 = std::chrono::high_resolution_clock::now();
+            tree.build(pos, mass, n, OCTREE_LEAF_SIZE, &radius);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+            fastest = std::min(fastest, elapsed.count());
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "build, %s", order_name);
+        printf("%-34s %12.2f ms (%u nodes, %u levels)\n", label, fastest, unsigned(tree.nodes.size()),
+               unsigned(tree.levels.size() - 1));
+
+        // collision broad phase: every overlapping pair, from the index and (for fewer bodies) by testing all pairs
+        auto t0 = std::chrono::high_resolution_clock::now();
+        unsigned long long pairs = 0;
+        for (unsigned i = 0; i < n; ++i) {
+            tree.overlapping(pos[i], radius[i], [&](unsigned j) {
+                if (j > i && (pos[j] - pos[i]).squaredNorm() < square(radius[i] + radius[j])) ++pairs;
+            });
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+        snprintf(label, sizeof(label), "overlapping pairs, %s", order_name);
+        printf("%-34s %12.2f ms (%llu pairs)\n", label, elapsed.count(), pairs);
+        if (n <= GRAVITY_DIRECT_LIMIT && !sorted) {
+            t0 = std::chrono::high_resolution_clock::now();
+            pairs = 0;
+            for (unsigned i = 0; i < n; ++i) for (unsigned j = i + 1; j < n; ++j) {
+                if ((pos[j] - pos[i]).squaredNorm() < square(radius[i] + radius[j])) ++pairs;
+            }
+            elapsed = std::chrono::high_resolution_clock::now() - t0;
+            printf("%-34s %12.2f ms (%llu pairs)\n", "overlapping pairs, all pairs", elapsed.count(), pairs);
+        }
+
+        // tree gravity with the scene's settings
+        t0 = std::chrono::high_resolution_clock::now();
+        barnesHutGravity(pos, mass, n, acceleration);
+        elapsed = std::chrono::high_resolution_clock::now() - t0;
+        snprintf(label, sizeof(label), "tree gravity, %s", order_name);
+        printf("%-34s %12.2f ms\n", label, elapsed.count());
+    }
+
+    // tree maintenance: the bodies drift in random directions, each step by INDEX_DRIFT of the side of the leaf
+    // they start in, and the tree is refitted (or rebuilt when it has degraded) against rebuilt every step
+    vector<Vector3d> drift(n);
+    {
+        Octree start;
+        start.build(pos, mass, n);
+        std::mt19937 random(2);
+        std::normal_distribution<double> normal(0.0, 1.0);
+        for (unsigned node = 0; node < start.nodes.size(); ++node) {
+            const OctreeNode& leaf = start.nodes[node];
+            if (leaf.n_children > 0) continue;
+            for (unsigned b = leaf.body_begin; b < leaf.body_end; ++b) {
+                Vector3d direction(normal(random), normal(random), normal(random));
+                drift[start.bodies[b]] = direction.normalized() * (INDEX_DRIFT * 2 * leaf.half_size);
+            }
+        }
+    }
+    Octree kept, rebuilt;
+    unsigned long long builds = n_tree_builds, refits = n_tree_refits;
+    double update_time = 0.0, build_time = 0.0;
+    for (unsigned s = 0; s < INDEX_DRIFT_STEPS; ++s) {
+        for (unsigned k = 0; k < n; ++k) pos[k] += drift[k];
+        auto t0 = std::chrono::high_resolution_clock::now();
+        updateTree(kept, pos, mass, n, OCTREE_LEAF_SIZE, &radius);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        rebuilt.build(pos, mass, n, OCTREE_LEAF_SIZE, &radius);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        update_time += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        build_time += std::chrono::duration<double, std::milli>(t2 - t1).count();
+    }
+    printf("\n%u steps, drift %g of a leaf per step\n", INDEX_DRIFT_STEPS, INDEX_DRIFT);
+    printf("%-34s %12.2f ms per step (%llu builds, %llu refits, overlap %.3g -> %.3g)\n", "refit",
+           update_time / INDEX_DRIFT_STEPS, n_tree_builds - builds, n_tree_refits - refits, kept.built_overlap,
+           kept.overlap());
+    printf("%-34s %12.2f ms per step\n", "rebuild", build_time / INDEX_DRIFT_STEPS);
+
+    // gravity from a tree refitted after INDEX_DRIFT_GRAVITY steps of drift and from a new tree
+    vector<Vector3d> rebuilt_acceleration(n);
+    ++body_generation;
+    barnesHutGravity(pos, mass, n, acceleration);
+    for (unsigned k = 0; k < n; ++k) pos[k] += drift[k] * INDEX_DRIFT_GRAVITY;
+    builds = n_tree_builds;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    barnesHutGravity(pos, mass, n, acceleration);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    bool refitted = n_tree_builds == builds;
+    ++body_generation;
+    barnesHutGravity(pos, mass, n, rebuilt_acceleration);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    double difference = 0.0;
+    for (unsigned k = 0; k < n; ++k) {
+        difference += (acceleration[k] - rebuilt_acceleration[k]).squaredNorm() / rebuilt_acceleration[k].squaredNorm();
+    }
+    printf("%-34s %12.2f ms (%s, rms difference %.3g)\n", "tree gravity, refitted tree",
+           std::chrono::duration<double, std::milli>(t1 - t0).count(), refitted ? "refitted" : "rebuilt",
+           std::sqrt(difference / n));
+    printf("%-34s %12.2f ms\n", "tree gravity, new tree", std::chrono::duration<double, std::milli>(t2 - t1).count());
+    return 0;
+}
+
+int reproducibilityBenchmark(string source, unsigned n_bodies) {
+    vector<Vector3d> pos;
+    vector<double> mass, radius;
+    benchmarkBodies(source, n_bodies, pos, mass, radius);
+    unsigned n = pos.size();
+    if (n < 2) return -1;
+    printf("Reproducibility benchmark: %s, %u bodies (differences from the result on one thread)\n", source.c_str(), n);
+    printf("%-34s %8s %12s %12s %12s\n", "solver", "threads", "time (ms)", "bodies diff", "largest diff");
+
+    vector<unsigned> thread_counts;
+    for (unsigned t = 1; t <= REPRODUCIBLE_MAX_THREADS; t *= 2) thread_counts.push_back(t);
+    thread_counts.insert(thread_counts.begin() + 2, 3);   // not a power of two
+    unsigned all_threads = parallelThreads();
+    if (std::find(thread_counts.begin(), thread_counts.end(), all_threads) == thread_counts.end()) {
+        thread_counts.push_back(all_threads);
+    }
+
+    unsigned scene_threads = parallel_threads;
+    bool scene_reproducible = reproducible_forces;
+    vector<Vector3d> acceleration(n), single(n);
+    static const char* names[] = { "direct sum", "direct sum, reproducible", "tree", "TreePM", "FMM", "particle mesh" };
+    bool failed = false;
+    for (unsigned solver = 0; solver < sizeof(names) / sizeof(names[0]); ++solver) {
+        if (solver < 2 && n > GRAVITY_DIRECT_LIMIT) continue;
+        reproducible_forces = solver == 1;
+        for (unsigned t = 0; t < thread_counts.size(); ++t) {
+            parallel_threads = thread_counts[t];
+            ++body_generation;   // a new tree every time
+            auto t0 = std::chrono::high_resolution_clock::now();
+            switch (solver) {
+            case 0: case 1: directGravity(pos, mass, n, acceleration); break;
+            case 2: barnesHutGravity(pos, mass, n, acceleration); break;
+            case 3: treePMGravity(pos, mass, n, acceleration); break;
+            case 4: fastMultipoleGravity(pos, mass, n, acceleration); break;
+            default: particleMeshGravity(pos, mass, n, acceleration); break;
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+            if (t == 0) single = acceleration;
+            unsigned differing = 0;
+            double largest = 0.0;
+            for (unsigned k = 0; k < n; ++k) {
+                if (acceleration[k] == single[k]) continue;
+                ++differing;
+                largest = std::max(largest, (acceleration[k] - single[k]).norm() / single[k].norm());
+            }
+            printf("%-34s %8u %12.1f %12u %12.3g\n", names[solver], thread_counts[t], elapsed.count(), differing, largest);
+            // only the fast direct sum may depend on the thread count
+            if (solver > 0 && differing > 0) {
+                fprintf(stderr, "%s on %u threads differs from one thread for %u bodies\n",
+                    names[solver], thread_counts[t], differing);
+                failed = true;
+            }
+        }
+    }
+    parallel_threads = scene_threads;
+    reproducible_forces = scene_reproducible;
+    return failed ? 1 : 0;
+}
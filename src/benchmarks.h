@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common_header.h"
+
+// Command-line benchmark modes. They run on the bodies in objects (those of the scene loaded),
+// print a table to stdout and return the exit code.
+
+// "--integrator-bench [scene] [duration]": energy error against wall time for every integrator and a few time steps
+int integratorBenchmark(string sceneFilename, double duration);
+// "--timestep-bench [scene] [duration]": fixed against adaptive steps, without and with the KS regularization
+// of binaries, and block steps
+// (steps, force evaluations, wall time, energy error)
+int timestepBenchmark(string sceneFilename, double duration);
+// "--respa-bench [scene] [duration]": position Verlet against RESPA with several far intervals and split radii
+int respaBenchmark(string sceneFilename, double duration);
+// "--gravity-bench [scene | plummer | uniform] [bodies]": time and acceleration error of the gravity solvers
+// against the direct sum, on a scene, a Plummer sphere or a uniform cube with the given number of bodies,
+// and the time of every variant of the direct sum kernel (softening, precision, with and without collisions).
+// Returns 1 if the 99th percentile error of the mixed precision direct sum is above MIXED_PRECISION_MAX_ERROR,
+// or, on the Plummer sphere and the uniform cube, that of a TreePM row above TREEPM_MAX_ERROR, an FMM row above
+// FMM_ERROR_SCALE angle^order or a tree row above the bound of its opening criterion and multipole order
+// (TREE_*_ERROR_SCALE, benchmarks.cpp).
+int gravityBenchmark(string source, unsigned n_bodies);
+// "--index-bench [scene | plummer | uniform] [bodies]": build time of the spatial index, the time of finding
+// every overlapping pair with it (and, for fewer bodies, by testing all pairs) and of the tree gravity,
+// with the bodies in the given order and sorted into Morton order, and refitting the tree to drifting bodies
+// against rebuilding it
+int indexBenchmark(string source, unsigned n_bodies);
+// "--reproducibility-bench [scene | plummer | uniform] [bodies]": time of every gravity solver on 1 ~ 8 threads
+// (and all of them) and how many accelerations differ from those on one thread, for the direct sum with and
+// without reproducible_forces. Fails when any solver but the fast direct sum differs
+int reproducibilityBenchmark(string source, unsigned n_bodies);
@@ -0,0 +1,125 @@
+#include "physics.h"
+#include "parallel.h"
+
+#define MAX_RUNG          16   // smallest body step: the block step / 2^MAX_RUNG
+#define PARALLEL_MIN_BODIES 32 // active bodies per thread below which forces are computed on one thread
+
+// Acceleration, jerk and shortest dynamical time (free-fall or crossing, as for the adaptive step)
+// of the bodies in the active list, from the (predicted) states of the gravity sources; a force kernel for
+// runForceKernel() (always in double precision), with the jerk as in gravityJerk()
+struct ActiveGravityJerk {
+    const vector<unsigned>& active;
+    const vector<Vector3d>& pos;
+    const vector<Vector3d>& vel;
+    const vector<double>& mass;
+    unsigned n_active;
+    vector<Vector3d>& acceleration;
+    vector<Vector3d>& jerk;
+    vector<double>& timescale;
+
+    template<class Softening, class Precision> void run(const Softening& softening) const {
+        parallelFor(active.size(), PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+            for (unsigned a = begin; a < end; ++a) {
+                unsigned i = active[a];
+                Vector3d acc = Vector3d::Zero(), jrk = Vector3d::Zero();
+                double shortest2 = HUGE_VAL;
+                for (unsigned j = 0; j < n_active; ++j) {
+                    if (j == i) continue;
+                    Vector3d distance = pos[j] - pos[i];
+                    Vector3d velocity = vel[j] - vel[i];
+                    double r2 = distance.squaredNorm();
+                    if (r2 == 0.0) continue;
+                    double Gm = G_para * mass[j], Gm_f = Gm * softening.factor(r2);
+                    acc += distance * Gm_f;
+                    jrk += velocity * Gm_f + distance * (2 * Gm * softening.derivative(r2) * distance.dot(velocity));
+                    shortest2 = std::min(shortest2, std::min(r2 * std::sqrt(r2) / (G_para * (mass[i] + mass[j])),
+                                                             r2 / velocity.squaredNorm()));
+                }
+                acceleration[i] = acc;
+                jerk[i] = jrk;
+                timescale[i] = std::sqrt(shortest2);
+            }
+        });
+    }
+};
+
+static void activeGravityJerk(const vector<unsigned>& active, const vector<Vector3d>& pos, const vector<Vector3d>& vel,
+                              const vector<double>& mass, unsigned n_active, vector<Vector3d>& acceleration,
+                              vector<Vector3d>& jerk, vector<double>& timescale) {
+    ActiveGravityJerk sum = { active, pos, vel, mass, n_active, acceleration, jerk, timescale };
+    runForceKernel(sum, softening, softening_length, false);
+    n_force_evaluations += active.size();
+}
+
+// Rung for a body with the given dynamical time: the block step h is halved rung times
+static unsigned rungFor(double timescale, double h) {
+    unsigned rung = 0;
+    double step = h;
+    while (rung < MAX_RUNG && !(step <= dt_accuracy * timescale)) {   // also refines on NaN
+        step /= 2;
+        ++rung;
+    }
+    return rung;
+}
+
+// Hierarchical (power of two) block steps with the 4th order Hermite scheme (Makino & Aarseth 1992).
+// Every body takes steps h / 2^rung, with its rung chosen from its own shortest dynamical time.
+// Time is counted in integer ticks of h / 2^MAX_RUNG; at each tick where some bodies finish their step,
+// all gravity sources are predicted to that time and only the finishing bodies are corrected.
+bool blockHermiteStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                      unsigned n_active, double h) {
+    unsigned n = pos.size();
+    const unsigned block_ticks = 1u << MAX_RUNG;
+    const double tick = h / block_ticks;
+
+    vector<Vector3d> acc(n), jerk(n), acc1(n), jerk1(n), pos_p(pos), vel_p(vel);
+    vector<double> timescale(n);
+    vector<unsigned> rung(n), time(n, 0), active(n);
+    for (unsigned k = 0; k < n; ++k) active[k] = k;
+    activeGravityJerk(active, pos, vel, mass, n_active, acc, jerk, timescale);
+    for (unsigned k = 0; k < n; ++k) rung[k] = rungFor(timescale[k], h);
+
+    unsigned now = 0;
+    while (now < block_ticks) {
+        // the next time at which some bodies finish their step
+        unsigned next = block_ticks;
+        for (unsigned k = 0; k < n; ++k) next = std::min(next, time[k] + (block_ticks >> rung[k]));
+        active.clear();
+        for (unsigned k = 0; k < n; ++k) {
+            if (time[k] + (block_ticks >> rung[k]) == next) active.push_back(k);
+        }
+
+        // predict the gravity sources and the active bodies to that time
+        for (unsigned k = 0; k < n; ++k) {
+            if (k >= n_active && time[k] + (block_ticks >> rung[k]) != next) continue;
+            double t = (next - time[k]) * tick;
+            pos_p[k] = pos[k] + t * (vel[k] + t / 2 * (acc[k] + t / 3 * jerk[k]));
+            vel_p[k] = vel[k] + t * (acc[k] + t / 2 * jerk[k]);
+        }
+
+        // correct the active bodies
+        activeGravityJerk(active, pos_p, vel_p, mass, n_active, acc1, jerk1, timescale);
+        for (unsigned a = 0; a < active.size(); ++a) {
+            unsigned k = active[a];
+            double t = (block_ticks >> rung[k]) * tick;
+            Vector3d vel_new = vel[k] + t / 2 * (acc[k] + acc1[k]) + t * t / 12 * (jerk[k] - jerk1[k]);
+            pos[k] += t / 2 * (vel[k] + vel_new) + t * t / 12 * (acc[k] - acc1[k]);
+            vel[k] = vel_new;
+            pos_p[k] = pos[k];
+            vel_p[k] = vel[k];
+            acc[k] = acc1[k];
+            jerk[k] = jerk1[k];
+            time[k] = next;
+
+            // new rung: smaller steps at any time, a larger step only where it stays aligned to the blocks
+            unsigned wanted = rungFor(timescale[k], h);
+            if (wanted > rung[k]) {
+                rung[k] = wanted;
+            } else if (wanted < rung[k] && next % (block_ticks >> (rung[k] - 1)) == 0) {
+                rung[k] -= 1;
+            }
+        }
+        now = next;
+    }
+    return true;
+}
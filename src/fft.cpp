@@ -0,0 +1,53 @@
+#include "fft.h"
+#include "parallel.h"
+
+#define PARALLEL_MIN_LINES 16   // grid lines per thread below which a 3D transform runs on one thread
+
+void fft(complexd* data, unsigned n, bool inverse) {
+    // bit reversal permutation
+    for (unsigned i = 1, j = 0; i < n; ++i) {
+        unsigned bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(data[i], data[j]);
+    }
+    // butterflies
+    for (unsigned length = 2; length <= n; length <<= 1) {
+        double angle = (inverse ? 2 : -2) * PI_D / length;
+        complexd w_length(std::cos(angle), std::sin(angle));
+        for (unsigned start = 0; start < n; start += length) {
+            complexd w(1.0, 0.0);
+            for (unsigned k = 0; k < length / 2; ++k) {
+                complexd even = data[start + k];
+                complexd odd = data[start + k + length / 2] * w;
+                data[start + k] = even + odd;
+                data[start + k + length / 2] = even - odd;
+                w *= w_length;
+            }
+        }
+    }
+    if (inverse) {
+        for (unsigned i = 0; i < n; ++i) data[i] /= double(n);
+    }
+}
+
+void fft3d(vector<complexd>& grid, unsigned n, bool inverse) {
+    // transform along z, y and x in turn; the lines of one direction are independent
+    const unsigned strides[] = { 1, n, n * n };
+    for (unsigned axis = 0; axis < 3; ++axis) {
+        unsigned stride = strides[axis];
+        parallelFor(n * n, PARALLEL_MIN_LINES, [&](unsigned begin, unsigned end) {
+            vector<complexd> line(n);
+            for (unsigned l = begin; l < end; ++l) {
+                // the two coordinates other than the transformed one
+                unsigned a = l / n, b = l % n;
+                unsigned base = axis == 0 ? (a * n + b) * n
+                              : axis == 1 ? a * n * n + b
+                                          : a * n + b;
+                for (unsigned i = 0; i < n; ++i) line[i] = grid[base + i * stride];
+                fft(&line[0], n, inverse);
+                for (unsigned i = 0; i < n; ++i) grid[base + i * stride] = line[i];
+            }
+        });
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "common_header.h"
+#include <complex>
+
+typedef std::complex<double> complexd;
+
+const double PI_D = 3.14159265358979323846;   // PI to double precision
+
+// In-place radix-2 fast Fourier transform of a sequence whose length is a power of two.
+// The inverse transform is scaled by 1 / n, so inverse(forward(x)) = x.
+void fft(complexd* data, unsigned n, bool inverse);
+
+// In-place 3D FFT of an n * n * n grid stored x-major (index (x * n + y) * n + z), in parallel over grid lines
+void fft3d(vector<complexd>& grid, unsigned n, bool inverse);
@@ -0,0 +1,210 @@
+#include "physics.h"
+#include "multipole.h"
+#include "parallel.h"
+#include <algorithm>
+
+#define FMM_MAX_ORDER        MULTIPOLE_MAX_ORDER   // highest expansion order accepted
+#define FMM_LEAF_SIZE        32   // largest number of bodies in a leaf
+#define FMM_TASK_DEPTH       3    // interactions below this tree depth run as parallel tasks, one per subtree
+#define PARALLEL_MIN_NODES   16   // nodes per thread below which a pass runs on one thread
+
+unsigned fmm_order = 4;
+double fmm_opening_angle = 0.5;
+
+// Cartesian fast multipole method (Greengard & Rokhlin 1987, in the Cartesian Taylor form of Dehnen 2002):
+// every node carries the multipole moments of its bodies about its center of mass and the Taylor
+// coefficients, about the same center, of the potential of the nodes well separated from it.
+// The leaves next to each other interact pair by pair with the softening; the expansions are Newtonian, as the
+// quadrupole and octupole terms of the tree walk, which is exact for the spline beyond its radius.
+class FastMultipole {
+public:
+    FastMultipole(Octree& tree, const vector<Vector3d>& pos, const vector<double>& source_mass, unsigned p)
+        : pos(pos), source_mass(source_mass), index(p), n_terms(index.size()), tree(tree) {
+        updateTree(tree, pos, source_mass, pos.size(), FMM_LEAF_SIZE);
+        unsigned n_nodes = tree.nodes.size();
+        multipole.assign(n_nodes * n_terms, 0.0);
+        local.assign(n_nodes * n_terms, 0.0);
+    }
+
+    template<class Softening> void solve(vector<Vector3d>& acceleration, const Softening& softening) {
+        std::fill(acceleration.begin(), acceleration.end(), Vector3d::Zero());
+
+        // upward pass, one level after the other from the leaves: P2M at the leaves, M2M above
+        for (unsigned l = tree.levels.size() - 1; l-- > 0; ) {
+            parallelFor(tree.levels[l + 1] - tree.levels[l], PARALLEL_MIN_NODES, [&](unsigned begin, unsigned end) {
+                for (unsigned node = tree.levels[l] + begin; node < tree.levels[l] + end; ++node) {
+                    if (tree.nodes[node].n_children == 0) particleToMultipole(node);
+                    else multipoleToMultipole(node);
+                }
+            });
+        }
+
+        // interactions: the dual tree walk down to FMM_TASK_DEPTH, then one task for each subtree below,
+        // which only writes to the local expansions and bodies of its own subtree
+        vector<pair<unsigned, unsigned> > tasks;
+        interact(0, 0, softening, &tasks);
+        std::stable_sort(tasks.begin(), tasks.end(),
+                         [](const pair<unsigned, unsigned>& x, const pair<unsigned, unsigned>& y) { return x.first < y.first; });
+        vector<unsigned> task_begin;
+        for (unsigned t = 0; t < tasks.size(); ++t) {
+            if (t == 0 || tasks[t].first != tasks[t - 1].first) task_begin.push_back(t);
+        }
+        task_begin.push_back(tasks.size());
+        parallelFor(task_begin.size() - 1, 1, [&](unsigned begin, unsigned end) {
+            for (unsigned k = begin; k < end; ++k) {
+                for (unsigned t = task_begin[k]; t < task_begin[k + 1]; ++t) {
+                    interact(tasks[t].first, tasks[t].second, softening, NULL, &acceleration);
+                }
+            }
+        });
+
+        // downward pass, one level after the other from the root: L2L to the children, L2P at the leaves
+        for (unsigned l = 0; l + 1 < tree.levels.size(); ++l) {
+            parallelFor(tree.levels[l + 1] - tree.levels[l], PARALLEL_MIN_NODES, [&](unsigned begin, unsigned end) {
+                for (unsigned node = tree.levels[l] + begin; node < tree.levels[l] + end; ++node) {
+                    if (tree.nodes[node].n_children == 0) localToParticle(node, acceleration);
+                    else localToLocal(node);
+                }
+            });
+        }
+    }
+
+private:
+    const vector<Vector3d>& pos;
+    const vector<double>& source_mass;
+    MultiIndices index;
+    unsigned n_terms;
+    Octree& tree;
+    vector<double> multipole, local;   // n_terms coefficients per node
+
+    void particleToMultipole(unsigned node) {
+        leafMoments(index, tree, node, pos, source_mass, &multipole[node * n_terms]);
+    }
+
+    void multipoleToMultipole(unsigned node) {
+        shiftedMoments(index, tree, node, multipole, &multipole[node * n_terms]);
+    }
+
+    // The local coefficients are kept as the derivatives of the potential, L_k = d^k phi, so phi(z + e) = sum L_k e^k / k!.
+    // L_k(target) += -G sum over |j| <= p - |k| of (-1)^|j| M_j(source) D_(j + k)(target - source center)
+    void multipoleToLocal(unsigned target, unsigned source) {
+        double D[MULTIPOLE_MAX_TERMS], signed_moments[MULTIPOLE_MAX_TERMS];
+        inverseDistanceDerivatives(index, tree.nodes[target].center_of_mass - tree.nodes[source].center_of_mass, D);
+        const double* moments = &multipole[source * n_terms];
+        for (unsigned j = 0; j < n_terms; ++j) signed_moments[j] = index.degree(j) % 2 ? -moments[j] : moments[j];
+        double* coefficients = &local[target * n_terms];
+        for (unsigned k = 0; k < n_terms; ++k) {
+            double sum = 0.0;
+            for (unsigned t = index.sum_begin[k]; t < index.sum_begin[k + 1]; ++t) {
+                sum += signed_moments[index.sum_j[t]] * D[index.sum_m[t]];
+            }
+            coefficients[k] -= G_para * sum;
+        }
+    }
+
+    // L_j(child) += sum over k >= j of L_k(parent) s^(k - j) / (k - j)!, s = child - parent center
+    void localToLocal(unsigned node) {
+        const OctreeNode& current = tree.nodes[node];
+        const double* coefficients = &local[node * n_terms];
+        double s[MULTIPOLE_MAX_TERMS];
+        for (unsigned c = current.first_child; c < current.first_child + current.n_children; ++c) {
+            index.scaledMonomials(tree.nodes[c].center_of_mass - current.center_of_mass, s);
+            double* child = &local[c * n_terms];
+            for (unsigned j = 0; j < n_terms; ++j) {
+                double sum = 0.0;
+                for (unsigned t = index.sum_begin[j]; t < index.sum_begin[j + 1]; ++t) {
+                    sum += coefficients[index.sum_m[t]] * s[index.sum_j[t]];
+                }
+                child[j] += sum;
+            }
+        }
+    }
+
+    // acceleration = -grad phi = -sum L_k grad(e^k / k!)
+    void localToParticle(unsigned node, vector<Vector3d>& acceleration) const {
+        const OctreeNode& current = tree.nodes[node];
+        const double* coefficients = &local[node * n_terms];
+        double e[MULTIPOLE_MAX_TERMS];
+        for (unsigned b = current.body_begin; b < current.body_end; ++b) {
+            unsigned i = tree.bodies[b];
+            index.scaledMonomials(pos[i] - current.center_of_mass, e);
+            Vector3d gradient = Vector3d::Zero();
+            for (unsigned k = 1; k < n_terms; ++k) {
+                if (index.lower_x[k] >= 0) gradient.x() += coefficients[k] * e[index.lower_x[k]];
+                if (index.lower_y[k] >= 0) gradient.y() += coefficients[k] * e[index.lower_y[k]];
+                if (index.lower_z[k] >= 0) gradient.z() += coefficients[k] * e[index.lower_z[k]];
+            }
+            acceleration[i] -= gradient;
+        }
+    }
+
+    // direct sum from the bodies of the source leaf on the bodies of the target leaf
+    template<class Softening> void particleToParticle(unsigned target, unsigned source, const Softening& softening,
+                                                      vector<Vector3d>& acceleration) const {
+        const OctreeNode& to = tree.nodes[target];
+        const OctreeNode& from = tree.nodes[source];
+        for (unsigned b = to.body_begin; b < to.body_end; ++b) {
+            unsigned i = tree.bodies[b];
+            Vector3d acc = Vector3d::Zero();
+            for (unsigned c = from.body_begin; c < from.body_end; ++c) {
+                unsigned j = tree.bodies[c];
+                Vector3d distance = pos[j] - pos[i];
+                double r2 = distance.squaredNorm();
+                if (j == i || r2 == 0.0 || source_mass[j] == 0.0) continue;
+                acc += distance * (G_para * source_mass[j] * softening.factor(r2));
+            }
+            acceleration[i] += acc;
+        }
+    }
+
+    // Dual tree walk: well-separated pairs of nodes interact through their expansions (M2L), pairs of leaves
+    // directly (P2P), and otherwise the larger node is split. Pairs whose target is at FMM_TASK_DEPTH or a leaf
+    // are collected in tasks instead, if given.
+    template<class Softening> void interact(unsigned target, unsigned source, const Softening& softening,
+                                            vector<pair<unsigned, unsigned> >* tasks,
+                                            vector<Vector3d>* acceleration = NULL) {
+        const OctreeNode& to = tree.nodes[target];
+        const OctreeNode& from = tree.nodes[source];
+        if (from.mass == 0.0) return;
+        if (tasks != NULL && (to.depth >= FMM_TASK_DEPTH || to.n_children == 0)) {
+            tasks->push_back(std::make_pair(target, source));
+            return;
+        }
+        double distance = (to.center_of_mass - from.center_of_mass).norm();
+        if (to.radius + from.radius < fmm_opening_angle * distance) {
+            multipoleToLocal(target, source);
+        } else if (to.n_children == 0 && from.n_children == 0) {
+            particleToParticle(target, source, softening, *acceleration);
+        } else if (from.n_children == 0 || (to.n_children > 0 && to.radius >= from.radius)) {
+            for (unsigned c = to.first_child; c < to.first_child + to.n_children; ++c) {
+                interact(c, source, softening, tasks, acceleration);
+            }
+        } else {
+            for (unsigned c = from.first_child; c < from.first_child + from.n_children; ++c) {
+                interact(target, c, softening, tasks, acceleration);
+            }
+        }
+    }
+};
+
+// The solver, as a force kernel for runForceKernel() (always in double precision)
+struct FastMultipoleSolve {
+    FastMultipole& fmm;
+    vector<Vector3d>& acceleration;
+
+    template<class Softening, class Precision> void run(const Softening& softening) const {
+        fmm.solve(acceleration, softening);
+    }
+};
+
+void fastMultipoleGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                          vector<Vector3d>& acceleration) {
+    // passive bodies are targets only: they are in the tree with no mass
+    vector<double> source_mass(mass.begin(), mass.end());
+    std::fill(source_mass.begin() + n_active, source_mass.end(), 0.0);
+    static Octree tree;   // kept between calls and refitted while the bodies stay the same
+    FastMultipole fmm(tree, pos, source_mass, std::max(1u, std::min(fmm_order, unsigned(FMM_MAX_ORDER))));
+    FastMultipoleSolve solve = { fmm, acceleration };
+    runForceKernel(solve, softening, softening_length, false);
+    n_force_evaluations += pos.size();
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "common_header.h"
+
+#define FORCE_TILE_SIZE  16      // sources per tile of the mixed precision direct sum
+#define MIXED_PRECISION_MAX_ERROR 1E-5  // largest 99th percentile relative error of the mixed precision direct sum
+#define FORCE_MIN_R2     1E-20f  // squared float distances are at least this, so a body adds nothing to itself
+#define SPLINE_LENGTHS   2.8     // spline softening: the force is Newtonian beyond this many softening lengths
+
+// Force laws of the direct sum and the tree walks
+enum softening_t {
+    NO_SOFTENING,      // point masses, 1 / r^2
+    PLUMMER_SOFTENING, // 1 / (r^2 + eps^2) times r / sqrt(r^2 + eps^2); never Newtonian
+    SPLINE_SOFTENING,  // cubic spline kernel (GADGET-2): Newtonian beyond SPLINE_LENGTHS eps
+    N_SOFTENINGS
+};
+
+// Softening policies of the force kernels: factor(r2) is the force per unit mass and distance, 1 / r^3 for a
+// point mass, at the squared distance r2, for a double or an Eigen array of floats; derivative(r2) is its
+// derivative by r2 (in double), for the jerk of the Hermite schemes. They are chosen at run time once per force
+// evaluation (runForceKernel()), so every variant of a kernel has its own branch-free inner loop.
+struct NoSoftening {
+    explicit NoSoftening(double) {}
+    double factor(double r2) const {
+        return 1 / (r2 * std::sqrt(r2));
+    }
+    double derivative(double r2) const {
+        return -1.5 / (r2 * r2 * std::sqrt(r2));
+    }
+    template<class Array> Array factor(const Array& r2) const {
+        return (r2 * r2.sqrt()).inverse();
+    }
+};
+
+// Plummer softening: the force of a point mass smeared out over the softening length eps, 1 / (r^2 + eps^2)^(3/2)
+struct PlummerSoftening {
+    double eps2;
+    float eps2_float;
+    explicit PlummerSoftening(double length) : eps2(length * length), eps2_float(float(length * length)) {}
+    double factor(double r2) const {
+        double s = r2 + eps2;
+        return 1 / (s * std::sqrt(s));
+    }
+    double derivative(double r2) const {
+        double s = r2 + eps2;
+        return -1.5 / (s * s * std::sqrt(s));
+    }
+    template<class Array> Array factor(const Array& r2) const {
+        Array s = r2 + eps2_float;
+        return (s * s.sqrt()).inverse();
+    }
+};
+
+// Cubic spline softening as in GADGET-2: the mass is spread over a sphere of radius h = SPLINE_LENGTHS eps
+// (the same central potential as Plummer softening with eps), and the force is exactly Newtonian beyond it
+struct SplineSoftening {
+    double inverse_h, inverse_h3;
+    explicit SplineSoftening(double length)
+        : inverse_h(1 / (SPLINE_LENGTHS * length)), inverse_h3(inverse_h * inverse_h * inverse_h) {}
+    double factor(double r2) const {
+        double r = std::sqrt(r2), u = r * inverse_h;
+        double inner = inverse_h3 * (10.666666666667 + u * u * (32.0 * u - 38.4));
+        double outer = inverse_h3 * (21.333333333333 - 48.0 * u + 38.4 * u * u - 10.666666666667 * u * u * u
+                                     - 0.066666666667 / (u * u * u));
+        return u < 0.5 ? inner : u < 1.0 ? outer : 1 / (r2 * r);
+    }
+    double derivative(double r2) const {
+        double r = std::sqrt(r2), u = r * inverse_h;
+        double inner = inverse_h3 * u * (96.0 * u - 76.8);   // d factor / du, then du / dr2 = 1 / (2 h r)
+        double outer = inverse_h3 * (-48.0 + 76.8 * u - 32.0 * u * u + 0.2 / (u * u * u * u));
+        return u < 0.5 ? inner * inverse_h / (2 * r) : u < 1.0 ? outer * inverse_h / (2 * r) : -1.5 / (r2 * r2 * r);
+    }
+    template<class Array> Array factor(const Array& r2) const {
+        Array r = r2.sqrt(), u = r * float(inverse_h);
+        Array inner = float(inverse_h3) * (10.666666666667f + u * u * (32.0f * u - 38.4f));
+        Array outer = float(inverse_h3) * (21.333333333333f - 48.0f * u + 38.4f * u * u - 10.666666666667f * u * u * u
+                                           - 0.066666666667f * (u * u * u).inverse());
+        return (u < 0.5f).select(inner, (u < 1.0f).select(outer, (r2 * r).inverse()));
+    }
+};
+
+// Precision policies: pairs in double, or in float about double tile origins (SourceTiles)
+struct DoublePrecision {
+    static const bool mixed = false;
+};
+struct MixedPrecision {
+    static const bool mixed = true;
+};
+
+// Call kernel.run<Softening, Precision>(softening) with the policies for the given settings; every combination
+// is instantiated. The kernel is a class with a template member run(), which does the force evaluation.
+template<class Kernel> void runForceKernel(const Kernel& kernel, softening_t softening, double softening_length,
+                                          bool mixed) {
+    switch (softening) {
+    case PLUMMER_SOFTENING:
+        if (mixed) kernel.template run<PlummerSoftening, MixedPrecision>(PlummerSoftening(softening_length));
+        else kernel.template run<PlummerSoftening, DoublePrecision>(PlummerSoftening(softening_length));
+        break;
+    case SPLINE_SOFTENING:
+        if (mixed) kernel.template run<SplineSoftening, MixedPrecision>(SplineSoftening(softening_length));
+        else kernel.template run<SplineSoftening, DoublePrecision>(SplineSoftening(softening_length));
+        break;
+    default:
+        if (mixed) kernel.template run<NoSoftening, MixedPrecision>(NoSoftening(softening_length));
+        else kernel.template run<NoSoftening, DoublePrecision>(NoSoftening(softening_length));
+        break;
+    }
+}
+
+// Gravity sources for the mixed precision kernel, in tiles of up to SIZE sources: each tile has a double
+// origin, and the positions of its sources relative to it and their G m relative to the largest of the tile
+// (kept in double, so masses far outside the range of float still work) are stored in float, so the pair
+// interactions run on SIMD float packets (twice as many lanes as double). Unused places of a tile have no mass.
+//
+// Error: rounding the offsets from the origin to float moves a pair's displacement by about 2^-24 times
+// the distance of the two bodies from the origin, so a pair force is off by a few 1E-7 relative to itself
+// when the bodies are farther apart than the extent of the tile, and by up to 2^-24 extent / distance
+// closer than that; tiles of bodies close in space (Morton order, tree leaves) keep that small. The float sum
+// over a tile adds about SIZE 2^-24 of the sum of the magnitudes of its forces, so the tiles are small
+// (FORCE_TILE_SIZE, OCTREE_LEAF_SIZE) and summed in double. Where the pull of the bodies cancels these errors are
+// large relative to the acceleration: on the Plummer sphere and the uniform cube of --gravity-bench, 99% of the
+// bodies are within MIXED_PRECISION_MAX_ERROR of the double precision direct sum, which the benchmark checks.
+template<int SIZE> class SourceTiles {
+public:
+    typedef Eigen::Array<float, SIZE, 1> TileArray;
+
+    void clear() {
+        origin.clear();
+        scale.clear();
+        tiles.clear();
+        index.clear();
+    }
+    unsigned size() const { return origin.size(); }
+
+    // Append the sources pos[bodies[k]], k < count, about the given origin; returns the index of their first tile.
+    // With radius, the tiles also hold the radii and indices of the bodies for the collision test.
+    unsigned add(const vector<Vector3d>& pos, const vector<double>& mass, double G, const unsigned* bodies,
+                 unsigned count, const Vector3d& tile_origin, const vector<double>* radius = NULL) {
+        unsigned first = size();
+        for (unsigned begin = 0; begin < count; begin += SIZE) {
+            Tile tile;
+            tile.x.setZero();
+            tile.y.setZero();
+            tile.z.setZero();
+            tile.w.setZero();
+            tile.r.setZero();
+            if (radius != NULL) index.resize(index.size() + SIZE, ~0u);
+            double largest = 0.0;
+            unsigned end = std::min(count, begin + SIZE);
+            for (unsigned k = begin; k < end; ++k) largest = std::max(largest, G * mass[bodies[k]]);
+            if (largest == 0.0) largest = 1.0;
+            for (unsigned k = begin; k < end; ++k) {
+                Vector3d offset = pos[bodies[k]] - tile_origin;
+                tile.x[k - begin] = float(offset.x());
+                tile.y[k - begin] = float(offset.y());
+                tile.z[k - begin] = float(offset.z());
+                tile.w[k - begin] = float(G * mass[bodies[k]] / largest);
+                if (radius == NULL) continue;
+                tile.r[k - begin] = float((*radius)[bodies[k]]);
+                index[index.size() - SIZE + k - begin] = bodies[k];
+            }
+            origin.push_back(tile_origin);
+            scale.push_back(largest);
+            tiles.push_back(tile);
+        }
+        return first;
+    }
+
+    // Acceleration at target from the sources of one tile, summed in float. With COLLISIONS (tiles added with
+    // radii), first becomes the lowest index of a source other than body i overlapping it, if that is lower.
+    template<class Softening, bool COLLISIONS>
+    Vector3d acceleration(unsigned t, const Vector3d& target, const Softening& softening,
+                          unsigned i = 0, double radius = 0.0, unsigned* first = NULL) const {
+        const Tile& tile = tiles[t];
+        Vector3f offset = (target - origin[t]).cast<float>();
+        TileArray dx = tile.x - offset.x(), dy = tile.y - offset.y(), dz = tile.z - offset.z();
+        TileArray r2 = (dx * dx + dy * dy + dz * dz).max(FORCE_MIN_R2);
+        if (COLLISIONS) {
+            TileArray reach = tile.r + float(radius);
+            if ((r2 - reach * reach).minCoeff() < 0) {   // arithmetic, so it runs on packets
+                for (unsigned k = 0; k < SIZE; ++k) {
+                    unsigned j = index[t * SIZE + k];
+                    if (j != i && j < *first && r2[k] < reach[k] * reach[k]) *first = j;
+                }
+            }
+        }
+        TileArray factor = tile.w * softening.factor(r2);
+        return scale[t] * Vector3d((dx * factor).sum(), (dy * factor).sum(), (dz * factor).sum());
+    }
+
+private:
+    struct Tile {
+        TileArray x, y, z, w, r;   // offsets from the origin, G m / scale and (for collisions) radii
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    vector<Vector3d> origin;
+    vector<double> scale;          // largest G m of each tile
+    vector<Tile, Eigen::aligned_allocator<Tile> > tiles;
+    vector<unsigned> index;        // for collisions: body of each place of each tile (~0 if unused)
+};
@@ -0,0 +1,114 @@
+#include "physics.h"
+
+// Yoshida composition weights: the leapfrog steps of a 4th/6th order scheme are
+// w1 w0 w1 and w3 w2 w1 w0 w1 w2 w3 (times h), where w0 makes the weights sum to 1
+static const double YOSHIDA4_W1 = 1.0 / (2.0 - std::cbrt(2.0));
+static const double YOSHIDA4_WEIGHTS[] = { YOSHIDA4_W1, 1.0 - 2.0 * YOSHIDA4_W1, YOSHIDA4_W1 };
+static const double YOSHIDA6_W1 = -1.17767998417887;
+static const double YOSHIDA6_W2 = 0.235573213359357;
+static const double YOSHIDA6_W3 = 0.784513610477560;
+static const double YOSHIDA6_W0 = 1.0 - 2.0 * (YOSHIDA6_W1 + YOSHIDA6_W2 + YOSHIDA6_W3);
+static const double YOSHIDA6_WEIGHTS[] = { YOSHIDA6_W3, YOSHIDA6_W2, YOSHIDA6_W1, YOSHIDA6_W0,
+                                           YOSHIDA6_W1, YOSHIDA6_W2, YOSHIDA6_W3 };
+
+// The acceleration and jerk sum, as a force kernel for runForceKernel() (always in double precision):
+// with a = G m d f(r^2), the jerk is G m (v f(r^2) + d 2 (d . v) f'(r^2)), v the relative velocity
+struct GravityJerk {
+    const vector<Vector3d>& pos;
+    const vector<Vector3d>& vel;
+    const vector<double>& mass;
+    unsigned n_active;
+    vector<Vector3d>& acceleration;
+    vector<Vector3d>& jerk;
+
+    template<class Softening, class Precision> void run(const Softening& softening) const {
+        for (unsigned i = 0; i < pos.size(); ++i) {
+            acceleration[i] = Vector3d::Zero();
+            jerk[i] = Vector3d::Zero();
+            for (unsigned j = 0; j < n_active; ++j) {
+                if (j == i) continue;
+                Vector3d distance = pos[j] - pos[i];
+                Vector3d velocity = vel[j] - vel[i];
+                double r2 = distance.squaredNorm();
+                if (r2 == 0.0) continue;
+                double Gm = G_para * mass[j], Gm_f = Gm * softening.factor(r2);
+                acceleration[i] += distance * Gm_f;
+                jerk[i] += velocity * Gm_f + distance * (2 * Gm * softening.derivative(r2) * distance.dot(velocity));
+            }
+        }
+    }
+};
+
+void gravityJerk(const vector<Vector3d>& pos, const vector<Vector3d>& vel, const vector<double>& mass,
+                 unsigned n_active, vector<Vector3d>& acceleration, vector<Vector3d>& jerk) {
+    GravityJerk sum = { pos, vel, mass, n_active, acceleration, jerk };
+    runForceKernel(sum, softening, softening_length, false);
+    n_force_evaluations += pos.size();
+}
+
+// Fourth order Hermite predictor-corrector (Makino & Aarseth 1992): predict with the
+// acceleration and jerk at the start of the step, correct with those at the predicted state.
+static bool hermiteStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                        unsigned n_active, double h) {
+    unsigned n = pos.size();
+    vector<Vector3d> acc0(n), jerk0(n), acc1(n), jerk1(n), pos_p(n), vel_p(n);
+    gravityJerk(pos, vel, mass, n_active, acc0, jerk0);
+    for (unsigned k = 0; k < n; ++k) {
+        pos_p[k] = pos[k] + h * (vel[k] + h / 2 * (acc0[k] + h / 3 * jerk0[k]));
+        vel_p[k] = vel[k] + h * (acc0[k] + h / 2 * jerk0[k]);
+    }
+    gravityJerk(pos_p, vel_p, mass, n_active, acc1, jerk1);
+    for (unsigned k = 0; k < n; ++k) {
+        Vector3d vel_new = vel[k] + h / 2 * (acc0[k] + acc1[k]) + h * h / 12 * (jerk0[k] - jerk1[k]);
+        pos[k] += h / 2 * (vel[k] + vel_new) + h * h / 12 * (acc0[k] - acc1[k]);
+        vel[k] = vel_new;
+    }
+    return true;
+}
+
+// Symmetric composition of drift-kick-drift leapfrog steps of sizes weights[s] * h (Yoshida 1990)
+static void yoshidaStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                        unsigned n_active, double h, const double* weights, unsigned n_stages) {
+    unsigned n = pos.size();
+    vector<Vector3d> acceleration(n);
+    for (unsigned s = 0; s < n_stages; ++s) {
+        double hs = weights[s] * h;
+        for (unsigned k = 0; k < n; ++k) pos[k] += vel[k] * (hs / 2);
+        gravity(pos, mass, n_active, acceleration);
+        for (unsigned k = 0; k < n; ++k) {
+            vel[k] += acceleration[k] * hs;
+            pos[k] += vel[k] * (hs / 2);
+        }
+    }
+}
+
+static bool yoshida4Step(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                         unsigned n_active, double h) {
+    yoshidaStep(pos, vel, mass, n_active, h, YOSHIDA4_WEIGHTS, 3);
+    return true;
+}
+
+static bool yoshida6Step(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                         unsigned n_active, double h) {
+    yoshidaStep(pos, vel, mass, n_active, h, YOSHIDA6_WEIGHTS, 7);
+    return true;
+}
+
+integrator_step_t integratorStep(integrator_t integrator) {
+    switch (integrator) {
+    case WISDOM_HOLMAN:
+        return wisdomHolmanStep;
+    case HERMITE4:
+        return hermiteStep;
+    case YOSHIDA4:
+        return yoshida4Step;
+    case YOSHIDA6:
+        return yoshida6Step;
+    case BLOCK_HERMITE4:
+        return blockHermiteStep;
+    case RESPA:
+        return respaStep;
+    default:
+        return NULL;
+    }
+}
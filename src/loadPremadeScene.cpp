@@ -1,12 +1,145 @@
 #include "common_header.h"
 #include "object_class.h"
+#include "physics.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdlib>
 
 const string examplesPath = "./data/examples/";
-extern double dt;
-extern vector<Object> objects;
+extern SlotMap<Object> objects;
 
+// The settings a scene file may change, so that a scene loaded into an empty simulation starts from the
+// defaults rather than from the settings of the scenes simulated before
+struct SceneSettings {
+    integrator_t integrator;
+    bool adaptive_dt;
+    unsigned respa_far_interval;
+    double respa_split_radius;
+    gravity_solver_t gravity_solver;
+    unsigned pm_grid_size;
+    mass_assignment_t pm_assignment;
+    bool pm_periodic;
+    double pm_box_size;
+    double tree_opening_angle;
+    opening_criterion_t tree_opening_criterion;
+    double tree_force_accuracy;
+    unsigned tree_multipole_order;
+    double treepm_split_cells;
+    double treepm_cutoff;
+    unsigned fmm_order;
+    double fmm_opening_angle;
+    unsigned body_sort_interval;
+    double body_sort_disorder;
+    double tree_rebuild_overlap;
+    bool reproducible_forces;
+    bool mixed_precision_forces;
+    softening_t softening;
+    double softening_length;
+    bool ks_regularization;
+    double ks_perturbation;
+    collision_mode_t collision_mode;
+};
+
+static SceneSettings currentSceneSettings() {
+    SceneSettings settings;
+    settings.integrator = integrator;
+    settings.adaptive_dt = adaptive_dt;
+    settings.respa_far_interval = respa_far_interval;
+    settings.respa_split_radius = respa_split_radius;
+    settings.gravity_solver = gravity_solver;
+    settings.pm_grid_size = pm_grid_size;
+    settings.pm_assignment = pm_assignment;
+    settings.pm_periodic = pm_periodic;
+    settings.pm_box_size = pm_box_size;
+    settings.tree_opening_angle = tree_opening_angle;
+    settings.tree_opening_criterion = tree_opening_criterion;
+    settings.tree_force_accuracy = tree_force_accuracy;
+    settings.tree_multipole_order = tree_multipole_order;
+    settings.treepm_split_cells = treepm_split_cells;
+    settings.treepm_cutoff = treepm_cutoff;
+    settings.fmm_order = fmm_order;
+    settings.fmm_opening_angle = fmm_opening_angle;
+    settings.body_sort_interval = body_sort_interval;
+    settings.body_sort_disorder = body_sort_disorder;
+    settings.tree_rebuild_overlap = tree_rebuild_overlap;
+    settings.reproducible_forces = reproducible_forces;
+    settings.mixed_precision_forces = mixed_precision_forces;
+    settings.softening = softening;
+    settings.softening_length = softening_length;
+    settings.ks_regularization = ks_regularization;
+    settings.ks_perturbation = ks_perturbation;
+    settings.collision_mode = collision_mode;
+    return settings;
+}
+
+static void applySceneSettings(const SceneSettings& settings) {
+    integrator = settings.integrator;
+    adaptive_dt = settings.adaptive_dt;
+    respa_far_interval = settings.respa_far_interval;
+    respa_split_radius = settings.respa_split_radius;
+    gravity_solver = settings.gravity_solver;
+    pm_grid_size = settings.pm_grid_size;
+    pm_assignment = settings.pm_assignment;
+    pm_periodic = settings.pm_periodic;
+    pm_box_size = settings.pm_box_size;
+    tree_opening_angle = settings.tree_opening_angle;
+    tree_opening_criterion = settings.tree_opening_criterion;
+    tree_force_accuracy = settings.tree_force_accuracy;
+    tree_multipole_order = settings.tree_multipole_order;
+    treepm_split_cells = settings.treepm_split_cells;
+    treepm_cutoff = settings.treepm_cutoff;
+    fmm_order = settings.fmm_order;
+    fmm_opening_angle = settings.fmm_opening_angle;
+    body_sort_interval = settings.body_sort_interval;
+    body_sort_disorder = settings.body_sort_disorder;
+    tree_rebuild_overlap = settings.tree_rebuild_overlap;
+    reproducible_forces = settings.reproducible_forces;
+    mixed_precision_forces = settings.mixed_precision_forces;
+    softening = settings.softening;
+    softening_length = settings.softening_length;
+    ks_regularization = settings.ks_regularization;
+    ks_perturbation = settings.ks_perturbation;
+    collision_mode = settings.collision_mode;
+}
+
+// taken before main() runs, while the globals still hold their initial values
+static const SceneSettings default_settings = currentSceneSettings();
+
+// Scene file format: the number of objects on the first line, then one object per line:
+//   radius x y z vx vy vz color_r color_g color_b density light [passive]
+// The optional "passive" column is 1 for a test particle (feels gravity but exerts none)
+// and 0 for a body that always exerts gravity; without it this is decided from the body's mass.
+// The objects may be followed by settings lines "keyword value"; other lines are ignored. Loaded into an
+// empty simulation, a scene starts from the default settings; loaded on top of other objects, it changes only
+// the settings it gives:
+//   integrator verlet|wisdom_holman|hermite4|yoshida4|yoshida6|block_hermite4|respa
+//   adaptive_dt 0|1
+//   respa_far_interval 4
+//   respa_split_radius 20
+//   gravity_solver direct|pm|tree|treepm|fmm
+//   pm_grid_size 64
+//   pm_assignment cic|tsc
+//   pm_periodic 0|1
+//   pm_box_size 1000
+//   tree_opening_angle 0.5
+//   tree_opening_criterion angle|bmax|relative
+//   tree_force_accuracy 0.0025
+//   tree_multipole_order 1|2|3
+//   treepm_split_cells 1.25
+//   treepm_cutoff 4.5
+//   fmm_order 4
+//   fmm_opening_angle 0.5
+//   body_sort_interval 100
+//   body_sort_disorder 2
+//   tree_rebuild_overlap 1.5
+//   reproducible_forces 0|1
+//   mixed_precision_forces 0|1
+//   softening none|plummer|spline
+//   softening_length 1
+//   ks_regularization 0|1
+//   ks_perturbation 0.05
+//   collisions elastic|merge
 int loadPremadeScene(string sceneFilename) {
     try {
         std::ifstream sceneFile((examplesPath + sceneFilename).c_str());
@@ -15,20 +148,30 @@ int loadPremadeScene(string sceneFilename) {
             sceneFile.open(("../" + examplesPath + sceneFilename).c_str());
         }
         if (!sceneFile.good()) throw 1;
+        // scenes are added to what is simulated: only the first one starts from the default settings
+        if (objects.empty()) applySceneSettings(default_settings);
 
         unsigned n_objects;
         sceneFile >> n_objects;
 
-        for (unsigned i = 0; i < n_objects; ++i) {	
+        // the objects are added to the scene together once they are all read
+        vector<Object> loaded;
+        loaded.reserve(n_objects);
+        string line;
+        for (unsigned i = 0; i < n_objects && std::getline(sceneFile, line); ) {
+            std::istringstream lineStream(line);
             double r, x, y, z, vx, vy, vz, c_r, c_g, c_b, density, x_last, y_last, z_last;
-            int light;
-            sceneFile >> r >> x >> y >> z >> vx >> vy >> vz >> c_r >> c_g >> c_b >> density >> light;
+            int light, passive;
+            if (!(lineStream >> r >> x >> y >> z >> vx >> vy >> vz >> c_r >> c_g >> c_b >> density >> light)) {
+                continue; // empty line
+            }
             x_last = x - dt * vx;
             y_last = y - dt * vy;
             z_last = z - dt * vz;
 
             Object temp(Object(6));
             temp.collision_radius = r;
+            temp.default_radius = false;
             temp.translateX = x;
             temp.translateY = y;
             temp.translateZ = z;
@@ -40,8 +183,111 @@ int loadPremadeScene(string sceneFilename) {
             temp.colorB = c_b;
             temp.density = density;
             temp.updateMass();
+            if (lineStream >> passive) {
+                temp.gravity_source = passive ? PASSIVE_SOURCE : ACTIVE_SOURCE;
+            }
+
+            loaded.push_back(temp);
+            ++i;
+        }
+        objects.insert(loaded.begin(), loaded.end());
 
-            objects.insert(objects.end() - 1, temp);
+        // scene settings
+        while (std::getline(sceneFile, line)) {
+            std::istringstream lineStream(line);
+            string keyword, value;
+            if (!(lineStream >> keyword >> value)) continue;
+            if (keyword == "integrator") {
+                if (integratorFromKeyword(value, integrator)) {
+                    std::cout << "Integrator: " << integratorName(integrator) << std::endl;
+                } else {
+                    std::cerr << "Unknown integrator \"" << value << "\" in " << sceneFilename << std::endl;
+                }
+            } else if (keyword == "adaptive_dt") {
+                adaptive_dt = value != "0";
+            } else if (keyword == "respa_far_interval") {
+                respa_far_interval = std::max(1, atoi(value.c_str()));
+            } else if (keyword == "respa_split_radius") {
+                double radius = atof(value.c_str());
+                if (radius > 0) respa_split_radius = radius;
+            } else if (keyword == "gravity_solver") {
+                if (gravitySolverFromKeyword(value, gravity_solver)) {
+                    std::cout << "Gravity solver: " << gravitySolverName(gravity_solver) << std::endl;
+                } else {
+                    std::cerr << "Unknown gravity solver \"" << value << "\" in " << sceneFilename << std::endl;
+                }
+            } else if (keyword == "pm_grid_size") {
+                unsigned size = atoi(value.c_str());
+                if (size >= 16 && (size & (size - 1)) == 0) {
+                    pm_grid_size = size;
+                } else {
+                    std::cerr << "pm_grid_size must be a power of two of at least 16" << std::endl;
+                }
+            } else if (keyword == "pm_assignment") {
+                if (massAssignmentFromKeyword(value, pm_assignment)) {
+                    std::cout << "Mass assignment: " << massAssignmentName(pm_assignment) << std::endl;
+                } else {
+                    std::cerr << "Unknown mass assignment \"" << value << "\" in " << sceneFilename << std::endl;
+                }
+            } else if (keyword == "pm_periodic") {
+                pm_periodic = value != "0";
+            } else if (keyword == "pm_box_size") {
+                double size = atof(value.c_str());
+                if (size > 0) pm_box_size = size;
+            } else if (keyword == "tree_opening_angle") {
+                tree_opening_angle = atof(value.c_str());
+            } else if (keyword == "tree_opening_criterion") {
+                if (value == "angle") tree_opening_criterion = OPENING_ANGLE;
+                else if (value == "bmax") tree_opening_criterion = OPENING_BMAX;
+                else if (value == "relative") tree_opening_criterion = OPENING_RELATIVE;
+            } else if (keyword == "tree_force_accuracy") {
+                tree_force_accuracy = atof(value.c_str());
+            } else if (keyword == "tree_multipole_order") {
+                int order = atoi(value.c_str());
+                if (order >= 1 && order <= 3) tree_multipole_order = order;
+            } else if (keyword == "treepm_split_cells") {
+                double split = atof(value.c_str());
+                if (split > 0) treepm_split_cells = split;
+            } else if (keyword == "treepm_cutoff") {
+                treepm_cutoff = atof(value.c_str());
+            } else if (keyword == "fmm_order") {
+                int order = atoi(value.c_str());
+                if (order >= 1 && order <= 8) fmm_order = order;
+            } else if (keyword == "fmm_opening_angle") {
+                fmm_opening_angle = atof(value.c_str());
+            } else if (keyword == "body_sort_interval") {
+                body_sort_interval = std::max(0, atoi(value.c_str()));
+            } else if (keyword == "body_sort_disorder") {
+                double disorder = atof(value.c_str());
+                if (disorder > 1) body_sort_disorder = disorder;
+            } else if (keyword == "tree_rebuild_overlap") {
+                double overlap = atof(value.c_str());
+                if (overlap > 1) tree_rebuild_overlap = overlap;
+            } else if (keyword == "reproducible_forces") {
+                reproducible_forces = value != "0";
+            } else if (keyword == "mixed_precision_forces") {
+                mixed_precision_forces = value != "0";
+            } else if (keyword == "softening") {
+                if (softeningFromKeyword(value, softening)) {
+                    std::cout << "Softening: " << softeningName(softening) << std::endl;
+                } else {
+                    std::cerr << "Unknown softening \"" << value << "\" in " << sceneFilename << std::endl;
+                }
+            } else if (keyword == "softening_length") {
+                double length = atof(value.c_str());
+                if (length > 0) softening_length = length;
+            } else if (keyword == "ks_regularization") {
+                ks_regularization = value != "0";
+            } else if (keyword == "ks_perturbation") {
+                double perturbation = atof(value.c_str());
+                if (perturbation > 0) ks_perturbation = perturbation;
+            } else if (keyword == "collisions") {
+                if (collisionModeFromKeyword(value, collision_mode)) {
+                    std::cout << "Collisions: " << collisionModeName(collision_mode) << std::endl;
+                } else {
+                    std::cerr << "Unknown collision mode \"" << value << "\" in " << sceneFilename << std::endl;
+                }
+            }
         }
 
         sceneFile.close();
@@ -50,4 +296,4 @@ int loadPremadeScene(string sceneFilename) {
         std::cerr << "Error opening file." << std::endl;
         return -1;
     }
-}
\ No newline at end of file
+}
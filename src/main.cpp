@@ -3,14 +3,18 @@
 // classes
 #include "camera.h"
 #include "object_class.h"
+#include "physics.h"
+#include "mesh_processing.h"
 // assets file loaders
-#include "OBJ_Loader.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "asset_loader.h"
+#include "benchmarks.h"
+#include "octree.h"
 // STL headers
 #include <iostream>
 #include <fstream>
 #include <utility>
+#include <cstddef>
+#include <cstdlib>
 
 // GLFW is necessary to handle the OpenGL context
 #include <GLFW/glfw3.h>
@@ -37,36 +41,44 @@
 #define LAUNCH_SPEED_CHANGE_STEP 1E-2    // hand object launch speed adjustment speed
 #define LAUNCH_SPEED_THREASHOLD  1E-1    // hand object launch speed adjustment threashold
 
+#define SIMULATED_TIME_PER_FRAME 1E-2    // simulated time per frame (taken in one or more physics steps)
+
 #define MOUSE_SENSITIVITY        1.0     // mouse sensitivity
 
 #define HAND_POSITION_X          1.0     // "hand" position on screen X
 #define HAND_POSITION_Y          -0.7    // "hand" position on screen Y
 
-const string dataPath = "./data/";       // path for data files
+const string shaderCachePath = "./shader_cache";  // directory for linked shader program binaries
+
+#define ASSET_UPLOAD_BUDGET      4E-3    // time per frame (seconds) spent uploading loaded assets to the GPU
+#define MAX_LOADER_THREADS       4       // maximum number of background asset loader threads
+
+#define N_MODELS                 7       // number of model meshes loaded from files
+#define PLACEHOLDER_MODEL        N_MODELS // generated sphere drawn in place of models that are still loading
+
+#define NO_HIGHLIGHTED SlotHandle()    // handle of no object
 
-#define NO_HIGHLIGHTED -1
+#define HAND_OBJECT 0                 // places in hud
+#define SPEED_ARROW 1
 
 // VertexBufferObject wrappers; corresponds to meshes
-vector<VertexBufferObject> VBO;     // vertex coords
-vector<VertexBufferObject> VBO_N;   // vertex normals
-vector<VertexBufferObject> VBO_T;   // vertex texture coords
+vector<VertexBufferObject> VBO;     // interleaved quantized vertices (coords, normals, texture coords)
 // ElementBufferObject wrappers
 vector<ElementBufferObject> EBO;
 
 vector<Mesh> meshes;          // list to store all model meshes
-vector<Object> objects;       // list to store all objects
-                              // (store structure: 
-                              //  static objects that does not participate in physics simulation, 
-                              //  objects in the scene that participate in physics simulation,
-                              //  hand object)
+vector<Object> scenery;       // static objects that does not participate in physics simulation
+SlotMap<Object> objects;      // objects in the scene that participate in physics simulation
+vector<Object> hud;           // the object in hand (drawn in the scene) and the HUD indicators
 
 vector<unsigned> textures;    // list to store texture IDs
 
-void physics(unsigned start_index, unsigned end_index);
+AssetLoader assetLoader;      // background loader of meshes and textures
+
 
 Camera camera;
 
-int highlighted = NO_HIGHLIGHTED;
+SlotHandle highlighted;       // the selected object of objects, if any
 bool blinkHighlight = true;
 
 float cameraMoveSpeed = CAMERA_PAN_FRAME_STEP;  // The initial movement speed
@@ -74,219 +86,72 @@ float launchSpeed = 1E-1;                        // The initial object launch sp
 
 int loadPremadeScene(string sceneFilename);
 
-// Function to read a ".off" mesh data file
-int readMesh(string filename, vector<Mesh>& meshes) {
-    try {
-        std::ifstream meshFile((dataPath + filename).c_str());
-        if (!meshFile.good()) {
-            meshFile.close();
-            meshFile.open(("../" + dataPath + filename).c_str());
-        }
-        if (!meshFile.good()) throw 1;
-
-        // Check first line
-        string firstLine;
-        meshFile >> firstLine;
-        if (firstLine != "OFF") throw 1;
+// Upload a decoded texture picture to the GPU and return its index in textures
+unsigned uploadTexture(const DecodedImage& image) {
+    unsigned int texture;
+    // create a new texture
+    glGenTextures(1, &texture);
+    check_gl_error();
+    glBindTexture(GL_TEXTURE_2D, texture);
+    check_gl_error();
+    // set the texture wrapping/filtering options (on the currently bound texture object)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    check_gl_error();
+    // upload texture image
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data);
+    check_gl_error();
+    glGenerateMipmap(GL_TEXTURE_2D);
+    check_gl_error();
+
+    // Save the texture ID for later reference
+    textures.push_back(texture);
+    return textures.size() - 1;
+}
 
-        unsigned int nV, nF, nE;
-        meshFile >> nV >> nF >> nE;
-        Mesh mesh;
-        // read vertices
-        for (unsigned i = 0; i < nV; ++i) {
-            Point vertex;
-            meshFile >> vertex.x >> vertex.y >> vertex.z;
-            mesh.V.push_back(vertex);
-        }
-        // read faces
-        for (unsigned i = 0; i < nF; ++i) {
-            unsigned n;
-            meshFile >> n;
-            Face face;
-            meshFile >> face.a >> face.b >> face.c;
-            mesh.F.push_back(face);
-        }
-        // calculate face normals
-        for (unsigned i = 0; i < nF; ++i) {
-            Vector3f edge1, edge2;
-            edge1 = Vector3f(mesh.V[mesh.F[i].b].x - mesh.V[mesh.F[i].a].x,
-                             mesh.V[mesh.F[i].b].y - mesh.V[mesh.F[i].a].y,
-                             mesh.V[mesh.F[i].b].z - mesh.V[mesh.F[i].a].z);
-            edge2 = Vector3f(mesh.V[mesh.F[i].c].x - mesh.V[mesh.F[i].a].x,
-                             mesh.V[mesh.F[i].c].y - mesh.V[mesh.F[i].a].y,
-                             mesh.V[mesh.F[i].c].z - mesh.V[mesh.F[i].a].z);
-            Vector3f faceNormal = edge1.cross(edge2).normalized();
-            mesh.FN.push_back(Point{faceNormal.x(), faceNormal.y(), faceNormal.z()});
-        }
-        // calculate vertex normals
-        for (unsigned i = 0; i < nV; ++i) {
-            unsigned adjCount = 0;
-            float sumX = 0, sumY = 0, sumZ = 0;
-            for (unsigned j = 0; j < nF; ++j) {
-                if (mesh.F[j].a == i || mesh.F[j].b == i || mesh.F[j].c == i) {
-                    sumX += mesh.FN[j].x;
-                    sumY += mesh.FN[j].y;
-                    sumZ += mesh.FN[j].z;
-                    ++adjCount;
-                }
-            }
-            Vector3f vertexNormal = Vector3f(sumX / adjCount, sumY / adjCount, sumZ / adjCount).normalized();
-            mesh.VN.push_back(Point{vertexNormal.x(), vertexNormal.y(), vertexNormal.z()});
-        }
-        // calculate barycenter
-        float sumX = 0, sumY = 0, sumZ = 0;
-        for (unsigned i = 0; i < nV; ++i) {
-            sumX += mesh.V[i].x;
-            sumY += mesh.V[i].y;
-            sumZ += mesh.V[i].z;
-        }
-        mesh.barycenterX = sumX / nV;
-        mesh.barycenterY = sumY / nV;
-        mesh.barycenterZ = sumZ / nV;
-
-        // calculate radius of containing sphere centered on barycenter
-        float max = 0.0;
-        for (unsigned i = 0; i < mesh.V.size(); ++i) {
-            max = std::max(max, square(mesh.V[i].x - mesh.barycenterX)
-                                + square(mesh.V[i].y - mesh.barycenterZ)
-                                + square(mesh.V[i].z - mesh.barycenterZ));
-        }
-        mesh.maxRadius = std::sqrt(max);
-
-        meshes.push_back(mesh);
-        return 0;
-    } catch (...) {
-        std::cerr << "Error opening file." << std::endl;
-        return -1;
-    }
+// Move a mesh finished by the asset loader into its slot and upload it to the GPU
+void uploadMesh(unsigned meshIndex, Mesh& mesh) {
+    mesh.texture = meshes[meshIndex].texture;  // keep the texture if it was ready first
+    meshes[meshIndex] = std::move(mesh);
+    VBO[meshIndex].update(meshes[meshIndex].packedV);
+    EBO[meshIndex].update(meshes[meshIndex].F);
+    meshes[meshIndex].ready = true;
+
+    // objects created while the mesh was loading can now get their model-dependent attributes
+    auto finish = [meshIndex](Object& object) {
+        if (object.model == meshIndex && object.model_pending) object.finishModelInit();
+    };
+    for (unsigned i = 0; i < scenery.size(); ++i) finish(scenery[i]);
+    for (unsigned i = 0; i < objects.size(); ++i) finish(objects[i]);
+    for (unsigned i = 0; i < hud.size(); ++i) finish(hud[i]);
 }
 
-// read a .obj file
-int readObj(string objFilename, vector<Mesh>& meshes) {
-    try {
-        objl::Loader loader;
-        std::ifstream testFile((dataPath + objFilename).c_str());
-        if (testFile.good()) {     
-            loader.LoadFile((char*)(dataPath + objFilename).c_str());
+// Upload the assets finished by the background loader, within the per-frame time budget
+void uploadLoadedAssets() {
+    auto t_begin = std::chrono::high_resolution_clock::now();
+    float elapsed;
+    do {
+        unsigned meshIndex;
+        Mesh mesh;
+        DecodedImage image;
+        if (assetLoader.popMesh(meshIndex, mesh)) {
+            uploadMesh(meshIndex, mesh);
+        } else if (assetLoader.popImage(image)) {
+            meshes[image.mesh].texture = uploadTexture(image);
+            freeImage(image);
         } else {
-            testFile.close();
-            testFile.open(("../" + dataPath + objFilename).c_str());
-            if (!testFile.good()) throw 1;
-            loader.LoadFile((char*)("../" + dataPath + objFilename).c_str());
+            break;
         }
-        testFile.close();
-
-
-        unsigned int nV, nF;
-        nV = loader.LoadedVertices.size();
-        nF = loader.LoadedMeshes[0].Indices.size() / 3;
-        Mesh mesh;
-        // read vertices
-        for (unsigned i = 0; i < nV; ++i) {
-            Point vertex;
-            vertex.x = loader.LoadedVertices[i].Position.X;
-            vertex.y = loader.LoadedVertices[i].Position.Y;
-            vertex.z = loader.LoadedVertices[i].Position.Z;
-            mesh.V.push_back(vertex);
-        }
-        // read faces
-        for (unsigned i = 0; i < nF; ++i) {
-            Face face;
-            face.a = loader.LoadedMeshes[0].Indices[i * 3];
-            face.b = loader.LoadedMeshes[0].Indices[i * 3 + 1];
-            face.c = loader.LoadedMeshes[0].Indices[i * 3 + 2];
-            mesh.F.push_back(face);
-        }
-        // read vertex normals
-        for (unsigned i = 0; i < nV; ++i) {
-            Point normal;
-            normal.x = loader.LoadedVertices[i].Normal.X;
-            normal.y = loader.LoadedVertices[i].Normal.Y;
-            normal.z = loader.LoadedVertices[i].Normal.Z;
-            mesh.VN.push_back(normal);
-        }
-        // read vertex texture coordinates
-        for (unsigned i = 0; i < nV; ++i) {
-            Point2d texCoords;
-            texCoords.u = loader.LoadedVertices[i].TextureCoordinate.X;
-            texCoords.v = loader.LoadedVertices[i].TextureCoordinate.Y;
-            mesh.texCorrds.push_back(texCoords);
-        }
-        // calculate barycenter
-        float sumX = 0, sumY = 0, sumZ = 0;
-        for (unsigned i = 0; i < nV; ++i) {
-            sumX += mesh.V[i].x;
-            sumY += mesh.V[i].y;
-            sumZ += mesh.V[i].z;
-        }
-        mesh.barycenterX = sumX / nV;
-        mesh.barycenterY = sumY / nV;
-        mesh.barycenterZ = sumZ / nV;
-
-        // calculate radius of containing sphere centered on barycenter
-        float max = 0.0;
-        for (unsigned i = 0; i < mesh.V.size(); ++i) {
-            max = std::max(max, square(mesh.V[i].x - mesh.barycenterX)
-                                 + square(mesh.V[i].y - mesh.barycenterZ)
-                                 + square(mesh.V[i].z - mesh.barycenterZ));
-        }
-        mesh.maxRadius = std::sqrt(max);
-
-        meshes.push_back(mesh);
-        return 0;
-    } catch (...) {
-        std::cerr << "Error opening file." << std::endl;
-        return -1;
-    }
+        auto t_now = std::chrono::high_resolution_clock::now();
+        elapsed = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_begin).count();
+    } while (elapsed < ASSET_UPLOAD_BUDGET);
 }
 
-// read a texture picture and associate it to a mesh
-int readTexture(string textureFilename, Mesh& mesh) {
-    // read image file
-    int width, height, nrChannels;
-    unsigned char *data;
-    objl::Loader loader;
-    std::ifstream testFile((dataPath + textureFilename).c_str());
-    if (testFile.good()) {     
-        data = stbi_load((dataPath + textureFilename).c_str(), &width, &height, &nrChannels, 0);
-    } else {
-        testFile.close();
-        testFile.open(("../" + dataPath + textureFilename).c_str());
-        if (!testFile.good()) throw 1;
-        data = stbi_load(("../" + dataPath + textureFilename).c_str(), &width, &height, &nrChannels, 0);
-    }
-    testFile.close();
-
-    if (data) {
-        unsigned int texture;
-        // create a new texture
-        glGenTextures(1, &texture);
-        check_gl_error();
-        glBindTexture(GL_TEXTURE_2D, texture);
-        check_gl_error();
-        // set the texture wrapping/filtering options (on the currently bound texture object)
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        check_gl_error();
-        // upload texture image
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        check_gl_error();
-        glGenerateMipmap(GL_TEXTURE_2D);
-        check_gl_error();
-
-        stbi_image_free(data);
-
-        // Save the texture ID for later reference
-        textures.push_back(texture);
-        mesh.texture = textures.size() - 1;
-        return 0;
-    }
-    else {
-        std::cout << "Failed to load texture" << std::endl;
-        return -1;
-    }
+// Models that are still loading are drawn as the placeholder sphere
+unsigned drawnModel(const Object& object) {
+    return meshes[object.model].ready ? object.model : PLACEHOLDER_MODEL;
 }
 
 void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos) {
@@ -330,19 +195,63 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
     }
 }
 
+// Select the object in the scene the camera looks at: the nearest one whose sphere the line of sight enters
+// (the reference sphere and the object in hand do not count); nothing if there is none
+void pickObject() {
+    unsigned count = objects.size();
+    vector<Vector3d> pos(count);
+    vector<double> mass(count), radius(count);
+    for (unsigned k = 0; k < count; ++k) {
+        const Object& object = objects[k];
+        pos[k] = Vector3d(object.translateX, object.translateY, object.translateZ);
+        mass[k] = object.mass;
+        radius[k] = object.collision_radius;
+    }
+    Octree tree;
+    tree.build(pos, mass, count, OCTREE_LEAF_SIZE, &radius);
+
+    Vector3d origin = camera.position.cast<double>(), direction = camera.lookDirection.cast<double>().normalized();
+    double nearest = HUGE_VAL;
+    highlighted = NO_HIGHLIGHTED;
+    tree.alongRay(origin, direction, [&](unsigned k) {
+        Vector3d offset = pos[k] - origin;
+        double along = offset.dot(direction), miss2 = offset.squaredNorm() - along * along;
+        if (miss2 > square(radius[k])) return;
+        double half_chord = std::sqrt(square(radius[k]) - miss2);
+        if (along + half_chord < 0) return;   // behind the camera
+        double hit = std::max(along - half_chord, 0.0);
+        if (hit < nearest) {
+            nearest = hit;
+            highlighted = objects.handle(k);
+        }
+    });
+}
+
+// The object the editing keys act on: the selected object in the scene, or else the object in hand
+Object& editedObject() {
+    Object* selected = objects.get(highlighted);
+    return selected != NULL ? *selected : hud[HAND_OBJECT];
+}
+
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
-        objects.back().translateX_last = objects.back().translateX - launchSpeed * camera.lookDirection.x();
-        objects.back().translateY_last = objects.back().translateY - launchSpeed * camera.lookDirection.y();
-        objects.back().translateZ_last = objects.back().translateZ - launchSpeed * camera.lookDirection.z();
-        objects.push_back(objects.back());
+        double launchScale = dt / SIMULATED_TIME_PER_FRAME;   // launchSpeed is a distance per frame
+        Object& hand = hud[HAND_OBJECT];
+        hand.translateX_last = hand.translateX - launchSpeed * launchScale * camera.lookDirection.x();
+        hand.translateY_last = hand.translateY - launchSpeed * launchScale * camera.lookDirection.y();
+        hand.translateZ_last = hand.translateZ - launchSpeed * launchScale * camera.lookDirection.z();
+        objects.insert(hand);
+        hand.id = Object::newId();   // the launched object keeps the id; the new one in hand gets its own
     }
     if (button == GLFW_MOUSE_BUTTON_MIDDLE && action == GLFW_PRESS) {
         // Stop rotation of current object in hand.
         // Also reset launch speed to 0.
-        objects.back().rotateY_last = objects.back().rotateY;
+        hud[HAND_OBJECT].rotateY_last = hud[HAND_OBJECT].rotateY;
         launchSpeed = 0.0;
     }
+    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
+        pickObject();
+    }
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -350,7 +259,7 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         switch (key) {
         case GLFW_KEY_GRAVE_ACCENT:
             // delete all objects in scene (that is, in physics simulation)
-            objects.erase(objects.begin() + 1, objects.end() - 1);
+            objects.clear();
             highlighted = NO_HIGHLIGHTED;
             break;
         case GLFW_KEY_1:
@@ -384,73 +293,66 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             loadPremadeScene("example_9.txt");
             break;
         case GLFW_KEY_F5:
-            objects.back() = Object(0);
+            hud[HAND_OBJECT] = Object(0);
             break;
         case GLFW_KEY_F6:
-            objects.back() = Object(1);
+            hud[HAND_OBJECT] = Object(1);
             break;
         case GLFW_KEY_F7:
-            objects.back() = Object(2);
+            hud[HAND_OBJECT] = Object(2);
             break;
         case GLFW_KEY_F8:
-            objects.back() = Object(3);
+            hud[HAND_OBJECT] = Object(3);
             break;
         case GLFW_KEY_F9:
-            objects.back() = Object(4);
+            hud[HAND_OBJECT] = Object(4);
             break;
-        case GLFW_KEY_F1:
-            if (!objects.empty()) {
-                if (highlighted == NO_HIGHLIGHTED) {
-                    objects.back().shading = WIREFRAME;
-                    objects.back().wireframe = true;
-                } else {
-                    objects[highlighted].shading = WIREFRAME;
-                    objects[highlighted].wireframe = true;
-                }
-            }
+        case GLFW_KEY_F12:
+            gravity_solver = gravity_solver_t((gravity_solver + 1) % N_GRAVITY_SOLVERS);
+            std::cout << "Gravity solver: " << gravitySolverName(gravity_solver) << std::endl;
             break;
-        case GLFW_KEY_F2:
-            if (!objects.empty()) {
-                if (highlighted == NO_HIGHLIGHTED) {
-                    objects.back().shading = FLAT;
-                    objects.back().wireframe = true;
-                } else {
-                    objects[highlighted].shading = FLAT;
-                    objects[highlighted].wireframe = true;
-                }
-            }
+        case GLFW_KEY_F11:
+            adaptive_dt = !adaptive_dt;
+            std::cout << "Adaptive time step: " << (adaptive_dt ? "on" : "off") << std::endl;
             break;
-        case GLFW_KEY_F3:
-            if (!objects.empty()) {
-                if (highlighted == NO_HIGHLIGHTED) {
-                    objects.back().shading = PHONG;
-                    objects.back().wireframe = false;
-                } else {
-                    objects[highlighted].shading = PHONG;
-                    objects[highlighted].wireframe = false;
-                }
-            }
+        case GLFW_KEY_F10:
+            integrator = integrator_t((integrator + 1) % N_INTEGRATORS);
+            std::cout << "Integrator: " << integratorName(integrator) << std::endl;
             break;
-        case GLFW_KEY_F4:
-            if (!objects.empty()) {
-                if (highlighted == NO_HIGHLIGHTED) {
-                    objects.back().shading = DEBUG_NORMAL;
-                } else {
-                    objects[highlighted].shading = DEBUG_NORMAL;
-                }
-            }
+        case GLFW_KEY_C:
+            collision_mode = collision_mode_t((collision_mode + 1) % N_COLLISION_MODES);
+            std::cout << "Collisions: " << collisionModeName(collision_mode) << std::endl;
             break;
-        case GLFW_KEY_TAB:
-            if (!objects.empty()) {
-                if (highlighted == NO_HIGHLIGHTED) {
-                    objects.back().wireframe = !objects.back().wireframe;
-                } else {
-                    objects[highlighted].wireframe = !objects[highlighted].wireframe;
-                }
-            }
+        case GLFW_KEY_F1: {
+            Object& edited = editedObject();
+            edited.shading = WIREFRAME;
+            edited.wireframe = true;
             break;
+        }
+        case GLFW_KEY_F2: {
+            Object& edited = editedObject();
+            edited.shading = FLAT;
+            edited.wireframe = true;
+            break;
+        }
+        case GLFW_KEY_F3: {
+            Object& edited = editedObject();
+            edited.shading = PHONG;
+            edited.wireframe = false;
+            break;
+        }
+        case GLFW_KEY_F4: {
+            Object& edited = editedObject();
+            edited.shading = DEBUG_NORMAL;
+            break;
+        }
+        case GLFW_KEY_TAB: {
+            Object& edited = editedObject();
+            edited.wireframe = !edited.wireframe;
+            break;
+        }
         case GLFW_KEY_BACKSLASH:
-            if (highlighted != NO_HIGHLIGHTED) {
+            if (objects.contains(highlighted)) {
                 blinkHighlight = !blinkHighlight;
             }
             break;
@@ -479,38 +381,28 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         case GLFW_KEY_KP_SUBTRACT:
             cameraMoveSpeed *= 0.5;
             break;
-        case GLFW_KEY_T:
-            if (!objects.empty()) {
-                if (highlighted == NO_HIGHLIGHTED) {
-                    objects.back().density *= 1.2;
-                    objects.back().updateMass();
-                } else {
-                    objects[highlighted].density *= 1.2;
-                    objects[highlighted].updateMass();
-                }
-            }
+        case GLFW_KEY_T: {
+            Object& edited = editedObject();
+            edited.density *= 1.2;
+            edited.updateMass();
             break;
-        case GLFW_KEY_G:
-            if (!objects.empty()) {
-                if (highlighted == NO_HIGHLIGHTED) {
-                    objects.back().density /= 1.2;
-                    objects.back().updateMass();
-                } else {
-                    objects[highlighted].density /= 1.2;
-                    objects[highlighted].updateMass();
-                }
-            }
+        }
+        case GLFW_KEY_G: {
+            Object& edited = editedObject();
+            edited.density /= 1.2;
+            edited.updateMass();
             break;
+        }
         case GLFW_KEY_E:
-            if (objects.size()) {
-                ++highlighted;
-                if (highlighted == objects.size()) highlighted = 0;
+            if (!objects.empty()) {
+                unsigned next = objects.contains(highlighted) ? objects.indexOf(highlighted) + 1 : 0;
+                highlighted = objects.handle(next < objects.size() ? next : 0);
             }
             break;
         case GLFW_KEY_Q:
-            if (objects.size()) {
-                --highlighted;
-                if (highlighted == -1) highlighted = objects.size() - 1;
+            if (!objects.empty()) {
+                unsigned current = objects.contains(highlighted) ? objects.indexOf(highlighted) : 0;
+                highlighted = objects.handle(current > 0 ? current - 1 : objects.size() - 1);
             }
             break;
         case GLFW_KEY_ESCAPE:
@@ -550,125 +442,123 @@ void testKeyStates(GLFWwindow *window) {
     }
     if (glfwGetKey(window, GLFW_KEY_R)) {
         // object scale up
-        if (!objects.empty()) {
-            if (highlighted == NO_HIGHLIGHTED) {
-                objects.back().collision_radius *= 1 + SCALE_FRAME_STEP;
-                objects.back().updateMass();
-            } else {
-                objects[highlighted].collision_radius *= 1 + SCALE_FRAME_STEP;
-                objects[highlighted].updateMass();
-            }
-        }
+        Object& edited = editedObject();
+        edited.collision_radius *= 1 + SCALE_FRAME_STEP;
+        edited.updateMass();
     }
     if (glfwGetKey(window, GLFW_KEY_F)) {
         // object scale down
-        if (!objects.empty()) {
-            if (highlighted == NO_HIGHLIGHTED) {
-                objects.back().collision_radius /= 1 + SCALE_FRAME_STEP;
-                objects.back().updateMass();
-            } else {
-                objects[highlighted].collision_radius /= 1 + SCALE_FRAME_STEP;
-                objects[highlighted].updateMass();
-            }
-        }
+        Object& edited = editedObject();
+        edited.collision_radius /= 1 + SCALE_FRAME_STEP;
+        edited.updateMass();
     }
-    if (highlighted != NO_HIGHLIGHTED) {
+    Object* selected = objects.get(highlighted);
+    if (selected != NULL) {
         if (glfwGetKey(window, GLFW_KEY_I)) {
             // object translate backward
-            objects[highlighted].translateZ += TRANSLATE_FRAME_STEP;
+            selected->translateZ += TRANSLATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_U)) {
             // object translate forward
-            objects[highlighted].translateZ -= TRANSLATE_FRAME_STEP;
+            selected->translateZ -= TRANSLATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_L)) {
             // object translate right
-            objects[highlighted].translateX += TRANSLATE_FRAME_STEP;
+            selected->translateX += TRANSLATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_H)) {
             // object translate left
-            objects[highlighted].translateX -= TRANSLATE_FRAME_STEP;
+            selected->translateX -= TRANSLATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_K)) {
             // object translate up
-            objects[highlighted].translateY += TRANSLATE_FRAME_STEP;
+            selected->translateY += TRANSLATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_J)) {
             // object translate down
-            objects[highlighted].translateY -= TRANSLATE_FRAME_STEP;
+            selected->translateY -= TRANSLATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_O)) {
             // object scale up
-            objects[highlighted].collision_radius *= 1 + SCALE_FRAME_STEP;
-            objects[highlighted].updateMass();
+            selected->collision_radius *= 1 + SCALE_FRAME_STEP;
+            selected->updateMass();
         }
         if (glfwGetKey(window, GLFW_KEY_P)) {
             // object scale down
-            objects[highlighted].collision_radius /= 1 + SCALE_FRAME_STEP;
-            objects[highlighted].updateMass();
+            selected->collision_radius /= 1 + SCALE_FRAME_STEP;
+            selected->updateMass();
         }
         if (glfwGetKey(window, GLFW_KEY_SLASH)) {
             // object rotate X 
-            objects[highlighted].rotateX += ROTATE_FRAME_STEP;
+            selected->rotateX += ROTATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_SEMICOLON)) {
             // object rotate X 
-            objects[highlighted].rotateX -= ROTATE_FRAME_STEP;
+            selected->rotateX -= ROTATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_N)) {
             // object rotate Y 
-            objects[highlighted].rotateY += ROTATE_FRAME_STEP;
+            selected->rotateY += ROTATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_M)) {
             // object rotate Y 
-            objects[highlighted].rotateY -= ROTATE_FRAME_STEP;
+            selected->rotateY -= ROTATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_COMMA)) {
             // object rotate Z 
-            objects[highlighted].rotateZ += ROTATE_FRAME_STEP;
+            selected->rotateZ += ROTATE_FRAME_STEP;
         }
         if (glfwGetKey(window, GLFW_KEY_PERIOD)) {
             // object rotate Z 
-            objects[highlighted].rotateZ -= ROTATE_FRAME_STEP;
+            selected->rotateZ -= ROTATE_FRAME_STEP;
         }
     }
 }
 
 // Prepare a render program to use
-void sceneRenderProgramInit(Program& program, unsigned i, float time) {
+void sceneRenderProgramInit(Program& program, const Object& object, float time) {
+    unsigned model = drawnModel(object);
     // specify program to use
     program.bind();
     // The vertex shader wants the position of the vertices as an input.
     // The following line connects the VBO we defined above with the position "slot"
     // in the vertex shader
-    program.bindVertexAttribArray("position_m",VBO[objects[i].model]);
-    program.bindVertexAttribArray("normal_m",VBO_N[objects[i].model]);
-    program.bindVertexAttribArray("texCoords",VBO_T[objects[i].model]);
+    program.bindVertexAttribPointer("position_q", VBO[model], 3, GL_UNSIGNED_SHORT, true,
+                                    offsetof(PackedVertex, position));
+    program.bindVertexAttribPointer("normal_oct", VBO[model], 2, GL_SHORT, true,
+                                    offsetof(PackedVertex, normal));
+    program.bindVertexAttribPointer("texCoords_q", VBO[model], 2, GL_UNSIGNED_SHORT, true,
+                                    offsetof(PackedVertex, texCoords));
 
-    EBO[objects[i].model].bind();
+    EBO[model].bind();
 
     // Set textures to use in texture units
     glActiveTexture(GL_TEXTURE0);           // GL_TEXTURE0 denotes the default texture unit
-    glBindTexture(GL_TEXTURE_2D, textures[meshes[objects[i].model].texture]);
+    glBindTexture(GL_TEXTURE_2D, textures[meshes[model].texture]);
     // Bind texture units to samplers
     glUniform1i(program.uniform("tex"), 0); // note to self: the parameter to bind to the sampler uniform is 0,
                                             // not GL_TEXTURE0 (which is not 0)!
 
     // Set the transformation parameters for the object
-    glUniform3f(program.uniform("TR"), objects[i].model_initial_translateX + objects[i].translateX,
-                                       objects[i].model_initial_translateY + objects[i].translateY,
-                                       objects[i].model_initial_translateZ + objects[i].translateZ);
-    glUniform3f(program.uniform("RO"), objects[i].rotateX, objects[i].rotateY, objects[i].rotateZ);
-    glUniform1f(program.uniform("SC"), objects[i].collision_radius / meshes[objects[i].model].maxRadius);
-    glUniform3f(program.uniform("barycenter"), meshes[objects[i].model].barycenterX, 
-                meshes[objects[i].model].barycenterY, meshes[objects[i].model].barycenterZ);
+    glUniform3f(program.uniform("TR"), object.model_initial_translateX + object.translateX,
+                                       object.model_initial_translateY + object.translateY,
+                                       object.model_initial_translateZ + object.translateZ);
+    glUniform3f(program.uniform("RO"), object.rotateX, object.rotateY, object.rotateZ);
+    glUniform1f(program.uniform("SC"), object.collision_radius / meshes[model].maxRadius);
+    glUniform3f(program.uniform("barycenter"), meshes[model].barycenterX, 
+                meshes[model].barycenterY, meshes[model].barycenterZ);
+    // Set the dequantization ranges of the mesh
+    glUniform3fv(program.uniform("bounds_min"), 1, meshes[model].boundsMin);
+    glUniform3fv(program.uniform("bounds_extent"), 1, meshes[model].boundsExtent);
+    glUniform2fv(program.uniform("tex_min"), 1, meshes[model].texMin);
+    glUniform2fv(program.uniform("tex_extent"), 1, meshes[model].texExtent);
 
     // Set the rendering parameters for the object
     glUniform1f(program.uniform("ambient_coef"), AMBIENT_COEF);
-    glUniform1f(program.uniform("diffuse_coef"), objects[i].diffuse);
-    glUniform1f(program.uniform("specular_coef"), objects[i].specular);
-    glUniform1f(program.uniform("phongExp"), objects[i].phongExp);
-    if (i == highlighted) {
+    glUniform1f(program.uniform("diffuse_coef"), object.diffuse);
+    glUniform1f(program.uniform("specular_coef"), object.specular);
+    glUniform1f(program.uniform("phongExp"), object.phongExp);
+    if (&object == objects.get(highlighted)) {
         if (blinkHighlight) glUniform3f(program.uniform("color"), 0.5f, 0.5f, (sin(time * 8.0f) + 1.0f) / 2.0f);
         else glUniform3f(program.uniform("color"), 0.7f, 0.7f, 0.0f);
     } else {
@@ -692,9 +582,12 @@ void HUDRenderProgramInit(Program& program, const Object& object) {
     // The vertex shader wants the position of the vertices as an input.
     // The following line connects the VBO we defined above with the position "slot"
     // in the vertex shader
-    program.bindVertexAttribArray("position_m",VBO[object.model]);
-    program.bindVertexAttribArray("normal_m",VBO_N[object.model]);
-    program.bindVertexAttribArray("texCoords",VBO_T[object.model]);
+    program.bindVertexAttribPointer("position_q", VBO[object.model], 3, GL_UNSIGNED_SHORT, true,
+                                    offsetof(PackedVertex, position));
+    program.bindVertexAttribPointer("normal_oct", VBO[object.model], 2, GL_SHORT, true,
+                                    offsetof(PackedVertex, normal));
+    program.bindVertexAttribPointer("texCoords_q", VBO[object.model], 2, GL_UNSIGNED_SHORT, true,
+                                    offsetof(PackedVertex, texCoords));
 
     EBO[object.model].bind();
 
@@ -713,6 +606,11 @@ void HUDRenderProgramInit(Program& program, const Object& object) {
     glUniform1f(program.uniform("SC"), object.collision_radius / meshes[object.model].maxRadius);
     glUniform3f(program.uniform("barycenter"), meshes[object.model].barycenterX, 
                 meshes[object.model].barycenterY, meshes[object.model].barycenterZ);
+    // Set the dequantization ranges of the mesh
+    glUniform3fv(program.uniform("bounds_min"), 1, meshes[object.model].boundsMin);
+    glUniform3fv(program.uniform("bounds_extent"), 1, meshes[object.model].boundsExtent);
+    glUniform2fv(program.uniform("tex_min"), 1, meshes[object.model].texMin);
+    glUniform2fv(program.uniform("tex_extent"), 1, meshes[object.model].texExtent);
 
     // Set the rendering parameters for the object
     glUniform1f(program.uniform("ambient_coef"), AMBIENT_COEF);
@@ -735,22 +633,86 @@ void HUDRenderProgramInit(Program& program, const Object& object) {
 }
 
 
-// Update the object on hand (stored as the last one in objects)
+// Update the object on hand (kept in hud, outside the physics simulation)
 void updateHand() {
     Vector3f handPosition;
     handPosition = camera.position + camera.lookDirection
                    + HAND_POSITION_X * camera.lookDirection.cross(camera.upDirection).normalized()
                    + HAND_POSITION_Y * camera.lookDirection.cross(camera.upDirection).cross(camera.lookDirection).normalized();
-    objects.back().translateX = handPosition.x();
-    objects.back().translateY = handPosition.y();
-    objects.back().translateZ = handPosition.z();
-    objects.back().translateX_last = objects.back().translateX;
-    objects.back().translateY_last = objects.back().translateY;
-    objects.back().translateZ_last = objects.back().translateZ;
+    Object& hand = hud[HAND_OBJECT];
+    hand.translateX = handPosition.x();
+    hand.translateY = handPosition.y();
+    hand.translateZ = handPosition.z();
+    hand.translateX_last = hand.translateX;
+    hand.translateY_last = hand.translateY;
+    hand.translateZ_last = hand.translateZ;
 }
 
-int main(void)
+int main(int argc, char* argv[])
 {
+    // "--mesh-stats": load every model in the data folder, print the import statistics and exit
+    // (Earth.off is a COFF file and test.obj has no faces, so they are not models we can load)
+    if (argc > 1 && string(argv[1]) == "--mesh-stats") {
+        Mesh mesh;
+        readMesh("unit_cube.off", mesh);
+        readMesh("bumpy_cube.off", mesh);
+        readMesh("bunny.off", mesh);
+        readObj("Earth.obj", mesh);
+        readObj("fancy_sphere_1_reduced.obj", mesh);
+        readObj("arrow.obj", mesh);
+        return 0;
+    }
+    // "--integrator-bench [scene] [duration]": compare the integrators on a premade scene and exit
+    if (argc > 1 && string(argv[1]) == "--integrator-bench") {
+        meshes.resize(N_MODELS + 1);
+        string scene = argc > 2 ? argv[2] : "example_real proportion solor system.txt";
+        if (loadPremadeScene(scene) != 0) return -1;
+        return integratorBenchmark(scene, argc > 3 ? atof(argv[3]) : 100.0);
+    }
+    // "--timestep-bench [scene] [duration]": compare fixed and adaptive steps on a premade scene and exit
+    if (argc > 1 && string(argv[1]) == "--timestep-bench") {
+        meshes.resize(N_MODELS + 1);
+        string scene = argc > 2 ? argv[2] : "example_2.txt";
+        if (loadPremadeScene(scene) != 0) return -1;
+        return timestepBenchmark(scene, argc > 3 ? atof(argv[3]) : 100.0);
+    }
+    // "--respa-bench [scene] [duration]": compare position Verlet and RESPA on a premade scene and exit
+    if (argc > 1 && string(argv[1]) == "--respa-bench") {
+        meshes.resize(N_MODELS + 1);
+        string scene = argc > 2 ? argv[2] : "example_5.txt";
+        if (loadPremadeScene(scene) != 0) return -1;
+        return respaBenchmark(scene, argc > 3 ? atof(argv[3]) : 1.0);
+    }
+    // "--gravity-bench [scene | plummer | uniform] [bodies]": compare the gravity solvers with the direct sum and exit
+    if (argc > 1 && string(argv[1]) == "--gravity-bench") {
+        string source = argc > 2 ? argv[2] : "plummer";
+        if (source != "plummer" && source != "uniform") {
+            meshes.resize(N_MODELS + 1);
+            if (loadPremadeScene(source) != 0) return -1;
+        }
+        return gravityBenchmark(source, argc > 3 ? atoi(argv[3]) : 100000);
+    }
+    // "--index-bench [scene | plummer | uniform] [bodies]": time the spatial index and exit
+    if (argc > 1 && string(argv[1]) == "--index-bench") {
+        string source = argc > 2 ? argv[2] : "plummer";
+        if (source != "plummer" && source != "uniform") {
+            meshes.resize(N_MODELS + 1);
+            if (loadPremadeScene(source) != 0) return -1;
+        }
+        return indexBenchmark(source, argc > 3 ? atoi(argv[3]) : 1000000);
+    }
+    // "--reproducibility-bench [scene | plummer | uniform] [bodies]": compare the solvers on 1 ~ 8 threads and exit
+    if (argc > 1 && string(argv[1]) == "--reproducibility-bench") {
+        string source = argc > 2 ? argv[2] : "plummer";
+        if (source != "plummer" && source != "uniform") {
+            meshes.resize(N_MODELS + 1);
+            if (loadPremadeScene(source) != 0) return -1;
+        }
+        return reproducibilityBenchmark(source, argc > 3 ? atoi(argv[3]) : 10000);
+    }
+
+    auto t_launch = std::chrono::high_resolution_clock::now();
+
     GLFWwindow* window;
 
     // Initialize the library
@@ -818,42 +780,47 @@ int main(void)
     VAO.init();
     VAO.bind();
 
-    // read models from .off meshes
-    readMesh("unit_cube.off", meshes);
-    readMesh("bumpy_cube.off", meshes);
-    readMesh("bunny.off", meshes);
-
-    // read models from .obj files (as well as their texture pictures)
-    readObj("Earth.obj", meshes);
-    readObj("fancy_sphere_1_reduced.obj", meshes);
-    readObj("arrow.obj", meshes);
-    readObj("Earth.obj", meshes);
-
-    // read textures
-    readTexture("Earth.png", meshes[3]);
-    readTexture("one_pixel_0_0.5_1.bmp", meshes[4]);
-    readTexture("one_pixel_1_0.5_0.bmp", meshes[5]);
-    readTexture("one_pixel_1_1_1.bmp", meshes[6]);
-    readTexture("one_pixel_0_0.5_1.bmp", meshes[0]);
-    readTexture("one_pixel_0_0.5_1.bmp", meshes[1]);
-    readTexture("one_pixel_0_0.5_1.bmp", meshes[2]);
-
-    // For each model mesh, create and initialize a VBO and EBO with its vertices data
+    // Reserve a slot for every model; until a model is loaded its slot holds
+    // a unit-radius placeholder and objects using it are drawn as the placeholder sphere
+    meshes.resize(N_MODELS + 1);
+    generateSphere(meshes[PLACEHOLDER_MODEL], 16, 32);
+    quantizeVertices(meshes[PLACEHOLDER_MODEL]);
+    meshes[PLACEHOLDER_MODEL].ready = true;
+
+    // White texture used until the textures are loaded
+    unsigned char whitePixel[3] = { 255, 255, 255 };
+    DecodedImage whiteImage = { 0, 1, 1, 3, whitePixel };
+    unsigned placeholderTexture = uploadTexture(whiteImage);
+    for (unsigned i = 0; i < meshes.size(); ++i) {
+        meshes[i].texture = placeholderTexture;
+    }
+
+    // For each model mesh, create a VBO and EBO (filled when its data is loaded)
     for (unsigned i = 0; i < meshes.size(); ++i) {
         VBO.push_back(VertexBufferObject());
         VBO[i].init();
-        VBO_N.push_back(VertexBufferObject());
-        VBO_N[i].init();
-        VBO_T.push_back(VertexBufferObject()); // even if a mesh model doesn't have texture,
-        VBO_T[i].init();                       // a position is still reserved
         EBO.push_back(ElementBufferObject());
         EBO[i].init();
-
-        VBO[i].update(meshes[i].V);
-        VBO_N[i].update(meshes[i].VN);
-        VBO_T[i].update(meshes[i].texCorrds);
-        EBO[i].update(meshes[i].F);
     }
+    VBO[PLACEHOLDER_MODEL].update(meshes[PLACEHOLDER_MODEL].packedV);
+    EBO[PLACEHOLDER_MODEL].update(meshes[PLACEHOLDER_MODEL].F);
+
+    // Load models and textures in the background, the ones needed in the first frames first
+    assetLoader.start(std::max(1u, std::min(std::thread::hardware_concurrency(), unsigned(MAX_LOADER_THREADS))));
+    assetLoader.loadMesh("Earth.obj", 3);
+    assetLoader.loadMesh("Earth.obj", 6);
+    assetLoader.loadMesh("arrow.obj", 5);
+    assetLoader.loadTexture("Earth.png", 3);
+    assetLoader.loadTexture("one_pixel_0_0.5_1.bmp", 4);
+    assetLoader.loadTexture("one_pixel_1_0.5_0.bmp", 5);
+    assetLoader.loadTexture("one_pixel_1_1_1.bmp", 6);
+    assetLoader.loadTexture("one_pixel_0_0.5_1.bmp", 0);
+    assetLoader.loadTexture("one_pixel_0_0.5_1.bmp", 1);
+    assetLoader.loadTexture("one_pixel_0_0.5_1.bmp", 2);
+    assetLoader.loadMesh("unit_cube.off", 0);
+    assetLoader.loadMesh("bumpy_cube.off", 1);
+    assetLoader.loadMesh("bunny.off", 2);
+    assetLoader.loadMesh("fancy_sphere_1_reduced.obj", 4);
     
     // declare shaders
     extern const GLchar *vertex_shader,
@@ -873,11 +840,18 @@ int main(void)
     // Compile the shaders and upload the binary to the GPU
     // Note that we have to explicitly specify that the output "slot" called outColor
     // is the one that we want in the fragment buffer (and thus on screen)
-    program_flat.init(vertex_shader,fragment_shader_flat,"outColor");
-    program_phong.init(vertex_shader,fragment_shader_phong,"outColor");
-    program_rawColor.init(vertex_shader,fragment_shader_rawColor,"outColor");
-    program_debug_normal.init(vertex_shader,fragment_shader_debug_normal,"outColor");
-    program_HUD.init(vertex_shader_HUD,fragment_shader_debug_normal,"outColor");
+    // (linked programs are cached in shaderCachePath, so later launches can skip compiling)
+    auto t_shaders = std::chrono::high_resolution_clock::now();
+    program_flat.initCached(vertex_shader,fragment_shader_flat,"outColor",shaderCachePath);
+    program_phong.initCached(vertex_shader,fragment_shader_phong,"outColor",shaderCachePath);
+    program_rawColor.initCached(vertex_shader,fragment_shader_rawColor,"outColor",shaderCachePath);
+    program_debug_normal.initCached(vertex_shader,fragment_shader_debug_normal,"outColor",shaderCachePath);
+    program_HUD.initCached(vertex_shader_HUD,fragment_shader_debug_normal,"outColor",shaderCachePath);
+    printf("Startup: shader programs ready in %.1f ms (%d of 5 from binary cache)\n",
+           std::chrono::duration_cast<std::chrono::duration<float>>(
+               std::chrono::high_resolution_clock::now() - t_shaders).count() * 1000,
+           program_flat.from_binary_cache + program_phong.from_binary_cache + program_rawColor.from_binary_cache
+           + program_debug_normal.from_binary_cache + program_HUD.from_binary_cache);
 
     // enable z-buffer
     glEnable(GL_DEPTH_TEST);
@@ -890,26 +864,33 @@ int main(void)
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     // Add static objects that does not participate in physics simulation
-    objects.push_back(Object(3));    // This is a reference sphere for easy orienting
-    objects[0].shading = WIREFRAME;
-    objects[0].wireframe = true;
-    objects[0].collision_radius = 100.0;
+    scenery.push_back(Object(3));    // This is a reference sphere for easy orienting
+    scenery[0].shading = WIREFRAME;
+    scenery[0].wireframe = true;
+    scenery[0].collision_radius = 100.0;
+    scenery[0].default_radius = false;
 
     // Add object on the hand
-    objects.push_back(Object(3));
+    hud.push_back(Object(3));
 
     // Add HUD indicator speed arrow
-    Object speedArrow(5);
+    hud.push_back(Object(5));
+    Object& speedArrow = hud[SPEED_ARROW];
     speedArrow.rotateX = -PI / 2;
     speedArrow.translateX = HAND_POSITION_X;
     speedArrow.translateY = HAND_POSITION_Y;
 
     // Save the current time
     auto t_start = std::chrono::high_resolution_clock::now();
+    bool firstFrame = true;
+    bool assetsLoaded = false;
 
     // Loop until the user closes the window
     while (!glfwWindowShouldClose(window))
     {
+        // Finish loading assets that are ready
+        uploadLoadedAssets();
+
         // Bind your VAO (not necessary if you have only one)
         VAO.bind();
 
@@ -921,64 +902,83 @@ int main(void)
         auto t_now = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
 
-        // Draw each object in the scene
-        for (unsigned i = 0; i < objects.size(); ++i) {
+        // Draw each object in the scene: the static ones, the simulated ones and the one in hand
+        auto drawObject = [&](const Object& object) {
             bool drawTriangle;
-            switch (objects[i].shading) {
+            switch (object.shading) {
             case WIREFRAME:
                 drawTriangle = false;
                 break;
             case FLAT:
-                sceneRenderProgramInit(program_flat, i, time);
+                sceneRenderProgramInit(program_flat, object, time);
                 drawTriangle = true;
                 break;
             case PHONG:
-                sceneRenderProgramInit(program_phong, i, time);
+                sceneRenderProgramInit(program_phong, object, time);
                 drawTriangle = true;
                 break;
             case DEBUG_NORMAL:
-                sceneRenderProgramInit(program_debug_normal, i, time);
+                sceneRenderProgramInit(program_debug_normal, object, time);
                 drawTriangle = true;
                 break;
             default:
                 break;
             }
             // Draw an object
+            unsigned model = drawnModel(object);
             if (drawTriangle) {
                 glDrawElements(GL_TRIANGLES,
-                               EBO[objects[i].model].rows * EBO[objects[i].model].cols,
+                               EBO[model].rows * EBO[model].cols,
                                GL_UNSIGNED_INT,
                                0);
             }
             // Draw a wireframe
-            if (objects[i].wireframe) {
-                sceneRenderProgramInit(program_rawColor, i, time);
+            if (object.wireframe) {
+                sceneRenderProgramInit(program_rawColor, object, time);
                 glUniform3f(program_rawColor.uniform("color"), 1.0, 1.0, 1.0);
-                for (unsigned j = 0; j < EBO[objects[i].model].cols; ++j) {
+                for (unsigned j = 0; j < EBO[model].cols; ++j) {
                     glDrawElements(GL_LINE_STRIP,
-                                   EBO[objects[i].model].rows,
+                                   EBO[model].rows,
                                    GL_UNSIGNED_INT,
-                                   (GLvoid *) (j * EBO[objects[i].model].rows * sizeof(unsigned)));
+                                   (GLvoid *) (j * EBO[model].rows * sizeof(unsigned)));
                 }
             }
-        }
+        };
+        for (unsigned i = 0; i < scenery.size(); ++i) drawObject(scenery[i]);
+        for (unsigned i = 0; i < objects.size(); ++i) drawObject(objects[i]);
+        drawObject(hud[HAND_OBJECT]);
 
-        // Draw HUD
-        HUDRenderProgramInit(program_HUD, speedArrow);
-        glDrawElements(GL_TRIANGLES,
-                       EBO[speedArrow.model].rows * EBO[speedArrow.model].cols,
-                       GL_UNSIGNED_INT,
-                       0);
+        // Draw HUD (once the arrow model is loaded)
+        if (meshes[speedArrow.model].ready) {
+            HUDRenderProgramInit(program_HUD, speedArrow);
+            glDrawElements(GL_TRIANGLES,
+                           EBO[speedArrow.model].rows * EBO[speedArrow.model].cols,
+                           GL_UNSIGNED_INT,
+                           0);
+        }
 
         // Swap front and back buffers
         glfwSwapBuffers(window);
 
+        // Report startup timing
+        if (firstFrame || (!assetsLoaded && !assetLoader.remaining())) {
+            float sinceLaunch = std::chrono::duration_cast<std::chrono::duration<float>>(
+                                    std::chrono::high_resolution_clock::now() - t_launch).count();
+            if (firstFrame) printf("Startup: first frame after %.0f ms\n", sinceLaunch * 1000);
+            if (!assetLoader.remaining()) {
+                printf("Startup: all assets loaded after %.0f ms\n", sinceLaunch * 1000);
+                assetsLoaded = true;
+            }
+            firstFrame = false;
+        }
+
         // Poll for and process events
         glfwPollEvents();      // for keyPress and keyRelease events
         testKeyStates(window); // for testing key state (holding keys)
 
-        // Calculate physics
-        physics(1, objects.size() - 1);
+        // Calculate physics (the selection is a handle, so it stays with its object however the bodies are
+        // re-sorted, and is dropped if its object merges into another)
+        advance(0, objects.size(), SIMULATED_TIME_PER_FRAME);
 
         // Update the object on the hand
         updateHand();
@@ -987,10 +987,11 @@ int main(void)
         speedArrow.collision_radius = launchSpeed / LAUNCH_SPEED_CHANGE_STEP;
 
         // Currently, rotation is not incorporated in physics. Here I just add a hardcoded rotation for a better looking.
-        for (unsigned i = 1; i < objects.size(); ++i) {
-            double temp = objects[i].rotateY;
-            objects[i].rotateY = objects[i].rotateY * 2 - objects[i].rotateY_last;
-            objects[i].rotateY_last = temp;
+        for (unsigned i = 0; i <= objects.size(); ++i) {
+            Object& object = i < objects.size() ? objects[i] : hud[HAND_OBJECT];
+            double temp = object.rotateY;
+            object.rotateY = object.rotateY * 2 - object.rotateY_last;
+            object.rotateY_last = temp;
         }
     }
 
@@ -1003,8 +1004,6 @@ int main(void)
     VAO.free();
     for (unsigned i = 0; i < VBO.size(); ++i) {
         VBO[i].free();
-        VBO_N[i].free();
-        VBO_T[i].free();
     }
     for (unsigned i = 0; i < EBO.size(); ++i) {
         EBO[i].free();
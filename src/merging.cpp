@@ -0,0 +1,129 @@
+#include "physics.h"
+#include "parallel.h"
+#include <algorithm>
+
+#define MERGE_INDEX_MIN_BODIES 64    // bodies above which the search for touching bodies uses the spatial index
+#define PARALLEL_MIN_BODIES 256      // bodies per thread below which the search runs on one thread
+
+collision_mode_t collision_mode = ELASTIC_COLLISIONS;
+unsigned long long n_merged_bodies = 0;
+
+// Root of the group of body k in the union-find forest parent, halving the path on the way
+static unsigned findGroup(vector<unsigned>& parent, unsigned k) {
+    while (parent[k] != k) {
+        parent[k] = parent[parent[k]];
+        k = parent[k];
+    }
+    return k;
+}
+
+unsigned mergeCollisions(unsigned start_index, unsigned end_index) {
+    // buffers kept over the rounds: a merged body is larger than its parts, and may reach bodies that none of
+    // them touched, so the merging repeats until no bodies touch
+    vector<Vector3d> pos, pos_last, moment, momentum;
+    vector<double> mass, radius, swept_radius, total_mass, volume;
+    vector<vector<unsigned> > touching;
+    vector<unsigned> parent, survivor, members;
+    vector<gravity_source_t> source;
+    vector<bool> merged;
+    static Octree tree;
+    unsigned total_removed = 0;
+    for (;;) {
+        unsigned n = end_index - start_index;
+        pos.resize(n);
+        pos_last.resize(n);
+        mass.resize(n);
+        radius.resize(n);
+        swept_radius.resize(n);
+        for (unsigned k = 0; k < n; ++k) {
+            Object& object = objects[start_index + k];
+            pos[k] = Vector3d(object.translateX, object.translateY, object.translateZ);
+            pos_last[k] = Vector3d(object.translateX_last, object.translateY_last, object.translateZ_last);
+            mass[k] = object.mass;
+            radius[k] = object.collision_radius;
+            swept_radius[k] = radius[k] + (pos[k] - pos_last[k]).norm();
+            object.COLLISION = false;   // nothing stays in contact
+        }
+
+        // every body lists the bodies after it whose swept spheres its own touched at some time in the last step
+        // (also when they were already in contact and parting); the broad phase is the same as for elastic
+        // collisions
+        bool indexed = n > MERGE_INDEX_MIN_BODIES;
+        if (indexed) tree.build(pos, mass, n, OCTREE_LEAF_SIZE, &swept_radius);
+        touching.resize(n);
+        for (unsigned k = 0; k < n; ++k) touching[k].clear();
+        parallelFor(n, PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+            for (unsigned i = begin; i < end; ++i) {
+                auto test = [&](unsigned j) {
+                    if (j > i && sweptImpact(pos_last[i], pos[i], radius[i], pos_last[j], pos[j], radius[j], true) <= 1)
+                        touching[i].push_back(j);
+                };
+                if (indexed) {
+                    tree.overlapping(pos[i], swept_radius[i], test);
+                } else {
+                    for (unsigned j = i + 1; j < n; ++j) test(j);
+                }
+            }
+        });
+
+        // groups of bodies connected by contacts (a body hit by two others merges with both)
+        parent.resize(n);
+        for (unsigned k = 0; k < n; ++k) parent[k] = k;
+        bool any = false;
+        for (unsigned i = 0; i < n; ++i) {
+            for (unsigned j : touching[i]) {
+                parent[findGroup(parent, j)] = findGroup(parent, i);
+                any = true;
+            }
+        }
+        if (!any) return total_removed;
+
+        // each group merges into its most massive body (the first of them if equal), with the sums of the group:
+        // mass, momentum (as mass times the motion over the last step), volume, and the center of mass. It is a
+        // gravity source if any member was one: ACTIVE if any was ACTIVE, else AUTO if any was AUTO, else PASSIVE.
+        survivor.assign(n, n);
+        members.assign(n, 0);
+        source.assign(n, PASSIVE_SOURCE);
+        total_mass.assign(n, 0.0);
+        volume.assign(n, 0.0);
+        moment.assign(n, Vector3d::Zero());
+        momentum.assign(n, Vector3d::Zero());
+        for (unsigned k = 0; k < n; ++k) {
+            unsigned group = findGroup(parent, k);
+            if (survivor[group] == n || mass[k] > mass[survivor[group]]) survivor[group] = k;
+            ++members[group];
+            gravity_source_t member_source = objects[start_index + k].gravity_source;
+            if (member_source == ACTIVE_SOURCE || (member_source == AUTO_SOURCE && source[group] == PASSIVE_SOURCE))
+                source[group] = member_source;
+            total_mass[group] += mass[k];
+            volume[group] += radius[k] * radius[k] * radius[k];
+            moment[group] += mass[k] * pos[k];
+            momentum[group] += mass[k] * (pos[k] - pos_last[k]);
+        }
+        for (unsigned group = 0; group < n; ++group) {
+            if (members[group] < 2) continue;
+            Object& object = objects[start_index + survivor[group]];
+            Vector3d center = moment[group] / total_mass[group], motion = momentum[group] / total_mass[group];
+            object.translateX = center.x();
+            object.translateY = center.y();
+            object.translateZ = center.z();
+            object.translateX_last = center.x() - motion.x();
+            object.translateY_last = center.y() - motion.y();
+            object.translateZ_last = center.z() - motion.z();
+            // the radius of the total volume; the density of the total mass in it, so updateMass() keeps the mass
+            object.collision_radius = std::cbrt(volume[group]);
+            object.density = total_mass[group] / (volume[group] * 4.0 / 3.0 * PI);
+            object.default_radius = false;
+            object.gravity_source = source[group];
+            object.updateMass();
+        }
+
+        // remove the merged bodies in one pass, keeping the order of the others (and of the objects after the range)
+        merged.resize(n);
+        for (unsigned k = 0; k < n; ++k) merged[k] = survivor[findGroup(parent, k)] != k;
+        unsigned removed = objects.eraseMarked(start_index, end_index, merged);
+        n_merged_bodies += removed;
+        total_removed += removed;
+        end_index -= removed;
+    }
+}
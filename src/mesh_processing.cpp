@@ -0,0 +1,452 @@
+#include "mesh_processing.h"
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+namespace {
+
+// All attributes of one vertex, converted to integers so they can be hashed and compared exactly
+struct VertexKey {
+    int64_t attrib[8]; // position xyz, normal xyz, texture uv
+
+    bool operator==(const VertexKey& other) const {
+        return std::memcmp(attrib, other.attrib, sizeof(attrib)) == 0;
+    }
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey& key) const {
+        // FNV-1a over the attribute words
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned i = 0; i < 8; ++i) {
+            hash ^= uint64_t(key.attrib[i]);
+            hash *= 1099511628211ULL;
+        }
+        return size_t(hash);
+    }
+};
+
+// Convert an attribute value to its key representation.
+// With epsilon == 0 the exact bit pattern is used (+0.0 and -0.0 are treated as equal);
+// otherwise the value is snapped to a grid of cell size epsilon.
+int64_t quantize(float value, float epsilon) {
+    if (epsilon > 0.0f) {
+        return int64_t(std::floor(value / epsilon + 0.5f));
+    }
+    value += 0.0f;
+    int32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+}
+
+unsigned weldVertices(Mesh& mesh, float epsilon) {
+    unsigned nV = mesh.V.size();
+    bool hasNormals = mesh.VN.size() == nV;
+    bool hasTexCoords = mesh.texCorrds.size() == nV;
+
+    std::unordered_map<VertexKey, unsigned, VertexKeyHash> uniqueVertices;
+    uniqueVertices.reserve(nV);
+    vector<unsigned> remap(nV);
+    vector<Point> V, VN;
+    vector<Point2d> texCoords;
+
+    for (unsigned i = 0; i < nV; ++i) {
+        VertexKey key;
+        key.attrib[0] = quantize(mesh.V[i].x, epsilon);
+        key.attrib[1] = quantize(mesh.V[i].y, epsilon);
+        key.attrib[2] = quantize(mesh.V[i].z, epsilon);
+        key.attrib[3] = hasNormals ? quantize(mesh.VN[i].x, epsilon) : 0;
+        key.attrib[4] = hasNormals ? quantize(mesh.VN[i].y, epsilon) : 0;
+        key.attrib[5] = hasNormals ? quantize(mesh.VN[i].z, epsilon) : 0;
+        key.attrib[6] = hasTexCoords ? quantize(mesh.texCorrds[i].u, epsilon) : 0;
+        key.attrib[7] = hasTexCoords ? quantize(mesh.texCorrds[i].v, epsilon) : 0;
+
+        auto inserted = uniqueVertices.insert(std::make_pair(key, unsigned(V.size())));
+        if (inserted.second) {
+            // first occurrence of this tuple; keep it as the representative vertex
+            V.push_back(mesh.V[i]);
+            if (hasNormals) VN.push_back(mesh.VN[i]);
+            if (hasTexCoords) texCoords.push_back(mesh.texCorrds[i]);
+        }
+        remap[i] = inserted.first->second;
+    }
+
+    // rewrite faces to the merged vertices
+    for (unsigned i = 0; i < mesh.F.size(); ++i) {
+        mesh.F[i].a = remap[mesh.F[i].a];
+        mesh.F[i].b = remap[mesh.F[i].b];
+        mesh.F[i].c = remap[mesh.F[i].c];
+    }
+
+    unsigned removed = nV - V.size();
+    mesh.V.swap(V);
+    if (hasNormals) mesh.VN.swap(VN);
+    if (hasTexCoords) mesh.texCorrds.swap(texCoords);
+    return removed;
+}
+
+VertexCacheStats analyzeVertexCache(const Mesh& mesh, unsigned cacheSize) {
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    if (mesh.F.empty() || mesh.V.empty()) return stats;
+
+    // timestamp of the moment each vertex entered the cache; a vertex is cached
+    // while fewer than cacheSize misses happened after it entered
+    vector<unsigned> entered(mesh.V.size(), 0);
+    vector<bool> seen(mesh.V.size(), false);
+    unsigned misses = 0;
+    for (unsigned i = 0; i < mesh.F.size(); ++i) {
+        unsigned corners[3] = { mesh.F[i].a, mesh.F[i].b, mesh.F[i].c };
+        for (unsigned k = 0; k < 3; ++k) {
+            unsigned v = corners[k];
+            if (!seen[v] || misses - entered[v] >= cacheSize) {
+                seen[v] = true;
+                entered[v] = misses++;
+            }
+        }
+    }
+    stats.ACMR = float(misses) / mesh.F.size();
+    stats.ATVR = float(misses) / mesh.V.size();
+    return stats;
+}
+
+namespace {
+
+// Parameters of the Forsyth scoring function
+const unsigned FORSYTH_CACHE_SIZE = 32;
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRI_SCORE = 0.75f;
+const float VALENCE_BOOST_SCALE = 2.0f;
+const float VALENCE_BOOST_POWER = 0.5f;
+
+float vertexScore(int cachePosition, unsigned remainingValence) {
+    // vertices not used by any remaining triangle are worthless
+    if (remainingValence == 0) return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // the vertices of the last triangle get a fixed score, so the
+            // algorithm doesn't prefer strips over fans
+            score = LAST_TRI_SCORE;
+        } else {
+            float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+        }
+    }
+    // boost vertices with few triangles left, to get rid of lone vertices quickly
+    score += VALENCE_BOOST_SCALE * std::pow(float(remainingValence), -VALENCE_BOOST_POWER);
+    return score;
+}
+
+}
+
+void optimizeVertexCache(Mesh& mesh) {
+    unsigned nV = mesh.V.size();
+    unsigned nF = mesh.F.size();
+    if (!nV || !nF) return;
+
+    // vertex -> adjacent faces (compressed adjacency lists)
+    vector<unsigned> valence(nV, 0);
+    for (unsigned i = 0; i < nF; ++i) {
+        ++valence[mesh.F[i].a];
+        ++valence[mesh.F[i].b];
+        ++valence[mesh.F[i].c];
+    }
+    vector<unsigned> adjOffset(nV + 1, 0);
+    for (unsigned v = 0; v < nV; ++v) adjOffset[v + 1] = adjOffset[v] + valence[v];
+    vector<unsigned> adjFaces(adjOffset[nV]);
+    vector<unsigned> fill(adjOffset.begin(), adjOffset.end() - 1);
+    for (unsigned i = 0; i < nF; ++i) {
+        adjFaces[fill[mesh.F[i].a]++] = i;
+        adjFaces[fill[mesh.F[i].b]++] = i;
+        adjFaces[fill[mesh.F[i].c]++] = i;
+    }
+
+    // remaining valence is tracked by compacting each adjacency list as faces are emitted
+    vector<unsigned> remaining(valence);
+    vector<int> cachePosition(nV, -1);
+    vector<float> vScore(nV);
+    for (unsigned v = 0; v < nV; ++v) vScore[v] = vertexScore(-1, remaining[v]);
+
+    vector<float> fScore(nF);
+    vector<bool> emitted(nF, false);
+    for (unsigned i = 0; i < nF; ++i) {
+        fScore[i] = vScore[mesh.F[i].a] + vScore[mesh.F[i].b] + vScore[mesh.F[i].c];
+    }
+
+    vector<Face> newF;
+    vector<unsigned> faceOrder;
+    newF.reserve(nF);
+    faceOrder.reserve(nF);
+    vector<unsigned> cache, newCache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    int bestFace = 0;
+    for (unsigned i = 1; i < nF; ++i) {
+        if (fScore[i] > fScore[bestFace]) bestFace = i;
+    }
+    unsigned scanStart = 0;
+
+    while (bestFace >= 0) {
+        // emit the best face
+        const Face& face = mesh.F[bestFace];
+        newF.push_back(face);
+        faceOrder.push_back(bestFace);
+        emitted[bestFace] = true;
+        unsigned corners[3] = { face.a, face.b, face.c };
+        for (unsigned k = 0; k < 3; ++k) {
+            unsigned v = corners[k];
+            unsigned* adj = &adjFaces[adjOffset[v]];
+            for (unsigned j = 0; j < remaining[v]; ++j) {
+                if (adj[j] == unsigned(bestFace)) {
+                    adj[j] = adj[--remaining[v]];
+                    break;
+                }
+            }
+        }
+
+        // push its vertices to the front of the LRU cache
+        newCache.assign(corners, corners + 3);
+        for (unsigned j = 0; j < cache.size(); ++j) {
+            unsigned v = cache[j];
+            if (v != corners[0] && v != corners[1] && v != corners[2]) newCache.push_back(v);
+        }
+        for (unsigned j = FORSYTH_CACHE_SIZE; j < newCache.size(); ++j) {
+            // evicted vertices lose their cache score
+            cachePosition[newCache[j]] = -1;
+            vScore[newCache[j]] = vertexScore(-1, remaining[newCache[j]]);
+        }
+        if (newCache.size() > FORSYTH_CACHE_SIZE) newCache.resize(FORSYTH_CACHE_SIZE);
+        cache.swap(newCache);
+
+        // rescore the cached vertices and the faces around them, picking the next best face
+        for (unsigned j = 0; j < cache.size(); ++j) {
+            cachePosition[cache[j]] = j;
+            vScore[cache[j]] = vertexScore(j, remaining[cache[j]]);
+        }
+        bestFace = -1;
+        float bestScore = -1.0f;
+        for (unsigned j = 0; j < cache.size(); ++j) {
+            unsigned v = cache[j];
+            for (unsigned k = 0; k < remaining[v]; ++k) {
+                unsigned f = adjFaces[adjOffset[v] + k];
+                fScore[f] = vScore[mesh.F[f].a] + vScore[mesh.F[f].b] + vScore[mesh.F[f].c];
+                if (fScore[f] > bestScore) {
+                    bestScore = fScore[f];
+                    bestFace = f;
+                }
+            }
+        }
+
+        // nothing left around the cache; continue with the best of the remaining faces
+        if (bestFace < 0) {
+            while (scanStart < nF && emitted[scanStart]) ++scanStart;
+            for (unsigned i = scanStart; i < nF; ++i) {
+                if (!emitted[i] && fScore[i] > bestScore) {
+                    bestScore = fScore[i];
+                    bestFace = i;
+                }
+            }
+        }
+    }
+
+    // face normals follow their faces
+    if (mesh.FN.size() == nF) {
+        vector<Point> FN(nF);
+        for (unsigned i = 0; i < nF; ++i) FN[i] = mesh.FN[faceOrder[i]];
+        mesh.FN.swap(FN);
+    }
+
+    // renumber vertices in order of first use; unreferenced vertices go to the end
+    const unsigned UNASSIGNED = unsigned(-1);
+    vector<unsigned> remap(nV, UNASSIGNED);
+    unsigned next = 0;
+    for (unsigned i = 0; i < nF; ++i) {
+        unsigned* corners[3] = { &newF[i].a, &newF[i].b, &newF[i].c };
+        for (unsigned k = 0; k < 3; ++k) {
+            if (remap[*corners[k]] == UNASSIGNED) remap[*corners[k]] = next++;
+            *corners[k] = remap[*corners[k]];
+        }
+    }
+    for (unsigned v = 0; v < nV; ++v) {
+        if (remap[v] == UNASSIGNED) remap[v] = next++;
+    }
+    mesh.F.swap(newF);
+
+    vector<Point> V(nV);
+    for (unsigned v = 0; v < nV; ++v) V[remap[v]] = mesh.V[v];
+    mesh.V.swap(V);
+    if (mesh.VN.size() == nV) {
+        vector<Point> VN(nV);
+        for (unsigned v = 0; v < nV; ++v) VN[remap[v]] = mesh.VN[v];
+        mesh.VN.swap(VN);
+    }
+    if (mesh.texCorrds.size() == nV) {
+        vector<Point2d> texCoords(nV);
+        for (unsigned v = 0; v < nV; ++v) texCoords[remap[v]] = mesh.texCorrds[v];
+        mesh.texCorrds.swap(texCoords);
+    }
+}
+
+namespace {
+
+unsigned short quantizeUnorm16(float value, float min, float extent) {
+    if (extent <= 0.0f) return 0;
+    float t = std::min(std::max((value - min) / extent, 0.0f), 1.0f);
+    return (unsigned short)(t * 65535.0f + 0.5f);
+}
+
+float dequantizeUnorm16(unsigned short value, float min, float extent) {
+    return min + value / 65535.0f * extent;
+}
+
+short quantizeSnorm16(float value) {
+    float t = std::min(std::max(value, -1.0f), 1.0f);
+    return short(std::floor(t * 32767.0f + 0.5f));
+}
+
+float signNotZero(float value) {
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Project the unit normal onto the octahedron |x| + |y| + |z| = 1 and unfold the lower half
+void encodeOctahedral(const Point& n, short encoded[2]) {
+    float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (!(l1 > 0.0f)) {
+        encoded[0] = encoded[1] = 0;
+        return;
+    }
+    float u = n.x / l1, v = n.y / l1;
+    if (n.z < 0.0f) {
+        float foldedU = (1.0f - std::fabs(v)) * signNotZero(u);
+        float foldedV = (1.0f - std::fabs(u)) * signNotZero(v);
+        u = foldedU;
+        v = foldedV;
+    }
+    encoded[0] = quantizeSnorm16(u);
+    encoded[1] = quantizeSnorm16(v);
+}
+
+Vector3f decodeOctahedral(const short encoded[2]) {
+    float u = std::max(encoded[0] / 32767.0f, -1.0f);
+    float v = std::max(encoded[1] / 32767.0f, -1.0f);
+    Vector3f n(u, v, 1.0f - std::fabs(u) - std::fabs(v));
+    if (n.z() < 0.0f) {
+        n.x() = (1.0f - std::fabs(v)) * signNotZero(u);
+        n.y() = (1.0f - std::fabs(u)) * signNotZero(v);
+    }
+    return n.normalized();
+}
+
+}
+
+void quantizeVertices(Mesh& mesh) {
+    unsigned nV = mesh.V.size();
+    bool hasNormals = mesh.VN.size() == nV;
+    bool hasTexCoords = mesh.texCorrds.size() == nV;
+
+    // quantization ranges
+    float boundsMax[3], texMax[2];
+    for (unsigned k = 0; k < 3; ++k) {
+        mesh.boundsMin[k] = nV ? INFINITY : 0.0f;
+        boundsMax[k] = nV ? -INFINITY : 0.0f;
+    }
+    for (unsigned i = 0; i < nV; ++i) {
+        const float p[3] = { mesh.V[i].x, mesh.V[i].y, mesh.V[i].z };
+        for (unsigned k = 0; k < 3; ++k) {
+            mesh.boundsMin[k] = std::min(mesh.boundsMin[k], p[k]);
+            boundsMax[k] = std::max(boundsMax[k], p[k]);
+        }
+    }
+    for (unsigned k = 0; k < 2; ++k) {
+        mesh.texMin[k] = hasTexCoords && nV ? INFINITY : 0.0f;
+        texMax[k] = hasTexCoords && nV ? -INFINITY : 0.0f;
+    }
+    for (unsigned i = 0; hasTexCoords && i < nV; ++i) {
+        mesh.texMin[0] = std::min(mesh.texMin[0], mesh.texCorrds[i].u);
+        mesh.texMin[1] = std::min(mesh.texMin[1], mesh.texCorrds[i].v);
+        texMax[0] = std::max(texMax[0], mesh.texCorrds[i].u);
+        texMax[1] = std::max(texMax[1], mesh.texCorrds[i].v);
+    }
+    for (unsigned k = 0; k < 3; ++k) mesh.boundsExtent[k] = boundsMax[k] - mesh.boundsMin[k];
+    for (unsigned k = 0; k < 2; ++k) mesh.texExtent[k] = texMax[k] - mesh.texMin[k];
+
+    // pack vertices
+    mesh.packedV.resize(nV);
+    for (unsigned i = 0; i < nV; ++i) {
+        PackedVertex& packed = mesh.packedV[i];
+        packed.position[0] = quantizeUnorm16(mesh.V[i].x, mesh.boundsMin[0], mesh.boundsExtent[0]);
+        packed.position[1] = quantizeUnorm16(mesh.V[i].y, mesh.boundsMin[1], mesh.boundsExtent[1]);
+        packed.position[2] = quantizeUnorm16(mesh.V[i].z, mesh.boundsMin[2], mesh.boundsExtent[2]);
+        packed.position[3] = 0;
+        if (hasNormals) {
+            encodeOctahedral(mesh.VN[i], packed.normal);
+        } else {
+            packed.normal[0] = packed.normal[1] = 0;
+        }
+        if (hasTexCoords) {
+            packed.texCoords[0] = quantizeUnorm16(mesh.texCorrds[i].u, mesh.texMin[0], mesh.texExtent[0]);
+            packed.texCoords[1] = quantizeUnorm16(mesh.texCorrds[i].v, mesh.texMin[1], mesh.texExtent[1]);
+        } else {
+            packed.texCoords[0] = packed.texCoords[1] = 0;
+        }
+    }
+}
+
+QuantizationError measureQuantizationError(const Mesh& mesh) {
+    QuantizationError error = { 0.0f, 0.0f, 0.0f };
+    unsigned nV = mesh.packedV.size();
+    bool hasNormals = mesh.VN.size() == nV;
+    bool hasTexCoords = mesh.texCorrds.size() == nV;
+
+    for (unsigned i = 0; i < nV; ++i) {
+        const PackedVertex& packed = mesh.packedV[i];
+        Vector3f position(dequantizeUnorm16(packed.position[0], mesh.boundsMin[0], mesh.boundsExtent[0]),
+                          dequantizeUnorm16(packed.position[1], mesh.boundsMin[1], mesh.boundsExtent[1]),
+                          dequantizeUnorm16(packed.position[2], mesh.boundsMin[2], mesh.boundsExtent[2]));
+        error.position = std::max(error.position, 
+                                  (position - Vector3f(mesh.V[i].x, mesh.V[i].y, mesh.V[i].z)).norm());
+        if (hasNormals) {
+            Vector3f normal = Vector3f(mesh.VN[i].x, mesh.VN[i].y, mesh.VN[i].z).normalized();
+            float cosAngle = std::min(std::max(normal.dot(decodeOctahedral(packed.normal)), -1.0f), 1.0f);
+            error.normal = std::max(error.normal, float(std::acos(cosAngle) * 180.0 / PI));
+        }
+        if (hasTexCoords) {
+            error.texCoords = std::max(error.texCoords, std::fabs(
+                dequantizeUnorm16(packed.texCoords[0], mesh.texMin[0], mesh.texExtent[0]) - mesh.texCorrds[i].u));
+            error.texCoords = std::max(error.texCoords, std::fabs(
+                dequantizeUnorm16(packed.texCoords[1], mesh.texMin[1], mesh.texExtent[1]) - mesh.texCorrds[i].v));
+        }
+    }
+    if (mesh.maxRadius > 0.0f) error.position /= mesh.maxRadius;
+    return error;
+}
+
+void generateSphere(Mesh& mesh, unsigned stacks, unsigned slices) {
+    mesh = Mesh();
+    // vertices on a latitude/longitude grid; the seam column is duplicated for the texture coords
+    for (unsigned i = 0; i <= stacks; ++i) {
+        float theta = PI * i / stacks;
+        for (unsigned j = 0; j <= slices; ++j) {
+            float phi = 2 * PI * j / slices;
+            Point p = { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+            mesh.V.push_back(p);
+            mesh.VN.push_back(p);
+            mesh.texCorrds.push_back(Point2d{ float(j) / slices, 1.0f - float(i) / stacks });
+        }
+    }
+    for (unsigned i = 0; i < stacks; ++i) {
+        for (unsigned j = 0; j < slices; ++j) {
+            unsigned a = i * (slices + 1) + j;
+            unsigned b = a + slices + 1;
+            if (i != 0) mesh.F.push_back(Face{ a, a + 1, b });
+            if (i != stacks - 1) mesh.F.push_back(Face{ a + 1, b + 1, b });
+        }
+    }
+    mesh.barycenterX = mesh.barycenterY = mesh.barycenterZ = 0.0;
+    mesh.maxRadius = 1.0;
+}
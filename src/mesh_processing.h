@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common_header.h"
+#include "object_class.h"
+
+// Merge vertices whose (position, normal, texture coords) tuples are identical
+// (or fall into the same epsilon-sized cell if epsilon > 0), and rewrite the faces
+// to index the merged vertices.
+// Returns the number of vertices removed.
+unsigned weldVertices(Mesh& mesh, float epsilon = 0.0f);
+
+// Post-transform vertex cache statistics of a mesh's index order
+struct VertexCacheStats {
+    float ACMR; // average cache miss ratio: transformed vertices per triangle
+    float ATVR; // average transform to vertex ratio: transformed vertices per distinct vertex
+};
+
+// Simulate a FIFO post-transform vertex cache of cacheSize entries over the faces of a mesh
+VertexCacheStats analyzeVertexCache(const Mesh& mesh, unsigned cacheSize = 16);
+
+// Reorder the faces for post-transform vertex cache locality (Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation"), then renumber the vertices
+// in order of first use so vertex fetches walk the buffers linearly.
+void optimizeVertexCache(Mesh& mesh);
+
+// Fill mesh.packedV (and the dequantization ranges) from the float vertex attributes:
+// 16-bit positions relative to the bounding box, octahedral 2x16-bit normals and 16-bit texture coords
+void quantizeVertices(Mesh& mesh);
+
+// Largest errors introduced by quantizeVertices()
+struct QuantizationError {
+    float position;  // relative to mesh.maxRadius
+    float normal;    // angle in degrees
+    float texCoords; // absolute
+};
+
+// Decode mesh.packedV on the CPU the same way the vertex shader does and compare with the float attributes
+QuantizationError measureQuantizationError(const Mesh& mesh);
+
+// Generate a unit sphere centered on the origin (with normals and texture coords)
+void generateSphere(Mesh& mesh, unsigned stacks, unsigned slices);
@@ -0,0 +1,126 @@
+#include "multipole.h"
+#include <algorithm>
+
+static double factorial(unsigned n) {
+    return n <= 1 ? 1.0 : n * factorial(n - 1);
+}
+
+MultiIndices::MultiIndices(unsigned order) : order(order), lookup((order + 1) * (order + 1) * (order + 1), -1) {
+    for (unsigned degree = 0; degree <= order; ++degree) {
+        for (unsigned x = degree + 1; x-- > 0; ) for (unsigned y = degree - x + 1; y-- > 0; ) {
+            unsigned z = degree - x - y;
+            lookup[(x * (order + 1) + y) * (order + 1) + z] = a.size();
+            a.push_back(x);
+            b.push_back(y);
+            c.push_back(z);
+            inverse_factorial.push_back(1.0 / (factorial(x) * factorial(y) * factorial(z)));
+        }
+    }
+    for (unsigned k = 0; k < size(); ++k) {
+        lower_x.push_back(at(a[k] - 1, b[k], c[k]));
+        lower_y.push_back(at(a[k], b[k] - 1, c[k]));
+        lower_z.push_back(at(a[k], b[k], c[k] - 1));
+        upper_x.push_back(at(a[k] + 1, b[k], c[k]));
+        upper_y.push_back(at(a[k], b[k] + 1, c[k]));
+        upper_z.push_back(at(a[k], b[k], c[k] + 1));
+        shift_begin.push_back(shift_j.size());
+        sum_begin.push_back(sum_j.size());
+        for (unsigned j = 0; j < size(); ++j) {
+            int m = at(int(a[k]) - int(a[j]), int(b[k]) - int(b[j]), int(c[k]) - int(c[j]));
+            if (m >= 0) {
+                shift_j.push_back(j);
+                shift_m.push_back(m);
+            }
+            m = at(a[k] + a[j], b[k] + b[j], c[k] + c[j]);
+            if (m >= 0) {
+                sum_j.push_back(j);
+                sum_m.push_back(m);
+            }
+        }
+    }
+    shift_begin.push_back(shift_j.size());
+    sum_begin.push_back(sum_j.size());
+}
+
+int MultiIndices::at(int x, int y, int z) const {
+    if (x < 0 || y < 0 || z < 0 || unsigned(x + y + z) > order) return -1;
+    return lookup[(x * (order + 1) + y) * (order + 1) + z];
+}
+
+void MultiIndices::scaledMonomials(const Vector3d& d, double* out) const {
+    double px[MULTIPOLE_MAX_ORDER + 1], py[MULTIPOLE_MAX_ORDER + 1], pz[MULTIPOLE_MAX_ORDER + 1];
+    px[0] = py[0] = pz[0] = 1.0;
+    for (unsigned k = 1; k <= order; ++k) {
+        px[k] = px[k - 1] * d.x() / k;
+        py[k] = py[k - 1] * d.y() / k;
+        pz[k] = pz[k - 1] * d.z() / k;
+    }
+    for (unsigned k = 0; k < size(); ++k) out[k] = px[a[k]] * py[b[k]] * pz[c[k]];
+}
+
+// The recurrence of McMurchie & Davidson (1978): R(n; 0) = (-1)^n (2n - 1)!! / r^(2n + 1),
+// R(n; k + e_x) = k_x R(n + 1; k - e_x) + x R(n + 1; k), and D_k = R(0; k)
+void inverseDistanceDerivatives(const MultiIndices& index, const Vector3d& r, double* out) {
+    unsigned p = index.order, n_terms = index.size();
+    double table[(MULTIPOLE_MAX_ORDER + 1) * MULTIPOLE_MAX_TERMS];
+    auto R = [&](unsigned n, int k) -> double& { return table[n * n_terms + k]; };
+    double inverse_r2 = 1.0 / r.squaredNorm();
+    double value = std::sqrt(inverse_r2);
+    for (unsigned n = 0; n <= p; ++n) {
+        R(n, 0) = value;
+        value *= -(2.0 * n + 1) * inverse_r2;
+    }
+    for (unsigned k = 1; k < n_terms; ++k) {
+        // step along the first axis with a nonzero index
+        const vector<int>* lower;
+        int axis_index;
+        double coordinate;
+        if (index.a[k] > 0) {
+            lower = &index.lower_x; axis_index = index.a[k]; coordinate = r.x();
+        } else if (index.b[k] > 0) {
+            lower = &index.lower_y; axis_index = index.b[k]; coordinate = r.y();
+        } else {
+            lower = &index.lower_z; axis_index = index.c[k]; coordinate = r.z();
+        }
+        int previous = (*lower)[k];
+        int before = (*lower)[previous];
+        for (unsigned n = 0; n + index.degree(k) <= p; ++n) {
+            R(n, k) = (before >= 0 ? (axis_index - 1) * R(n + 1, before) : 0.0) + coordinate * R(n + 1, previous);
+        }
+    }
+    for (unsigned k = 0; k < n_terms; ++k) out[k] = R(0, k);
+}
+
+void leafMoments(const MultiIndices& index, const Octree& tree, unsigned node,
+                 const vector<Vector3d>& pos, const vector<double>& mass, double* moments) {
+    const OctreeNode& current = tree.nodes[node];
+    double d[MULTIPOLE_MAX_TERMS];
+    std::fill(moments, moments + index.size(), 0.0);
+    for (unsigned b = current.body_begin; b < current.body_end; ++b) {
+        unsigned j = tree.bodies[b];
+        if (mass[j] == 0.0) continue;
+        index.scaledMonomials(pos[j] - current.center_of_mass, d);
+        for (unsigned k = 0; k < index.size(); ++k) moments[k] += mass[j] * d[k];
+    }
+}
+
+// M_k(parent) = sum over the children and j <= k of M_j(child) s^(k - j) / (k - j)!, s = child - parent center
+void shiftedMoments(const MultiIndices& index, const Octree& tree, unsigned node,
+                    const vector<double>& all_moments, double* moments) {
+    const OctreeNode& current = tree.nodes[node];
+    unsigned n_terms = index.size();
+    double s[MULTIPOLE_MAX_TERMS];
+    std::fill(moments, moments + n_terms, 0.0);
+    for (unsigned c = current.first_child; c < current.first_child + current.n_children; ++c) {
+        if (tree.nodes[c].mass == 0.0) continue;
+        index.scaledMonomials(tree.nodes[c].center_of_mass - current.center_of_mass, s);
+        const double* child = &all_moments[c * n_terms];
+        for (unsigned k = 0; k < n_terms; ++k) {
+            double sum = 0.0;
+            for (unsigned t = index.shift_begin[k]; t < index.shift_begin[k + 1]; ++t) {
+                sum += child[index.shift_j[t]] * s[index.shift_m[t]];
+            }
+            moments[k] += sum;
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common_header.h"
+#include "octree.h"
+
+#define MULTIPOLE_MAX_ORDER  8    // highest order of the multi-indices
+#define MULTIPOLE_MAX_TERMS  ((MULTIPOLE_MAX_ORDER + 1) * (MULTIPOLE_MAX_ORDER + 2) * (MULTIPOLE_MAX_ORDER + 3) / 6)
+
+// Cartesian multi-indices k = (a, b, c) with a + b + c <= order, in order of increasing degree
+// (so the indices up to a lower order come first), with the index tables the expansion operators loop over
+struct MultiIndices {
+    unsigned order;
+    vector<unsigned> a, b, c;
+    vector<double> inverse_factorial;        // 1 / (a! b! c!)
+    vector<int> lower_x, lower_y, lower_z;   // k - e_x, k - e_y, k - e_z (-1 if not a multi-index)
+    vector<int> upper_x, upper_y, upper_z;   // k + e_x, k + e_y, k + e_z (-1 beyond the order)
+    // shifts: for k, the pairs (j, k - j) of multi-indices with j <= k, from shift_begin[k] to shift_begin[k + 1]
+    vector<unsigned> shift_begin, shift_j, shift_m;
+    // sums: for k, the pairs (j, j + k) with |j + k| <= order, from sum_begin[k] to sum_begin[k + 1]
+    vector<unsigned> sum_begin, sum_j, sum_m;
+
+    explicit MultiIndices(unsigned order);
+    unsigned size() const { return a.size(); }
+    unsigned degree(unsigned k) const { return a[k] + b[k] + c[k]; }
+    // position of (x, y, z), or -1 if it is not in the list
+    int at(int x, int y, int z) const;
+    // d^k / k! for every multi-index k
+    void scaledMonomials(const Vector3d& d, double* out) const;
+
+private:
+    vector<int> lookup;   // position of (a, b, c) in the list
+};
+
+// Number of multi-indices up to an order
+inline unsigned multipoleTerms(unsigned order) {
+    return (order + 1) * (order + 2) * (order + 3) / 6;
+}
+
+// Derivatives D_k = d^k (1 / |r|) for every multi-index
+void inverseDistanceDerivatives(const MultiIndices& index, const Vector3d& r, double* out);
+
+// Multipole moments M_k = sum m d^k / k! of the bodies of a leaf about its center of mass (d = body - center of mass)
+void leafMoments(const MultiIndices& index, const Octree& tree, unsigned node,
+                 const vector<Vector3d>& pos, const vector<double>& mass, double* moments);
+// Moments of an inner node from those of its children, stored index.size() per node in all_moments
+void shiftedMoments(const MultiIndices& index, const Octree& tree, unsigned node,
+                    const vector<double>& all_moments, double* moments);
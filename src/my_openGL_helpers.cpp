@@ -2,6 +2,14 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#ifdef _WIN32
+#  include <direct.h>
+#else
+#  include <sys/stat.h>
+#endif
 
 void VertexArrayObject::init()
 {
@@ -61,6 +69,18 @@ void VertexBufferObject::update(const vector<Point2d>& coords)
     check_gl_error();
 }
 
+void VertexBufferObject::update(const vector<PackedVertex>& vertices)
+{
+    if (!vertices.size()) return;
+    assert(id != 0);
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(PackedVertex)*vertices.size(), &vertices[0], GL_STATIC_DRAW);
+    rows = 1;
+    cols = vertices.size();
+    stride = sizeof(PackedVertex);
+    check_gl_error();
+}
+
 void ElementBufferObject::init()
 {
     glGenBuffers(1,&id);
@@ -93,7 +113,8 @@ void ElementBufferObject::update(const vector<Face>& faces)
 bool Program::init(
   const std::string &vertex_shader_string,
   const std::string &fragment_shader_string,
-  const std::string &fragment_data_name)
+  const std::string &fragment_data_name,
+  bool retrievable_binary)
 {
   using namespace std;
   vertex_shader = create_shader_helper(GL_VERTEX_SHADER, vertex_shader_string);
@@ -108,6 +129,8 @@ bool Program::init(
   glAttachShader(program_shader, fragment_shader);
 
   glBindFragDataLocation(program_shader, 0, fragment_data_name.c_str());
+  if (retrievable_binary)
+    glProgramParameteri(program_shader, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram(program_shader);
 
   GLint status;
@@ -126,6 +149,110 @@ bool Program::init(
   return true;
 }
 
+bool Program::initCached(
+  const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name,
+  const std::string &cache_dir)
+{
+  using namespace std;
+  from_binary_cache = false;
+  if (!binary_cache_supported())
+    return init(vertex_shader_string, fragment_shader_string, fragment_data_name);
+
+  // Cache key: FNV-1a hash of the sources and of the driver identification
+  string key_string = vertex_shader_string + '\0' + fragment_shader_string + '\0' + fragment_data_name + '\0'
+                      + (const char*)glGetString(GL_VENDOR) + '\0'
+                      + (const char*)glGetString(GL_RENDERER) + '\0'
+                      + (const char*)glGetString(GL_VERSION);
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned i = 0; i < key_string.size(); ++i)
+  {
+    hash ^= (unsigned char) key_string[i];
+    hash *= 1099511628211ULL;
+  }
+  ostringstream filename;
+  filename << cache_dir << "/" << hex << setw(16) << setfill('0') << hash << ".bin";
+
+  if (load_binary(filename.str()))
+  {
+    from_binary_cache = true;
+    return true;
+  }
+
+  if (!init(vertex_shader_string, fragment_shader_string, fragment_data_name, true))
+    return false;
+#ifdef _WIN32
+  _mkdir(cache_dir.c_str());
+#else
+  mkdir(cache_dir.c_str(), 0755);
+#endif
+  if (!save_binary(filename.str()))
+    cerr << "Could not write shader cache file " << filename.str() << endl;
+  return true;
+}
+
+bool Program::binary_cache_supported()
+{
+#ifndef __APPLE__
+  if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+    return false;
+#endif
+  GLint n_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+  check_gl_error();
+  return n_formats > 0;
+}
+
+bool Program::load_binary(const std::string &filename)
+{
+  using namespace std;
+  ifstream file(filename.c_str(), ios::binary);
+  if (!file.good())
+    return false;
+
+  // File layout: binary format enum, then the program binary
+  GLenum format;
+  file.read((char*) &format, sizeof(format));
+  vector<char> binary((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  if (binary.empty())
+    return false;
+
+  program_shader = glCreateProgram();
+  glProgramBinary(program_shader, format, &binary[0], binary.size());
+  // A changed driver may reject the binary; that is not an error, the program is just compiled again
+  glGetError();
+
+  GLint status;
+  glGetProgramiv(program_shader, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE)
+  {
+    glDeleteProgram(program_shader);
+    program_shader = 0;
+    return false;
+  }
+  return true;
+}
+
+bool Program::save_binary(const std::string &filename) const
+{
+  using namespace std;
+  GLint length = 0;
+  glGetProgramiv(program_shader, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return false;
+
+  vector<char> binary(length);
+  GLenum format;
+  glGetProgramBinary(program_shader, length, NULL, &format, &binary[0]);
+  check_gl_error();
+
+  ofstream file(filename.c_str(), ios::binary);
+  file.write((const char*) &format, sizeof(format));
+  file.write(&binary[0], length);
+  return file.good();
+}
+
 void Program::bind()
 {
   glUseProgram(program_shader);
@@ -162,6 +289,22 @@ GLint Program::bindVertexAttribArray(
   return id;
 }
 
+GLint Program::bindVertexAttribPointer(
+        const std::string &name, VertexBufferObject& VBO,
+        GLint size, GLenum type, bool normalized, unsigned offset) const
+{
+  if (!VBO.rows) return -1;
+  GLint id = attrib(name);
+  if (id < 0)
+    return id;
+  VBO.bind();
+  glEnableVertexAttribArray(id);
+  glVertexAttribPointer(id, size, type, normalized ? GL_TRUE : GL_FALSE, VBO.stride, (const GLvoid *) (size_t) offset);
+  check_gl_error();
+
+  return id;
+}
+
 void Program::free()
 {
   if (program_shader)
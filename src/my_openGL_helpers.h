@@ -52,8 +52,9 @@ public:
     GLuint id;
     GLuint rows;
     GLuint cols;
+    GLuint stride; // size in bytes of one interleaved vertex (0 for tightly packed float attributes)
 
-    VertexBufferObject() : id(0), rows(0), cols(0) {}
+    VertexBufferObject() : id(0), rows(0), cols(0), stride(0) {}
 
     // Create a new empty VBO
     void init();
@@ -61,6 +62,7 @@ public:
     // Updates the VBO with a mesh
     void update(const vector<Point>& coords);
     void update(const vector<Point2d>& coords);
+    void update(const vector<PackedVertex>& vertices);
 
     // Select this VBO for subsequent draw calls
     void bind();
@@ -104,13 +106,24 @@ public:
   GLuint vertex_shader;
   GLuint fragment_shader;
   GLuint program_shader;
+  bool from_binary_cache; // whether the program was loaded from the binary cache instead of compiled
 
-  Program() : vertex_shader(0), fragment_shader(0), program_shader(0) { }
+  Program() : vertex_shader(0), fragment_shader(0), program_shader(0), from_binary_cache(false) { }
 
   // Create a new shader from the specified source strings
+  // (retrievable_binary asks the driver to keep the linked binary for glGetProgramBinary)
   bool init(const std::string &vertex_shader_string,
   const std::string &fragment_shader_string,
-  const std::string &fragment_data_name);
+  const std::string &fragment_data_name,
+  bool retrievable_binary = false);
+
+  // Same as init(), but the linked program is kept in a binary cache file in cache_dir,
+  // keyed by the shader sources and the GL vendor/renderer/version.
+  // Falls back to compiling if there is no valid cache entry or the driver can't do program binaries.
+  bool initCached(const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name,
+  const std::string &cache_dir);
 
   // Select this shader for subsequent draw calls
   void bind();
@@ -127,8 +140,18 @@ public:
   // Bind a per-vertex array attribute
   GLint bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const;
 
+  // Bind one attribute of an interleaved VBO
+  // (components of the given type starting at byte offset, optionally normalized to [0, 1] or [-1, 1])
+  GLint bindVertexAttribPointer(const std::string &name, VertexBufferObject& VBO,
+                                GLint size, GLenum type, bool normalized, unsigned offset) const;
+
   GLuint create_shader_helper(GLint type, const std::string &shader_string);
 
+  // Program binary cache helpers
+  static bool binary_cache_supported();
+  bool load_binary(const std::string &filename);
+  bool save_binary(const std::string &filename) const;
+
 };
 
 // From: https://blog.nobel-joergensen.com/2013/01/29/debugging-opengl-using-glgeterror/
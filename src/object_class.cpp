@@ -1,7 +1,7 @@
 #include "object_class.h"
 #include <random>
 
-Object::Object(unsigned _model) : model(_model) {
+Object::Object(unsigned _model) : id(newId()), model(_model) {
     model_initial_translateX = -meshes[_model].barycenterX;
     model_initial_translateY = -meshes[_model].barycenterY;
     model_initial_translateZ = -meshes[_model].barycenterZ;
@@ -29,6 +29,7 @@ Object::Object(unsigned _model) : model(_model) {
 
     // use the farthest reaching vertex as the default collision_radius
     collision_radius = meshes[_model].maxRadius * model_initial_scale;
+    model_pending = !meshes[_model].ready;
 
     // randomize initial rotate speed
     std::random_device rd;
@@ -56,6 +57,23 @@ Object::Object(unsigned _model) : model(_model) {
     updateMass();
 }
 
+unsigned Object::newId() {
+    static unsigned next_id = 0;
+    return next_id++;
+}
+
 void Object::updateMass() {
     mass = collision_radius * collision_radius * collision_radius * 4.0 / 3.0 * PI * density;
+}
+
+void Object::finishModelInit() {
+    model_initial_translateX = -meshes[model].barycenterX;
+    model_initial_translateY = -meshes[model].barycenterY;
+    model_initial_translateZ = -meshes[model].barycenterZ;
+    if (default_radius) {
+        // the radius was derived from the placeholder's unit radius
+        collision_radius *= meshes[model].maxRadius;
+        updateMass();
+    }
+    model_pending = false;
 }
\ No newline at end of file
@@ -1,11 +1,11 @@
 #pragma once
 
 #include "common_header.h"
+#include "slot_map.h"
 
 class Mesh;
 class Object;
 extern vector<Mesh> meshes;          // list to store all model meshes
-extern vector<Object> objects;       // list to store all objects in the scene
 
 enum shading_t {
     WIREFRAME,
@@ -14,6 +14,13 @@ enum shading_t {
     DEBUG_NORMAL
 };
 
+// Whether a body's gravity acts on other bodies
+enum gravity_source_t {
+    AUTO_SOURCE,     // passive if its mass is negligible (see passive_mass_ratio), active otherwise
+    ACTIVE_SOURCE,   // always exerts gravity
+    PASSIVE_SOURCE   // test particle: feels gravity but exerts none
+};
+
 struct Point {
     float x, y, z;
 };
@@ -26,6 +33,14 @@ struct Face {
     unsigned a, b, c;
 };
 
+// Interleaved, quantized vertex as uploaded to the GPU (16 bytes instead of 32);
+// dequantized in the vertex shader
+struct PackedVertex {
+    unsigned short position[4];  // Position normalized to the mesh bounding box (4th component is padding)
+    short normal[2];             // Octahedral-encoded vertex normal
+    unsigned short texCoords[2]; // Texture coords normalized to the mesh texture coords range
+};
+
 // Class to represent a model mesh
 class Mesh {
 public:
@@ -36,11 +51,17 @@ public:
     vector<Point> FN;   // List of face normals
 
     vector<Point2d> texCorrds; // List of vertex texture coords
+
+    vector<PackedVertex> packedV;        // Quantized vertex data for the GPU
+    float boundsMin[3] = {0}, boundsExtent[3] = {0}; // Dequantization ranges of positions
+    float texMin[2] = {0}, texExtent[2] = {0};       // and texture coords
     unsigned texture = -1;     // Texture data ID; -1 stands for no texture
 
-    float barycenterX, barycenterY, barycenterZ;
-    float maxRadius; // The maximum distance from a vertex to barycenter;
-                     // i.e. radius of a containing sphere centered on barycenter
+    float barycenterX = 0.0, barycenterY = 0.0, barycenterZ = 0.0;
+    float maxRadius = 1.0; // The maximum distance from a vertex to barycenter;
+                           // i.e. radius of a containing sphere centered on barycenter
+
+    bool ready = false; // Whether the mesh is loaded and uploaded to the GPU
 
     Mesh() {};
 };
@@ -50,6 +71,8 @@ class Object {
 public:
     Object(unsigned _model = 0);
 
+    unsigned id;                    // Stable identity: the place of an object in objects changes when the bodies
+                                    // are re-sorted (copies share it, so a copy that becomes a new object needs newId())
     unsigned model;
 
     // rendering related attributes
@@ -77,9 +100,22 @@ public:
     double collision_radius = 1.0;
     double density = 10.0;          // For calculating mass
     double mass;                   // Derived from density and collision_radius
+    gravity_source_t gravity_source = AUTO_SOURCE;
     bool COLLISION = false; // To check if the object is already in a collision (so it is not deemed as a new collision)
                             // Note since there is only one collision flag, 
                             // collision with multiple objects at the same time is not supported
 
+    // A model that is still loading has unit radius and zero barycenter;
+    // objects created meanwhile are drawn as a placeholder sphere
+    bool model_pending = false;     // Model-dependent attributes still need finishModelInit()
+    bool default_radius = true;     // collision_radius is (a multiple of) the model's default radius;
+                                    // false if it was set explicitly
+
     void updateMass();
-};
\ No newline at end of file
+    // A fresh id, not used by any object before
+    static unsigned newId();
+    // Apply the model's barycenter and radius once a pending model is loaded
+    void finishModelInit();
+};
+
+extern SlotMap<Object> objects;      // the objects in the scene that participate in physics simulation
\ No newline at end of file
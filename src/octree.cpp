@@ -0,0 +1,290 @@
+#include "octree.h"
+#include "parallel.h"
+#include <algorithm>
+
+#define RADIX_BITS           11     // bits of the key sorted per pass of the radix sort
+#define RADIX_MIN_KEYS       1024   // fewer keys are sorted by comparison
+#define SCAN_MAX_BODIES      64     // nodes with up to this many bodies are split by counting instead of binary search
+#define PARALLEL_MIN_BODIES  4096   // bodies per thread below which a pass over the bodies runs on one thread
+#define PARALLEL_MIN_NODES   256    // nodes per thread below which a pass over a level runs on one thread
+
+// Number of contiguous chunks a pass over n items is split into, one per thread
+static unsigned chunkCount(unsigned n) {
+    return std::max(1u, std::min(parallelThreads(), n / PARALLEL_MIN_BODIES));
+}
+
+// Spread the lower 21 bits of x to every third bit
+static uint64_t spreadBits(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+// Stable parallel LSD radix sort of (key, value) pairs on the lowest key_bits bits of the keys: every chunk
+// counts its digits of all passes at once, the counts give each chunk its place among the keys with every digit,
+// and the chunks scatter; passes whose digit is the same for all keys are skipped. After a scatter the chunks
+// hold other keys, so with several chunks the later passes count their chunks again.
+static void radixSort(vector<uint64_t>& keys, vector<unsigned>& values, unsigned key_bits) {
+    const unsigned n = keys.size(), radix = 1u << RADIX_BITS, n_passes = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+    if (n < RADIX_MIN_KEYS) {
+        vector<pair<uint64_t, unsigned> > sorted(n);
+        for (unsigned k = 0; k < n; ++k) sorted[k] = std::make_pair(keys[k], values[k]);
+        std::sort(sorted.begin(), sorted.end());
+        for (unsigned k = 0; k < n; ++k) {
+            keys[k] = sorted[k].first;
+            values[k] = sorted[k].second;
+        }
+        return;
+    }
+    const unsigned n_chunks = chunkCount(n);
+    auto chunkBegin = [&](unsigned c) { return unsigned(uint64_t(n) * c / n_chunks); };
+    vector<unsigned> offset(n_passes * n_chunks * radix, 0);   // offset[(pass * n_chunks + chunk) * radix + digit]
+    auto count = [&](unsigned first_pass, unsigned end_pass) {
+        parallelFor(n_chunks, 1, [&](unsigned begin, unsigned end) {
+            for (unsigned c = begin; c < end; ++c) {
+                for (unsigned k = chunkBegin(c); k < chunkBegin(c + 1); ++k) {
+                    for (unsigned pass = first_pass; pass < end_pass; ++pass) {
+                        ++offset[(pass * n_chunks + c) * radix + (keys[k] >> (pass * RADIX_BITS) & (radix - 1))];
+                    }
+                }
+            }
+        });
+    };
+    count(0, n_passes);
+
+    vector<uint64_t> other_keys(n);
+    vector<unsigned> other_values(n);
+    for (unsigned pass = 0; pass < n_passes; ++pass) {
+        unsigned* pass_offset = &offset[pass * n_chunks * radix];
+        bool trivial = false;
+        for (unsigned d = 0; d < radix && !trivial; ++d) {
+            unsigned digit_total = 0;
+            for (unsigned c = 0; c < n_chunks; ++c) digit_total += pass_offset[c * radix + d];
+            trivial = digit_total == n;
+        }
+        if (trivial) continue;
+        if (pass > 0 && n_chunks > 1) {
+            std::fill(pass_offset, pass_offset + n_chunks * radix, 0u);
+            count(pass, pass + 1);
+        }
+        unsigned total = 0;
+        for (unsigned d = 0; d < radix; ++d) {
+            for (unsigned c = 0; c < n_chunks; ++c) {
+                unsigned digit_count = pass_offset[c * radix + d];
+                pass_offset[c * radix + d] = total;
+                total += digit_count;
+            }
+        }
+        const unsigned shift = pass * RADIX_BITS;
+        parallelFor(n_chunks, 1, [&](unsigned begin, unsigned end) {
+            for (unsigned c = begin; c < end; ++c) {
+                unsigned* next = &pass_offset[c * radix];
+                for (unsigned k = chunkBegin(c); k < chunkBegin(c + 1); ++k) {
+                    unsigned to = next[keys[k] >> shift & (radix - 1)]++;
+                    other_keys[to] = keys[k];
+                    other_values[to] = values[k];
+                }
+            }
+        });
+        keys.swap(other_keys);
+        values.swap(other_values);
+    }
+}
+
+// Bounding cube of the first n bodies
+static void boundingCube(const vector<Vector3d>& pos, unsigned n, Vector3d& center, double& half_size) {
+    const unsigned n_chunks = chunkCount(n);
+    vector<Vector3d> chunk_low(n_chunks, Vector3d::Constant(HUGE_VAL)), chunk_high(n_chunks, Vector3d::Constant(-HUGE_VAL));
+    parallelFor(n_chunks, 1, [&](unsigned begin, unsigned end) {
+        for (unsigned c = begin; c < end; ++c) {
+            for (unsigned k = unsigned(uint64_t(n) * c / n_chunks); k < unsigned(uint64_t(n) * (c + 1) / n_chunks); ++k) {
+                chunk_low[c] = chunk_low[c].cwiseMin(pos[k]);
+                chunk_high[c] = chunk_high[c].cwiseMax(pos[k]);
+            }
+        }
+    });
+    Vector3d low = Vector3d::Constant(HUGE_VAL), high = Vector3d::Constant(-HUGE_VAL);
+    for (unsigned c = 0; c < n_chunks; ++c) {
+        low = low.cwiseMin(chunk_low[c]);
+        high = high.cwiseMax(chunk_high[c]);
+    }
+    center = n > 0 ? Vector3d((low + high) / 2) : Vector3d::Zero();
+    half_size = n > 0 ? std::max((high - low).maxCoeff() / 2, 1E-12) : 0.0;
+}
+
+// Morton codes of the cells of the first n bodies on a grid of 2^OCTREE_MAX_DEPTH cells per side over the cube
+// (bit 3 l of the code is x, 3 l + 1 y and 3 l + 2 z of level l counted from the finest), sorted with the bodies
+static void sortedCodes(const vector<Vector3d>& pos, unsigned n, const Vector3d& center, double half_size,
+                        vector<uint64_t>& codes, vector<unsigned>& bodies) {
+    const double cells = double(1u << OCTREE_MAX_DEPTH);
+    const Vector3d corner = center - Vector3d::Constant(half_size);
+    const double scale = n > 0 ? cells / (2 * half_size) : 0.0;
+    codes.resize(n);
+    bodies.resize(n);
+    parallelFor(n, PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+        for (unsigned k = begin; k < end; ++k) {
+            uint64_t cell[3];
+            for (unsigned axis = 0; axis < 3; ++axis) {
+                double u = (pos[k][axis] - corner[axis]) * scale;
+                cell[axis] = uint64_t(std::min(std::max(u, 0.0), cells - 1));
+            }
+            codes[k] = spreadBits(cell[0]) | spreadBits(cell[1]) << 1 | spreadBits(cell[2]) << 2;
+            bodies[k] = k;
+        }
+    });
+    radixSort(codes, bodies, 3 * OCTREE_MAX_DEPTH);
+}
+
+void mortonOrder(const vector<Vector3d>& pos, unsigned n, vector<unsigned>& order) {
+    Vector3d center;
+    double half_size;
+    vector<uint64_t> codes;
+    boundingCube(pos, n, center, half_size);
+    sortedCodes(pos, n, center, half_size, codes, order);
+}
+
+void Octree::build(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n, unsigned leaf_size,
+                   const vector<double>* radius) {
+    // root cube: the bounding cube of the bodies; the bodies sorted along the Morton curve through it
+    OctreeNode root;
+    boundingCube(pos, n, root.center, root.half_size);
+    root.depth = 0;
+    root.first_child = 0;
+    root.n_children = 0;
+    root.body_begin = 0;
+    root.body_end = n;
+    sortedCodes(pos, n, root.center, root.half_size, codes, bodies);
+
+    // nodes one level after the other: the children of a node are the runs of its bodies with the same
+    // octant digit of the code at the next level, which follow each other as the codes are sorted
+    nodes.assign(1, root);
+    levels.assign(1, 0);
+    for (unsigned depth = 0; levels.back() < nodes.size(); ++depth) {
+        unsigned level_begin = levels.back(), level_end = nodes.size(), count = level_end - level_begin;
+        levels.push_back(level_end);
+        if (depth >= OCTREE_MAX_DEPTH) break;
+        unsigned shift = 3 * (OCTREE_MAX_DEPTH - 1 - depth);
+        vector<unsigned> split(count * 9);   // for every node, the start of the bodies of each octant and the end
+        vector<unsigned> n_children(count, 0);
+        parallelFor(count, PARALLEL_MIN_NODES, [&](unsigned begin, unsigned end) {
+            for (unsigned k = begin; k < end; ++k) {
+                const OctreeNode& node = nodes[level_begin + k];
+                if (node.body_end - node.body_begin <= leaf_size) continue;
+                unsigned* bound = &split[k * 9];
+                bound[8] = node.body_end;
+                if (node.body_end - node.body_begin <= SCAN_MAX_BODIES) {
+                    unsigned count[8] = { 0 };
+                    for (unsigned b = node.body_begin; b < node.body_end; ++b) ++count[codes[b] >> shift & 7];
+                    bound[0] = node.body_begin;
+                    for (unsigned o = 1; o < 8; ++o) bound[o] = bound[o - 1] + count[o - 1];
+                } else {
+                    for (unsigned o = 0; o < 8; ++o) {
+                        bound[o] = std::lower_bound(codes.begin() + node.body_begin, codes.begin() + node.body_end, o,
+                                                    [shift](uint64_t code, unsigned octant) {
+                                                        return unsigned(code >> shift & 7) < octant;
+                                                    }) - codes.begin();
+                    }
+                }
+                for (unsigned o = 0; o < 8; ++o) n_children[k] += bound[o + 1] > bound[o];
+            }
+        });
+        // children of the level stored consecutively after it, in the order of their parents
+        vector<unsigned> first_child(count);
+        unsigned total = level_end;
+        for (unsigned k = 0; k < count; ++k) {
+            first_child[k] = total;
+            total += n_children[k];
+        }
+        nodes.resize(total);
+        parallelFor(count, PARALLEL_MIN_NODES, [&](unsigned begin, unsigned end) {
+            for (unsigned k = begin; k < end; ++k) {
+                OctreeNode& node = nodes[level_begin + k];
+                if (n_children[k] == 0) continue;
+                node.first_child = first_child[k];
+                node.n_children = n_children[k];
+                const unsigned* bound = &split[k * 9];
+                unsigned c = first_child[k];
+                for (unsigned o = 0; o < 8; ++o) {
+                    if (bound[o + 1] == bound[o]) continue;
+                    OctreeNode& child = nodes[c++];
+                    child.half_size = node.half_size / 2;
+                    child.center = node.center + child.half_size * Vector3d(o & 1 ? 1 : -1, o & 2 ? 1 : -1, o & 4 ? 1 : -1);
+                    child.depth = depth + 1;
+                    child.first_child = 0;
+                    child.n_children = 0;
+                    child.body_begin = bound[o];
+                    child.body_end = bound[o + 1];
+                }
+            }
+        });
+    }
+
+    summarize(pos, mass, radius);
+    built_overlap = overlap();
+}
+
+void Octree::refit(const vector<Vector3d>& pos, const vector<double>& mass, const vector<double>* radius) {
+    summarize(pos, mass, radius);
+}
+
+double Octree::overlap() const {
+    double sum = 0.0;
+    unsigned count = 0;
+    for (unsigned node = 0; node < nodes.size(); ++node) {
+        const OctreeNode& current = nodes[node];
+        if (current.n_children == 0 || current.half_size == 0.0) continue;
+        double children = 0.0;
+        for (unsigned c = current.first_child; c < current.first_child + current.n_children; ++c) {
+            children += nodes[c].half_size * nodes[c].half_size * nodes[c].half_size;
+        }
+        sum += children / (current.half_size * current.half_size * current.half_size);
+        ++count;
+    }
+    return count > 0 ? sum / count : 0.0;
+}
+
+// Mass moments, radius and bound of every node, from the children or from the bodies of a leaf, one level after
+// the other upwards; the cubes grow where their bodies (or their children's cubes) have moved out of them
+void Octree::summarize(const vector<Vector3d>& pos, const vector<double>& mass, const vector<double>* radius) {
+    for (unsigned depth = levels.size() - 1; depth-- > 0; ) {
+        parallelFor(levels[depth + 1] - levels[depth], PARALLEL_MIN_NODES, [&](unsigned begin, unsigned end) {
+            for (unsigned node = levels[depth] + begin; node < levels[depth] + end; ++node) {
+                OctreeNode& current = nodes[node];
+                unsigned first_child = current.first_child, n_children = current.n_children;
+                double total = 0.0, half_size = current.half_size;
+                Vector3d weighted = Vector3d::Zero();
+                for (unsigned c = first_child; c < first_child + n_children; ++c) {
+                    total += nodes[c].mass;
+                    weighted += nodes[c].mass * nodes[c].center_of_mass;
+                    half_size = std::max(half_size, (nodes[c].center - current.center).cwiseAbs().maxCoeff() + nodes[c].half_size);
+                }
+                for (unsigned b = current.body_begin; n_children == 0 && b < current.body_end; ++b) {
+                    total += mass[bodies[b]];
+                    weighted += mass[bodies[b]] * pos[bodies[b]];
+                    half_size = std::max(half_size, (pos[bodies[b]] - current.center).cwiseAbs().maxCoeff());
+                }
+                Vector3d center_of_mass = total > 0 ? Vector3d(weighted / total) : current.center;
+                double farthest = 0.0, bound = 0.0;
+                for (unsigned c = first_child; c < first_child + n_children; ++c) {
+                    double distance = (nodes[c].center_of_mass - center_of_mass).norm();
+                    farthest = std::max(farthest, distance + nodes[c].radius);
+                    bound = std::max(bound, distance + nodes[c].bound);
+                }
+                for (unsigned b = current.body_begin; n_children == 0 && b < current.body_end; ++b) {
+                    double distance = (pos[bodies[b]] - center_of_mass).norm();
+                    farthest = std::max(farthest, distance);
+                    bound = std::max(bound, distance + (radius != NULL ? (*radius)[bodies[b]] : 0.0));
+                }
+                current.half_size = half_size;
+                current.mass = total;
+                current.center_of_mass = center_of_mass;
+                current.radius = farthest;
+                current.bound = bound;
+            }
+        });
+    }
+}
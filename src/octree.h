@@ -0,0 +1,90 @@
+#pragma once
+
+#include "common_header.h"
+#include <cstdint>
+
+#define OCTREE_LEAF_SIZE 8      // default largest number of bodies in a leaf
+#define OCTREE_MAX_DEPTH 21     // bits of the Morton code per axis; leaves at this depth may hold more bodies
+
+// A node of the octree: a cube with the total mass and the center of mass of the bodies inside
+struct OctreeNode {
+    Vector3d center;          // center of the cube
+    double half_size;         // half of the side of the cube
+    Vector3d center_of_mass;
+    double mass;
+    double radius;            // distance from the center of mass to the farthest body inside
+    double bound;             // radius of the sphere about the center of mass that holds the bodies' spheres
+    unsigned depth;           // 0 for the root
+    unsigned first_child;     // children are stored consecutively; 0 for a leaf
+    unsigned n_children;
+    unsigned body_begin;      // the bodies inside are bodies[body_begin ~ body_end) of the tree
+    unsigned body_end;
+};
+
+// Spatial index over a set of bodies, shared by the tree gravity solvers, the collision broad phase and picking:
+// a linear octree over the bodies sorted by their 63-bit Morton codes (the cells of a Z-order curve through the
+// bounding cube), so every node holds a contiguous range of the sorted bodies. The codes, the radix sort,
+// the levels of nodes and the sums of mass and bounds over them are all computed in parallel.
+class Octree {
+public:
+    vector<OctreeNode> nodes;   // nodes[0] is the root; nodes are in order of depth
+    vector<unsigned> levels;    // nodes of depth d are nodes[levels[d] ~ levels[d + 1])
+    vector<unsigned> bodies;    // body indices in Morton order (grouped by node)
+    vector<uint64_t> codes;     // Morton code of bodies[k] (at the last build)
+    double built_overlap;       // overlap() right after the last build
+    unsigned long long generation = 0;   // for the owner: which set of bodies the tree was built over
+
+    // Build the tree over the first n bodies of pos/mass. With radius, bound encloses the bodies' spheres,
+    // otherwise their centers.
+    void build(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n,
+               unsigned leaf_size = OCTREE_LEAF_SIZE, const vector<double>* radius = NULL);
+    // Update the sums and bounds of every node in place, bottom-up, for new positions (and masses, radii)
+    // of the same bodies. Every body stays in its leaf; the cubes grow to keep holding their bodies.
+    void refit(const vector<Vector3d>& pos, const vector<double>& mass, const vector<double>* radius = NULL);
+    // Quality of the tree: the total volume of the children of an inner node over its own volume, averaged over
+    // the inner nodes. At most 1 after a build, where children do not overlap; it grows as refits enlarge them.
+    double overlap() const;
+
+    // Call visit(k) for every body k of the leaves whose bounding spheres overlap the sphere (center, radius);
+    // testing the bodies themselves is up to the caller
+    template<class Visit> void overlapping(const Vector3d& center, double radius, Visit visit) const {
+        unsigned stack[8 * (OCTREE_MAX_DEPTH + 1)];
+        unsigned top = 0;
+        if (!nodes.empty()) stack[top++] = 0;
+        while (top > 0) {
+            const OctreeNode& node = nodes[stack[--top]];
+            if ((node.center_of_mass - center).squaredNorm() >= square(node.bound + radius)) continue;
+            if (node.n_children > 0) {
+                for (unsigned c = 0; c < node.n_children; ++c) stack[top++] = node.first_child + c;
+            } else {
+                for (unsigned b = node.body_begin; b < node.body_end; ++b) visit(bodies[b]);
+            }
+        }
+    }
+
+    // Call visit(k) for every body k of the leaves whose bounding spheres the ray from origin
+    // along the unit vector direction passes through
+    template<class Visit> void alongRay(const Vector3d& origin, const Vector3d& direction, Visit visit) const {
+        unsigned stack[8 * (OCTREE_MAX_DEPTH + 1)];
+        unsigned top = 0;
+        if (!nodes.empty()) stack[top++] = 0;
+        while (top > 0) {
+            const OctreeNode& node = nodes[stack[--top]];
+            Vector3d offset = node.center_of_mass - origin;
+            double along = std::max(offset.dot(direction), 0.0);
+            if (offset.squaredNorm() - along * along > square(node.bound)) continue;
+            if (node.n_children > 0) {
+                for (unsigned c = 0; c < node.n_children; ++c) stack[top++] = node.first_child + c;
+            } else {
+                for (unsigned b = node.body_begin; b < node.body_end; ++b) visit(bodies[b]);
+            }
+        }
+    }
+
+private:
+    void summarize(const vector<Vector3d>& pos, const vector<double>& mass, const vector<double>* radius);
+};
+
+// Indices of the first n bodies in the order of the Morton curve through their bounding cube
+// (the order of Octree::bodies), which keeps bodies close in space close in memory
+void mortonOrder(const vector<Vector3d>& pos, unsigned n, vector<unsigned>& order);
@@ -0,0 +1,95 @@
+#include "parallel.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+unsigned parallel_threads = 0;
+
+// Set on the pool's workers, and on a thread while it runs its own chunk of a parallelFor
+static thread_local bool in_parallel_for = false;
+
+// Threads that wait for the chunks of one parallelFor at a time. They are started when first needed and
+// stay until the program ends, so a parallelFor costs a wake-up instead of creating and joining threads.
+class WorkerPool {
+public:
+    WorkerPool() : body(NULL), count(0), n_chunks(0), generation(0), pending(0), stopping(false) {}
+    ~WorkerPool();
+
+    // Run body on the n_chunks chunks of [0, count): the first n_chunks - 1 on the workers, the last on this thread
+    void run(unsigned count, unsigned n_chunks, const std::function<void(unsigned, unsigned)>& body);
+
+private:
+    vector<std::thread> workers;
+    std::mutex dispatch;                 // held for a whole run(), so parallelFors from several threads take turns
+    std::mutex mutex;                    // guards the job below
+    std::condition_variable jobAvailable, jobDone;
+    const std::function<void(unsigned, unsigned)>* body;
+    unsigned count, n_chunks;
+    unsigned generation;                 // bumped for every job, so a worker runs each job at most once
+    unsigned pending;                    // chunks of the job still running on the workers
+    bool stopping;
+
+    void workerLoop(unsigned chunk);
+};
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for (unsigned i = 0; i < workers.size(); ++i) workers[i].join();
+}
+
+void WorkerPool::run(unsigned count, unsigned n_chunks, const std::function<void(unsigned, unsigned)>& body) {
+    std::lock_guard<std::mutex> turn(dispatch);
+    while (workers.size() + 1 < n_chunks) {
+        workers.push_back(std::thread(&WorkerPool::workerLoop, this, unsigned(workers.size())));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->body = &body;
+        this->count = count;
+        this->n_chunks = n_chunks;
+        pending = n_chunks - 1;
+        ++generation;
+    }
+    jobAvailable.notify_all();
+
+    in_parallel_for = true;
+    body(count * (n_chunks - 1) / n_chunks, count);   // the last chunk on this thread
+    in_parallel_for = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this]() { return pending == 0; });
+}
+
+void WorkerPool::workerLoop(unsigned chunk) {
+    in_parallel_for = true;
+    unsigned done = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        jobAvailable.wait(lock, [&]() { return stopping || generation != done; });
+        if (stopping) return;
+        done = generation;
+        if (chunk + 1 >= n_chunks) continue;   // the job has fewer chunks than there are workers
+        lock.unlock();
+        (*body)(count * chunk / n_chunks, count * (chunk + 1) / n_chunks);
+        lock.lock();
+        if (--pending == 0) jobDone.notify_one();
+    }
+}
+
+unsigned parallelThreads() {
+    return parallel_threads > 0 ? parallel_threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+void parallelFor(unsigned count, unsigned min_chunk, const std::function<void(unsigned, unsigned)>& body) {
+    unsigned n_threads = std::min(parallelThreads(), count / std::max(1u, min_chunk));
+    if (n_threads <= 1 || in_parallel_for) {
+        body(0, count);
+        return;
+    }
+    static WorkerPool pool;
+    pool.run(count, n_threads, body);
+}
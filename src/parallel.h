@@ -0,0 +1,14 @@
+#pragma once
+
+#include "common_header.h"
+#include <functional>
+
+extern unsigned parallel_threads;   // Threads parallelFor may use; 0 for one per hardware thread
+
+// Number of threads parallelFor runs on when there is enough work
+unsigned parallelThreads();
+
+// Run body(begin, end) on contiguous chunks of [0, count), one chunk per thread (see parallelThreads()).
+// Runs on the calling thread alone if there are fewer than min_chunk items per thread, or if it is called from
+// inside another parallelFor. The threads are kept in a pool between calls.
+void parallelFor(unsigned count, unsigned min_chunk, const std::function<void(unsigned, unsigned)>& body);
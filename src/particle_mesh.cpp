@@ -0,0 +1,219 @@
+#include "physics.h"
+#include "parallel.h"
+#include "fft.h"
+
+#define PM_MARGIN_CELLS       4      // empty cells around the bodies (isolated boundaries), room for the stencils
+#define PM_SELF_POTENTIAL     2.38   // potential of a uniform cube at its center, in units of G m / h
+#define PARALLEL_MIN_PLANES   2      // grid planes per thread below which grid passes run on one thread
+#define PARALLEL_MIN_BODIES   256    // bodies per thread below which interpolation runs on one thread
+
+unsigned pm_grid_size = 64;
+mass_assignment_t pm_assignment = TSC;
+bool pm_periodic = false;
+double pm_box_size = 1000.0;
+
+// Nodes and weights of the mass assignment along one axis, for a position u in grid units
+static unsigned assignmentStencil(double u, int& first, double weight[3]) {
+    if (pm_assignment == CIC) {
+        first = int(std::floor(u));
+        double f = u - first;
+        weight[0] = 1 - f;
+        weight[1] = f;
+        return 2;
+    }
+    first = int(std::floor(u + 0.5));
+    double d = u - first;
+    weight[0] = 0.5 * square(0.5 - d);
+    weight[1] = 0.75 - d * d;
+    weight[2] = 0.5 * square(0.5 + d);
+    --first;
+    return 3;
+}
+
+// Fourier transform of the mass assignment along one axis at frequency index f of an n-point grid;
+// the force is divided by its square to undo the smoothing by the assignment and the interpolation
+static double assignmentWindow(int f, unsigned n) {
+    double x = PI_D * f / n;
+    double sinc = x != 0 ? std::sin(x) / x : 1.0;
+    return pm_assignment == CIC ? sinc * sinc : sinc * sinc * sinc;
+}
+
+// Long-range filter of the split with scale r_s (in cells): exp(-k^2 r_s^2), with the assignment deconvolved
+static double longRangeFilter(int fx, int fy, int fz, unsigned n, double split_cells) {
+    double k2 = square(2 * PI_D / n) * (fx * fx + fy * fy + fz * fz);
+    double window = assignmentWindow(fx, n) * assignmentWindow(fy, n) * assignmentWindow(fz, n);
+    return std::exp(-k2 * split_cells * split_cells) / (window * window);
+}
+
+static int signedFrequency(unsigned i, unsigned n) {
+    return i <= n / 2 ? int(i) : int(i) - int(n);
+}
+
+// Fourier transform of the isolated Green's function -1/r (in cells) on the zero-padded grid,
+// filtered to its long-range part if split_cells > 0. Kept between calls, as it only depends on the grid and the split.
+static const vector<complexd>& isolatedKernel(unsigned n_fft, double split_cells) {
+    static vector<complexd> kernel;
+    static unsigned kernel_size = 0;
+    static double kernel_split = -1.0;
+    static mass_assignment_t kernel_assignment = CIC;
+    if (kernel_size == n_fft && kernel_split == split_cells && kernel_assignment == pm_assignment) return kernel;
+
+    kernel.assign(n_fft * n_fft * n_fft, complexd(0.0, 0.0));
+    parallelFor(n_fft, PARALLEL_MIN_PLANES, [&](unsigned begin, unsigned end) {
+        for (unsigned x = begin; x < end; ++x) for (unsigned y = 0; y < n_fft; ++y) for (unsigned z = 0; z < n_fft; ++z) {
+            // distance to the nearest periodic image of the origin in the padded grid
+            double dx = std::min(x, n_fft - x), dy = std::min(y, n_fft - y), dz = std::min(z, n_fft - z);
+            double r = std::sqrt(dx * dx + dy * dy + dz * dz);
+            kernel[(x * n_fft + y) * n_fft + z] = complexd(r > 0 ? -1 / r : -PM_SELF_POTENTIAL, 0.0);
+        }
+    });
+    fft3d(kernel, n_fft, false);
+    if (split_cells > 0) {
+        parallelFor(n_fft, PARALLEL_MIN_PLANES, [&](unsigned begin, unsigned end) {
+            for (unsigned x = begin; x < end; ++x) for (unsigned y = 0; y < n_fft; ++y) for (unsigned z = 0; z < n_fft; ++z) {
+                kernel[(x * n_fft + y) * n_fft + z] *= longRangeFilter(signedFrequency(x, n_fft), signedFrequency(y, n_fft),
+                                                                      signedFrequency(z, n_fft), n_fft, split_cells);
+            }
+        });
+    }
+    kernel_size = n_fft;
+    kernel_split = split_cells;
+    kernel_assignment = pm_assignment;
+    return kernel;
+}
+
+double particleMeshGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                           vector<Vector3d>& acceleration, double split_cells) {
+    unsigned n = pos.size();
+    const unsigned m = pm_grid_size;
+    const unsigned n_fft = pm_periodic ? m : 2 * m;   // isolated: zero-padded to twice the size
+
+    // grid geometry: node (i, j, k) is at origin + h * (i, j, k)
+    Vector3d origin;
+    double h;
+    if (pm_periodic) {
+        h = pm_box_size / m;
+        origin = Vector3d::Constant(-pm_box_size / 2);
+    } else {
+        Vector3d low = Vector3d::Constant(HUGE_VAL), high = Vector3d::Constant(-HUGE_VAL);
+        for (unsigned k = 0; k < n; ++k) {
+            low = low.cwiseMin(pos[k]);
+            high = high.cwiseMax(pos[k]);
+        }
+        double extent = n > 0 ? (high - low).maxCoeff() : 0.0;
+        h = extent > 0 ? extent / (m - 2 * PM_MARGIN_CELLS) : 1.0;
+        origin = (low + high) / 2 - Vector3d::Constant(h * m / 2);
+    }
+    auto wrap = [](int i, unsigned size) { return unsigned(positiveMod(i, int(size))); };
+
+    // mass assignment; the bodies are binned by the first x plane of their stencils, and each thread owns a range
+    // of x planes and visits only the bins that reach into it, in the same order on any number of threads
+    const int reach = pm_assignment == CIC ? 1 : 2;   // x planes after the first one that a stencil covers
+    vector<unsigned> bin_start(m + 1, 0), bin_fill(m), binned(n_active), first_plane(n_active);
+    for (unsigned k = 0; k < n_active; ++k) {
+        int first;
+        double weight[3];
+        assignmentStencil((pos[k].x() - origin.x()) / h, first, weight);
+        first_plane[k] = wrap(first, m);
+        ++bin_start[first_plane[k] + 1];
+    }
+    for (unsigned x = 0; x < m; ++x) {
+        bin_start[x + 1] += bin_start[x];
+        bin_fill[x] = bin_start[x];
+    }
+    for (unsigned k = 0; k < n_active; ++k) binned[bin_fill[first_plane[k]]++] = k;
+
+    vector<double> grid_mass(m * m * m, 0.0);
+    parallelFor(m, PARALLEL_MIN_PLANES, [&](unsigned begin, unsigned end) {
+        for (int plane = int(begin) - reach; plane < int(end); ++plane) {
+            unsigned bin = wrap(plane, m);
+            for (unsigned index = bin_start[bin]; index < bin_start[bin + 1]; ++index) {
+                unsigned k = binned[index];
+                Vector3d u = (pos[k] - origin) / h;
+                int first[3];
+                double weight[3][3];
+                unsigned size = 0;
+                for (unsigned axis = 0; axis < 3; ++axis) size = assignmentStencil(u[axis], first[axis], weight[axis]);
+                for (unsigned a = 0; a < size; ++a) {
+                    // counted from the bin rather than from first[0], so a periodic wrap is not visited twice
+                    int x = plane + int(a);
+                    if (x < int(begin) || x >= int(end)) continue;
+                    for (unsigned b = 0; b < size; ++b) {
+                        unsigned y = wrap(first[1] + b, m);
+                        for (unsigned c = 0; c < size; ++c) {
+                            unsigned z = wrap(first[2] + c, m);
+                            grid_mass[(x * m + y) * m + z] += mass[k] * weight[0][a] * weight[1][b] * weight[2][c];
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // potential: convolution with the Green's function in Fourier space
+    vector<complexd> potential(n_fft * n_fft * n_fft, complexd(0.0, 0.0));
+    for (unsigned x = 0; x < m; ++x) for (unsigned y = 0; y < m; ++y) for (unsigned z = 0; z < m; ++z) {
+        potential[(x * n_fft + y) * n_fft + z] = grid_mass[(x * m + y) * m + z];
+    }
+    fft3d(potential, n_fft, false);
+    if (pm_periodic) {
+        // -4 pi G rho / k^2, filtered to the long-range part of the split
+        parallelFor(n_fft, PARALLEL_MIN_PLANES, [&](unsigned begin, unsigned end) {
+            for (unsigned x = begin; x < end; ++x) for (unsigned y = 0; y < n_fft; ++y) for (unsigned z = 0; z < n_fft; ++z) {
+                int fx = signedFrequency(x, n_fft), fy = signedFrequency(y, n_fft), fz = signedFrequency(z, n_fft);
+                double k2 = square(2 * PI_D / pm_box_size) * (fx * fx + fy * fy + fz * fz);
+                complexd& value = potential[(x * n_fft + y) * n_fft + z];
+                double filter = split_cells > 0 ? longRangeFilter(fx, fy, fz, n_fft, split_cells) : 1.0;
+                value = k2 > 0 ? value * (-4 * PI_D * G_para / (h * h * h * k2) * filter) : complexd(0.0, 0.0);
+            }
+        });
+    } else {
+        const vector<complexd>& kernel = isolatedKernel(n_fft, split_cells);
+        parallelFor(n_fft, PARALLEL_MIN_PLANES, [&](unsigned begin, unsigned end) {
+            for (unsigned i = begin * n_fft * n_fft; i < end * n_fft * n_fft; ++i) {
+                potential[i] *= kernel[i] * (G_para / h);
+            }
+        });
+    }
+    fft3d(potential, n_fft, true);
+
+    // acceleration on the nodes: -grad(potential) by 4-point central differences
+    vector<Vector3d> grid_acceleration(m * m * m);
+    parallelFor(m, PARALLEL_MIN_PLANES, [&](unsigned begin, unsigned end) {
+        auto phi = [&](int x, int y, int z) {
+            return potential[(wrap(x, n_fft) * n_fft + wrap(y, n_fft)) * n_fft + wrap(z, n_fft)].real();
+        };
+        for (unsigned x = begin; x < end; ++x) for (unsigned y = 0; y < m; ++y) for (unsigned z = 0; z < m; ++z) {
+            int i = x, j = y, k = z;
+            grid_acceleration[(x * m + y) * m + z] = Vector3d(
+                8 * (phi(i + 1, j, k) - phi(i - 1, j, k)) - (phi(i + 2, j, k) - phi(i - 2, j, k)),
+                8 * (phi(i, j + 1, k) - phi(i, j - 1, k)) - (phi(i, j + 2, k) - phi(i, j - 2, k)),
+                8 * (phi(i, j, k + 1) - phi(i, j, k - 1)) - (phi(i, j, k + 2) - phi(i, j, k - 2))) / (-12 * h);
+        }
+    });
+
+    // interpolation back to the bodies with the same weights (no self-force, momentum is conserved)
+    parallelFor(n, PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+        for (unsigned k = begin; k < end; ++k) {
+            Vector3d u = (pos[k] - origin) / h;
+            int first[3];
+            double weight[3][3];
+            unsigned size = 0;
+            for (unsigned axis = 0; axis < 3; ++axis) size = assignmentStencil(u[axis], first[axis], weight[axis]);
+            Vector3d acc = Vector3d::Zero();
+            for (unsigned a = 0; a < size; ++a) {
+                unsigned x = wrap(first[0] + a, m);
+                for (unsigned b = 0; b < size; ++b) {
+                    unsigned y = wrap(first[1] + b, m);
+                    for (unsigned c = 0; c < size; ++c) {
+                        unsigned z = wrap(first[2] + c, m);
+                        acc += grid_acceleration[(x * m + y) * m + z] * (weight[0][a] * weight[1][b] * weight[2][c]);
+                    }
+                }
+            }
+            acceleration[k] = acc;
+        }
+    });
+    n_force_evaluations += n;
+    return h;
+}
@@ -1,88 +1,770 @@
-#include "common_header.h"
-#include "object_class.h"
+#include "physics.h"
+#include "parallel.h"
+#include "force_kernels.h"
 
+#define COLLISION_INDEX_MIN_BODIES 64    // bodies above which the collision broad phase uses the spatial index
+#define COLLISION_SCAN_MAX_BODIES 32     // bodies left by the fused pass up to which they test all bodies rather than
+                                         // bring the spatial index up to date
+#define PARALLEL_MIN_BODIES 256          // bodies per thread below which a pass over the bodies runs on one thread
+#define DIRECT_PARALLEL_MIN_PAIRS 65536  // pairs below which the direct sum runs on one thread
+#define REPRODUCIBLE_PARTS 16            // partial sums of the direct sum in the reproducible mode (a power of two)
+#define TIMESCALE_INDEX_MIN_BODIES 64    // bodies above which the shortest dynamical time is searched in an octree
+
+integrator_t integrator = VERLET;
+gravity_solver_t gravity_solver = DIRECT_SUM;
 double G_para = 5.0; // Gravity parameter
 double dt = 0.01;    // Time step
+double passive_mass_ratio = 1E-12; // Relative mass below which a body's own gravity is neglected
+unsigned long long n_force_evaluations = 0;
+bool last_step_verlet = true;
+bool adaptive_dt = false;
+double dt_min = 1E-4;
+double dt_max = 0.1;
+double dt_accuracy = 0.005;
+double dt_smoothing = 0.5;
+double dt_adaptive = 0.01;
+unsigned body_sort_interval = 100;
+double body_sort_disorder = 2.0;
+unsigned long long n_body_sorts = 0;
+double tree_rebuild_overlap = 1.5;
+unsigned long long body_generation = 0;
+unsigned long long n_tree_builds = 0;
+unsigned long long n_tree_refits = 0;
+bool reproducible_forces = false;
+bool mixed_precision_forces = false;
+softening_t softening = NO_SOFTENING;
+double softening_length = 1.0;
 
-extern vector<Object> objects;
+extern SlotMap<Object> objects;
 
-// Physics simulation on objects range [start_index ~ end_index).
-// (Objects with index out of the range don't participate in physics simulation.)
-void physics(unsigned start_index, unsigned end_index) {
-    vector<Vector3d> acceleration = vector<Vector3d>(end_index, Vector3d::Zero());
-    vector<Vector3d> pos = vector<Vector3d>(end_index);
-    vector<Vector3d> pos_last = vector<Vector3d>(end_index);
-    vector<Vector3d> temp_pos = vector<Vector3d>(end_index);      // For temporarily storing the result of collision calculation,
-    vector<Vector3d> temp_pos_last = vector<Vector3d>(end_index); // a.k.a. new states to be updated after collision
-    // preparing data
-    for (unsigned i = start_index; i < end_index; ++i) {
-        pos[i] = Vector3d(objects[i].translateX, 
-                          objects[i].translateY, 
-                          objects[i].translateZ);
-        pos_last[i] = Vector3d(objects[i].translateX_last, 
-                               objects[i].translateY_last, 
-                               objects[i].translateZ_last);
-        temp_pos[i] = pos[i];            // Used as the default update value if there is no collision.
-        temp_pos_last[i] = pos_last[i];  // Both pos and pos_last are updated after collision in this implementation
-                                         // in order to preserve the total energy (kinetic + potential energy)
+const char* integratorName(integrator_t integrator) {
+    switch (integrator) {
+    case VERLET:
+        return "position Verlet";
+    case WISDOM_HOLMAN:
+        return "Wisdom-Holman";
+    case HERMITE4:
+        return "4th order Hermite";
+    case YOSHIDA4:
+        return "4th order Yoshida";
+    case YOSHIDA6:
+        return "6th order Yoshida";
+    case BLOCK_HERMITE4:
+        return "block step Hermite";
+    case RESPA:
+        return "RESPA";
+    default:
+        return "unknown";
     }
+}
 
-    // physics calculation
-    for (unsigned i = start_index; i < end_index; ++i) {
-        if(objects[i].COLLISION == true) {
-            // If the object is already in a collision, check if it has completed the collision
-            objects[i].COLLISION = false;
-            for (unsigned j = start_index; j < end_index; ++j) {
-                if (j == i) continue;
-                Vector3d distance = pos[j] - pos[i];
-                if (distance.squaredNorm() < square(objects[i].collision_radius + objects[j].collision_radius)) {
-                    objects[i].COLLISION = true;
-                    break;
+const char* integratorKeyword(integrator_t integrator) {
+    switch (integrator) {
+    case VERLET:
+        return "verlet";
+    case WISDOM_HOLMAN:
+        return "wisdom_holman";
+    case HERMITE4:
+        return "hermite4";
+    case YOSHIDA4:
+        return "yoshida4";
+    case YOSHIDA6:
+        return "yoshida6";
+    case BLOCK_HERMITE4:
+        return "block_hermite4";
+    case RESPA:
+        return "respa";
+    default:
+        return "";
+    }
+}
+
+bool integratorFromKeyword(const string& keyword, integrator_t& integrator) {
+    for (unsigned i = 0; i < N_INTEGRATORS; ++i) {
+        if (keyword == integratorKeyword(integrator_t(i))) {
+            integrator = integrator_t(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* gravitySolverName(gravity_solver_t solver) {
+    switch (solver) {
+    case DIRECT_SUM:
+        return "direct sum";
+    case PARTICLE_MESH:
+        return "particle mesh";
+    case BARNES_HUT:
+        return "Barnes-Hut tree";
+    case TREE_PM:
+        return "TreePM";
+    case FAST_MULTIPOLE:
+        return "fast multipole";
+    default:
+        return "unknown";
+    }
+}
+
+const char* gravitySolverKeyword(gravity_solver_t solver) {
+    switch (solver) {
+    case DIRECT_SUM:
+        return "direct";
+    case PARTICLE_MESH:
+        return "pm";
+    case BARNES_HUT:
+        return "tree";
+    case TREE_PM:
+        return "treepm";
+    case FAST_MULTIPOLE:
+        return "fmm";
+    default:
+        return "";
+    }
+}
+
+bool gravitySolverFromKeyword(const string& keyword, gravity_solver_t& solver) {
+    for (unsigned i = 0; i < N_GRAVITY_SOLVERS; ++i) {
+        if (keyword == gravitySolverKeyword(gravity_solver_t(i))) {
+            solver = gravity_solver_t(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* softeningName(softening_t softening) {
+    switch (softening) {
+    case NO_SOFTENING:
+        return "none";
+    case PLUMMER_SOFTENING:
+        return "Plummer";
+    case SPLINE_SOFTENING:
+        return "cubic spline";
+    default:
+        return "unknown";
+    }
+}
+
+const char* softeningKeyword(softening_t softening) {
+    switch (softening) {
+    case NO_SOFTENING:
+        return "none";
+    case PLUMMER_SOFTENING:
+        return "plummer";
+    case SPLINE_SOFTENING:
+        return "spline";
+    default:
+        return "";
+    }
+}
+
+const char* collisionModeName(collision_mode_t mode) {
+    switch (mode) {
+    case ELASTIC_COLLISIONS:
+        return "elastic";
+    case MERGING_COLLISIONS:
+        return "merging";
+    default:
+        return "unknown";
+    }
+}
+
+const char* collisionModeKeyword(collision_mode_t mode) {
+    switch (mode) {
+    case ELASTIC_COLLISIONS:
+        return "elastic";
+    case MERGING_COLLISIONS:
+        return "merge";
+    default:
+        return "";
+    }
+}
+
+bool collisionModeFromKeyword(const string& keyword, collision_mode_t& mode) {
+    for (unsigned i = 0; i < N_COLLISION_MODES; ++i) {
+        if (keyword == collisionModeKeyword(collision_mode_t(i))) {
+            mode = collision_mode_t(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* massAssignmentName(mass_assignment_t assignment) {
+    switch (assignment) {
+    case CIC:
+        return "CIC";
+    case TSC:
+        return "TSC";
+    default:
+        return "unknown";
+    }
+}
+
+const char* massAssignmentKeyword(mass_assignment_t assignment) {
+    switch (assignment) {
+    case CIC:
+        return "cic";
+    case TSC:
+        return "tsc";
+    default:
+        return "";
+    }
+}
+
+bool massAssignmentFromKeyword(const string& keyword, mass_assignment_t& assignment) {
+    for (unsigned i = 0; i < N_MASS_ASSIGNMENTS; ++i) {
+        if (keyword == massAssignmentKeyword(mass_assignment_t(i))) {
+            assignment = mass_assignment_t(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool softeningFromKeyword(const string& keyword, softening_t& softening) {
+    for (unsigned i = 0; i < N_SOFTENINGS; ++i) {
+        if (keyword == softeningKeyword(softening_t(i))) {
+            softening = softening_t(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void gravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+             vector<Vector3d>& acceleration) {
+    switch (gravity_solver) {
+    case PARTICLE_MESH:
+        particleMeshGravity(pos, mass, n_active, acceleration);
+        break;
+    case BARNES_HUT:
+        barnesHutGravity(pos, mass, n_active, acceleration);
+        break;
+    case TREE_PM:
+        treePMGravity(pos, mass, n_active, acceleration);
+        break;
+    case FAST_MULTIPOLE:
+        fastMultipoleGravity(pos, mass, n_active, acceleration);
+        break;
+    default:
+        directGravity(pos, mass, n_active, acceleration);
+        break;
+    }
+}
+
+// The direct sum, as a force kernel for runForceKernel(); with COLLISIONS it also finds the first body overlapping
+// each body (as the collision broad phase does), which costs one more comparison per pair
+template<bool COLLISIONS> struct DirectSum {
+    const vector<Vector3d>& pos;
+    const vector<double>& mass;
+    unsigned n_active;
+    vector<Vector3d>& acceleration;
+    const vector<double>* radius;      // with COLLISIONS
+    vector<unsigned>* first_overlap;   // with COLLISIONS: the lowest index of a body overlapping each body, or n
+
+    template<class Softening, class Precision> void run(const Softening& softening) const {
+        if (Precision::mixed) tiled(softening);
+        else paired(softening);
+        n_force_evaluations += pos.size();
+    }
+
+    // Each pair is evaluated once and acts on both bodies. The rows i of the pair triangle are dealt out in turn
+    // to a number of parts, each with its own partial accelerations, which are added up pairwise at the end.
+    // With one part per thread the result depends on the number of threads; with REPRODUCIBLE_PARTS it does not.
+    template<class Softening> void paired(const Softening& softening) const {
+        unsigned n = pos.size();
+        bool parallel = (unsigned long long)n_active * n >= DIRECT_PARALLEL_MIN_PAIRS;
+        unsigned n_parts = reproducible_forces ? REPRODUCIBLE_PARTS : parallel ? parallelThreads() : 1;
+        vector<vector<Vector3d> > partial(n_parts);
+        vector<vector<unsigned> > partial_first(COLLISIONS ? n_parts : 0);
+        parallelFor(n_parts, parallel ? 1 : n_parts, [&](unsigned begin, unsigned end) {
+            for (unsigned part = begin; part < end; ++part) {
+                vector<Vector3d>& acc = partial[part];
+                acc.assign(n, Vector3d::Zero());
+                if (COLLISIONS) partial_first[part].assign(n, n);
+                for (unsigned i = part; i < (COLLISIONS ? n : n_active); i += n_parts) {
+                    if (i >= n_active) {
+                        // passive bodies only pair with active ones for the gravity, but collide with each other
+                        for (unsigned j = i + 1; j < n; ++j) {
+                            if ((pos[j] - pos[i]).squaredNorm() >= square((*radius)[i] + (*radius)[j])) continue;
+                            partial_first[part][i] = std::min(partial_first[part][i], j);
+                            partial_first[part][j] = std::min(partial_first[part][j], i);
+                        }
+                        continue;
+                    }
+                    Vector3d acc_i = Vector3d::Zero();
+                    for (unsigned j = i + 1; j < n; ++j) {
+                        Vector3d distance = pos[j] - pos[i];
+                        double r2 = distance.squaredNorm();
+                        if (COLLISIONS && r2 < square((*radius)[i] + (*radius)[j])) {
+                            partial_first[part][i] = std::min(partial_first[part][i], j);
+                            partial_first[part][j] = std::min(partial_first[part][j], i);
+                        }
+                        if (r2 == 0.0) continue;   // coincident bodies: no defined direction
+                        double G_r3 = G_para * softening.factor(r2);
+                        if (j < n_active) acc_i += distance * (G_r3 * mass[j]);
+                        acc[j] -= distance * (G_r3 * mass[i]);
+                    }
+                    acc[i] += acc_i;
+                }
+            }
+        });
+        // pairwise: parts 2k + 1 into 2k, then 4k + 2 into 4k, and so on
+        parallelFor(n, PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+            for (unsigned stride = 1; stride < n_parts; stride *= 2) {
+                for (unsigned part = 0; part + stride < n_parts; part += 2 * stride) {
+                    for (unsigned k = begin; k < end; ++k) partial[part][k] += partial[part + stride][k];
+                }
+            }
+            for (unsigned k = begin; k < end; ++k) acceleration[k] = partial[0][k];
+            for (unsigned part = 0; COLLISIONS && part < n_parts; ++part) {
+                for (unsigned k = begin; k < end; ++k) {
+                    (*first_overlap)[k] = std::min(part == 0 ? n : (*first_overlap)[k], partial_first[part][k]);
+                }
+            }
+        });
+    }
+
+    // Mixed precision: every body against tiles of FORCE_TILE_SIZE consecutive bodies (close in space in Morton
+    // order) about the centers of their bounding boxes, the tiles summed in double in a fixed order. Each pair is
+    // evaluated twice, but on float packets. The tiles hold the active bodies, or with COLLISIONS all bodies,
+    // the passive ones without mass.
+    template<class Softening> void tiled(const Softening& softening) const {
+        unsigned n = pos.size(), n_sources = COLLISIONS ? n : n_active;
+        vector<double> source_mass(mass.begin(), mass.begin() + n_sources);
+        std::fill(source_mass.begin() + n_active, source_mass.end(), 0.0);
+        SourceTiles<FORCE_TILE_SIZE> tiles;
+        vector<unsigned> bodies(n_sources);
+        for (unsigned j = 0; j < n_sources; ++j) bodies[j] = j;
+        for (unsigned begin = 0; begin < n_sources; begin += FORCE_TILE_SIZE) {
+            unsigned end = std::min(n_sources, begin + FORCE_TILE_SIZE);
+            Vector3d low = pos[begin], high = pos[begin];
+            for (unsigned j = begin + 1; j < end; ++j) {
+                low = low.cwiseMin(pos[j]);
+                high = high.cwiseMax(pos[j]);
+            }
+            tiles.add(pos, source_mass, G_para, &bodies[begin], end - begin, (low + high) / 2, COLLISIONS ? radius : NULL);
+        }
+        parallelFor(n, PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+            for (unsigned i = begin; i < end; ++i) {
+                Vector3d acc = Vector3d::Zero();
+                unsigned first = n;
+                for (unsigned t = 0; t < tiles.size(); ++t) {
+                    acc += tiles.template acceleration<Softening, COLLISIONS>(t, pos[i], softening, i,
+                                                                             COLLISIONS ? (*radius)[i] : 0.0, &first);
                 }
+                acceleration[i] = acc;
+                if (COLLISIONS) (*first_overlap)[i] = first;
+            }
+        });
+    }
+};
+
+void directGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                   vector<Vector3d>& acceleration, const vector<double>* radius, vector<unsigned>* first_overlap) {
+    if (radius != NULL && first_overlap != NULL) {
+        first_overlap->resize(pos.size());
+        DirectSum<true> sum = { pos, mass, n_active, acceleration, radius, first_overlap };
+        runForceKernel(sum, softening, softening_length, mixed_precision_forces);
+    } else {
+        DirectSum<false> sum = { pos, mass, n_active, acceleration, NULL, NULL };
+        runForceKernel(sum, softening, softening_length, mixed_precision_forces);
+    }
+}
+
+void updateTree(Octree& tree, const vector<Vector3d>& pos, const vector<double>& mass, unsigned n,
+                unsigned leaf_size, const vector<double>* radius) {
+    if (tree.generation == body_generation && tree.bodies.size() == n && !tree.nodes.empty()) {
+        tree.refit(pos, mass, radius);
+        if (!(tree.overlap() > tree_rebuild_overlap * tree.built_overlap)) {
+            ++n_tree_refits;
+            return;
+        }
+    }
+    tree.build(pos, mass, n, leaf_size, radius);
+    tree.generation = body_generation;
+    ++n_tree_builds;
+}
+
+// Squared shortest of the free-fall time sqrt(r^3 / (G (m_i + m_j))) and the crossing time r / |v_i - v_j| of
+// bodies i and j; touching bodies count at contact distance
+static double pairTimescale2(const vector<Vector3d>& pos, const vector<Vector3d>& vel, const vector<double>& mass,
+                             const vector<double>& radius, unsigned i, unsigned j) {
+    double r = std::max((pos[j] - pos[i]).norm(), radius[i] + radius[j]);
+    double free_fall2 = r * r * r / (G_para * (mass[i] + mass[j]));
+    double crossing2 = r * r / (vel[j] - vel[i]).squaredNorm();
+    return std::min(free_fall2, crossing2);
+}
+
+// Shortest dynamical time of the system: the shortest pairTimescale2() of every pair with an active body.
+// Above TIMESCALE_INDEX_MIN_BODIES every body searches an octree over the active bodies, skipping the nodes whose
+// bodies cannot beat the shortest time found so far: none is closer than the distance d to the node's sphere,
+// heavier than its mass M or faster relative to the body than its spread of velocities about their mean allows,
+// so sqrt(d^3 / (G (m_i + M))) and d / (|v_i - mean| + spread) bound their times from below. The result is
+// the same as that of every pair, at the cost of a tree walk per body.
+static double shortestTimescale(const vector<Vector3d>& pos, const vector<Vector3d>& vel, const vector<double>& mass,
+                                const vector<double>& radius, unsigned n_active) {
+    unsigned n = pos.size();
+    if (n <= TIMESCALE_INDEX_MIN_BODIES || n_active == 0) {
+        double shortest = HUGE_VAL;
+        for (unsigned i = 0; i < n; ++i) {
+            for (unsigned j = 0; j < n_active && j < i; ++j) {
+                shortest = std::min(shortest, pairTimescale2(pos, vel, mass, radius, i, j));
+            }
+        }
+        return std::sqrt(shortest);
+    }
+
+    static Octree tree;
+    tree.build(pos, mass, n_active);
+    // mean velocity of the bodies of each node and their largest distance from it, bottom-up (children come
+    // after their parents)
+    unsigned n_nodes = tree.nodes.size();
+    vector<Vector3d> mean_vel(n_nodes);
+    vector<double> spread(n_nodes);
+    for (unsigned a = n_nodes; a-- > 0; ) {
+        const OctreeNode& node = tree.nodes[a];
+        Vector3d sum = Vector3d::Zero();
+        double largest = 0.0;
+        if (node.n_children == 0) {
+            for (unsigned b = node.body_begin; b < node.body_end; ++b) sum += vel[tree.bodies[b]];
+            mean_vel[a] = sum / (node.body_end - node.body_begin);
+            for (unsigned b = node.body_begin; b < node.body_end; ++b) {
+                largest = std::max(largest, (vel[tree.bodies[b]] - mean_vel[a]).norm());
             }
         } else {
-            // If the object is not in a collision, check for new collisions
-            for (unsigned j = start_index; j < end_index; ++j) {
-                if (j == i) continue;
-                Vector3d distance = pos[j] - pos[i];
-                if (distance.squaredNorm() < square(objects[i].collision_radius + objects[j].collision_radius)) {
-                    objects[i].COLLISION = true;
-                    distance.normalize();
-                    double vi = (pos[i] - pos_last[i]).dot(distance);
-                    double vj = (pos[j] - pos_last[j]).dot(distance);
-                    double vi_n = (vi * (objects[i].mass - objects[j].mass) + vj * (2 * objects[j].mass)) 
-                                  / (objects[i].mass + objects[j].mass);
-                    // calculate collision change of state
-                    temp_pos[i] = pos_last[i];
-                    temp_pos_last[i] = pos_last[i] + distance * (vi - vi_n)
-                                       + (pos_last[i] - pos[i]); 
-                    break;
+            for (unsigned c = node.first_child; c < node.first_child + node.n_children; ++c) {
+                sum += mean_vel[c] * double(tree.nodes[c].body_end - tree.nodes[c].body_begin);
+            }
+            mean_vel[a] = sum / (node.body_end - node.body_begin);
+            for (unsigned c = node.first_child; c < node.first_child + node.n_children; ++c) {
+                largest = std::max(largest, (mean_vel[c] - mean_vel[a]).norm() + spread[c]);
+            }
+        }
+        spread[a] = largest;
+    }
+
+    // the bodies walk the tree in Morton order (the active ones, then the passive ones), so each starts from the
+    // shortest time its thread found for bodies close by; the shortest of the threads is that of the system
+    vector<double> shortest(n, HUGE_VAL);
+    parallelFor(n, PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+        double best = HUGE_VAL;
+        unsigned stack[8 * (OCTREE_MAX_DEPTH + 1)];
+        for (unsigned k = begin; k < end; ++k) {
+            unsigned i = k < n_active ? tree.bodies[k] : k;
+            unsigned top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                unsigned a = stack[--top];
+                const OctreeNode& node = tree.nodes[a];
+                double d = std::max((node.center_of_mass - pos[i]).norm() - node.radius, 0.0);
+                double free_fall2 = d * d * d / (G_para * (mass[i] + node.mass));
+                double crossing2 = d * d / square((vel[i] - mean_vel[a]).norm() + spread[a]);
+                if (!(std::min(free_fall2, crossing2) < best)) continue;
+                if (node.n_children > 0) {
+                    for (unsigned c = 0; c < node.n_children; ++c) stack[top++] = node.first_child + c;
+                } else {
+                    for (unsigned b = node.body_begin; b < node.body_end; ++b) {
+                        unsigned j = tree.bodies[b];
+                        if (j != i) best = std::min(best, pairTimescale2(pos, vel, mass, radius, i, j));
+                    }
                 }
             }
+            shortest[k] = best;
+        }
+    });
+    return std::sqrt(*std::min_element(shortest.begin(), shortest.end()));
+}
+
+// Mean distance between objects next to each other in objects[start_index ~ end_index)
+static double storageGap(unsigned start_index, unsigned end_index) {
+    double sum = 0.0;
+    for (unsigned i = start_index + 1; i < end_index; ++i) {
+        sum += Vector3d(objects[i].translateX - objects[i - 1].translateX, objects[i].translateY - objects[i - 1].translateY,
+                        objects[i].translateZ - objects[i - 1].translateZ).norm();
+    }
+    return end_index > start_index + 1 ? sum / (end_index - start_index - 1) : 0.0;
+}
+
+bool sortBodies(unsigned start_index, unsigned end_index) {
+    static unsigned steps_since_sort = 0;
+    static double sorted_gap = 0.0;   // storageGap() right after the last re-sort
+    if (body_sort_interval == 0 || end_index < start_index + 2) return false;
+    if (++steps_since_sort < body_sort_interval
+        && !(storageGap(start_index, end_index) > body_sort_disorder * sorted_gap)) return false;
+
+    unsigned n = end_index - start_index;
+    vector<Vector3d> pos(n);
+    for (unsigned k = 0; k < n; ++k) {
+        const Object& object = objects[start_index + k];
+        pos[k] = Vector3d(object.translateX, object.translateY, object.translateZ);
+    }
+    vector<unsigned> order;
+    mortonOrder(pos, n, order);
+    objects.reorder(start_index, order);
+
+    steps_since_sort = 0;
+    sorted_gap = storageGap(start_index, end_index);
+    ++n_body_sorts;
+    return true;
+}
+
+unsigned advance(unsigned start_index, unsigned end_index, double duration) {
+    double time = 0.0;
+    unsigned steps = 0;
+    while (time < duration * (1 - 1E-9)) {
+        sortBodies(start_index, end_index);
+        unsigned long long merged = n_merged_bodies;
+        time += physics(start_index, end_index, duration - time);
+        end_index -= unsigned(n_merged_bodies - merged);
+        ++steps;
+    }
+    return steps;
+}
+
+double sweptImpact(const Vector3d& last_i, const Vector3d& now_i, double radius_i,
+                   const Vector3d& last_j, const Vector3d& now_j, double radius_j, bool merging) {
+    Vector3d start = last_j - last_i;
+    Vector3d motion = (now_j - last_j) - (now_i - last_i);
+    double a = motion.squaredNorm(), b = start.dot(motion), c = start.squaredNorm() - square(radius_i + radius_j);
+    if (c <= 0) return merging || b < 0 ? 0.0 : HUGE_VAL;   // in contact already at the start
+    if (b >= 0) return HUGE_VAL;          // not approaching (touching bodies only part from here on)
+    double discriminant = b * b - a * c;
+    if (discriminant < 0) return HUGE_VAL;
+    double t = c / (-b + std::sqrt(discriminant));   // the smaller root of a t^2 + 2 b t + c
+    return t <= 1 ? t : HUGE_VAL;
+}
+
+double physics(unsigned start_index, unsigned end_index, double max_step) {
+    // Merging: bodies that touched in the last step become one before anything else, and no collision is left
+    bool elastic = collision_mode == ELASTIC_COLLISIONS;
+    if (!elastic) end_index -= mergeCollisions(start_index, end_index);
+
+    // Classify bodies: passive bodies (test particles) feel gravity but exert none
+    double total_mass = 0.0;
+    for (unsigned i = start_index; i < end_index; ++i) {
+        total_mass += objects[i].mass;
+    }
+    vector<unsigned> index;      // Bodies in simulation order: active bodies first, then passive bodies
+    unsigned n_active = 0;
+    index.reserve(end_index - start_index);
+    for (unsigned pass = 0; pass < 2; ++pass) {
+        for (unsigned i = start_index; i < end_index; ++i) {
+            bool passive = objects[i].gravity_source == PASSIVE_SOURCE
+                           || (objects[i].gravity_source == AUTO_SOURCE && objects[i].mass < passive_mass_ratio * total_mass);
+            if (passive == (pass == 1)) index.push_back(i);
+        }
+        if (pass == 0) n_active = index.size();
+    }
+    unsigned n = index.size();
+
+    // the trees kept between steps are only refitted while the bodies (and their order) stay the same
+    static vector<unsigned> last_ids;
+    vector<unsigned> ids(n);
+    for (unsigned k = 0; k < n; ++k) ids[k] = objects[index[k]].id;
+    if (ids != last_ids) {
+        ++body_generation;
+        last_ids.swap(ids);
+    }
+
+    vector<Vector3d> acceleration = vector<Vector3d>(n);
+    vector<Vector3d> pos = vector<Vector3d>(n);
+    vector<Vector3d> pos_last = vector<Vector3d>(n);
+    vector<Vector3d> temp_pos = vector<Vector3d>(n);      // For temporarily storing the result of collision calculation,
+    vector<Vector3d> temp_pos_last = vector<Vector3d>(n); // a.k.a. new states to be updated after collision
+    vector<double> mass = vector<double>(n);
+    vector<double> radius = vector<double>(n);
+    // preparing data
+    for (unsigned k = 0; k < n; ++k) {
+        const Object& object = objects[index[k]];
+        pos[k] = Vector3d(object.translateX, object.translateY, object.translateZ);
+        pos_last[k] = Vector3d(object.translateX_last, object.translateY_last, object.translateZ_last);
+        temp_pos[k] = pos[k];            // Used as the default update value if there is no collision.
+        temp_pos_last[k] = pos_last[k];  // Both pos and pos_last are updated after collision in this implementation
+                                         // in order to preserve the total energy (kinetic + potential energy)
+        mass[k] = object.mass;
+        radius[k] = object.collision_radius;
+    }
+
+    // collision calculation, continuous: every body's sphere sweeps the straight path from its last position to
+    // its current one, and a body hits the body whose swept sphere it touches first while they approach.
+    // The broad phase finds the bodies whose swept bounds (the sphere at the current position grown by the
+    // distance travelled) overlap, from the spatial index once there are enough bodies. A position Verlet step
+    // with the direct sum needs the gravity at these positions anyway, so there the direct sum finds the first
+    // of them in the same pass, and only the bodies it finds one for search further. (Merged bodies touch nothing.)
+    // Not after a step that regularized binaries, though: they are usually still there, and then the step needs
+    // no gravity at these positions.
+    vector<double> swept_radius(n);
+    for (unsigned k = 0; k < n; ++k) swept_radius[k] = radius[k] + (pos[k] - pos_last[k]).norm();
+    integrator_step_t step = integratorStep(integrator);
+    bool fused = step == NULL && gravity_solver == DIRECT_SUM && last_step_verlet;
+    vector<unsigned> first_overlap;
+    if (fused && elastic) directGravity(pos, mass, n_active, acceleration, &swept_radius, &first_overlap);
+    else if (fused) directGravity(pos, mass, n_active, acceleration);
+    unsigned searching = elastic ? n : 0;   // bodies that search further
+    if (fused && elastic) searching = n - std::count(first_overlap.begin(), first_overlap.end(), n);
+    bool indexed = n > COLLISION_INDEX_MIN_BODIES && searching > COLLISION_SCAN_MAX_BODIES;
+    static Octree tree;
+    if (indexed) updateTree(tree, pos, mass, n, OCTREE_LEAF_SIZE, &swept_radius);
+    // time of impact of bodies i and j as a fraction of the last step (see sweptImpact())
+    auto impact = [&](unsigned i, unsigned j) -> double {
+        return sweptImpact(pos_last[i], pos[i], radius[i], pos_last[j], pos[j], radius[j]);
+    };
+    // call test(j) for every body j whose swept bounds may overlap those of body i
+    auto candidates = [&](unsigned i, const std::function<void(unsigned)>& test) {
+        if (fused && first_overlap[i] == n) return;
+        if (indexed) {
+            tree.overlapping(pos[i], swept_radius[i], test);
+        } else {
+            for (unsigned j = 0; j < n; ++j) test(j);
+        }
+    };
+    // the body i hits first in the last step (the lowest index of those at the same time), or n, and when
+    auto firstImpact = [&](unsigned i, double& time) -> unsigned {
+        unsigned first = n;
+        time = HUGE_VAL;
+        candidates(i, [&](unsigned j) {
+            if (j == i) return;
+            double t = impact(i, j);
+            if (t < time || (t == time && t <= 1 && j < first)) {
+                time = t;
+                first = j;
+            }
+        });
+        return first;
+    };
+    if (elastic) parallelFor(n, PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; ++i) {
+            bool& collision = objects[index[i]].COLLISION;
+            if (collision == true) {
+                // If the object is already in a collision, check if it has completed the collision
+                auto overlap = [&](unsigned j) {
+                    if (j != i && (pos[j] - pos[i]).squaredNorm() < square(radius[i] + radius[j])) collision = true;
+                };
+                collision = false;
+                if (fused && first_overlap[i] < n) overlap(first_overlap[i]);   // usually still the one
+                if (!collision) candidates(i, overlap);
+                continue;
+            }
+            double t;
+            unsigned j = firstImpact(i, t);
+            if (j < n) {
+                // If the object is not in a collision, check for new collisions
+                collision = true;
+                Vector3d motion_i = pos[i] - pos_last[i], motion_j = pos[j] - pos_last[j];
+                Vector3d contact_i = pos_last[i] + motion_i * t, contact_j = pos_last[j] + motion_j * t;
+                Vector3d distance = (contact_j - contact_i).normalized();
+                double vi = motion_i.dot(distance);
+                double vj = motion_j.dot(distance);
+                double vi_n = (vi * (mass[i] - mass[j]) + vj * (2 * mass[j])) 
+                              / (mass[i] + mass[j]);
+                // calculate collision change of state: the new motion from the contact for the rest of the step
+                Vector3d bounced = motion_i + distance * (vi_n - vi);
+                temp_pos[i] = contact_i + bounced * (1 - t);
+                temp_pos_last[i] = temp_pos[i] - bounced;
+            }
         }
+    });
+
+    // the acceleration at the positions after the collisions (the fused pass computed it before them)
+    bool accelerated = fused && temp_pos == pos;
+    auto accelerate = [&]() {
+        if (!accelerated) gravity(temp_pos, mass, n_active, acceleration);
+        accelerated = true;
+    };
+
+    // Velocity-based integrators work on (position, velocity). They store pos_last = pos - vel dt, which reads
+    // back as it is; after a position Verlet step (pos - pos_last) / dt is the velocity half a step back, which
+    // the acceleration at pos moves to the current position. So they can take over from the Verlet state at any
+    // step, and the Verlet step below takes over from them.
+    double dt_last = dt;   // the step the stored state belongs to
+    bool from_verlet = last_step_verlet;
+    vector<Vector3d> vel = vector<Vector3d>(n);
+    for (unsigned k = 0; k < n; ++k) {
+        vel[k] = (temp_pos[k] - temp_pos_last[k]) / dt_last;
+    }
+    if (from_verlet) {
+        accelerate();
+        for (unsigned k = 0; k < n; ++k) vel[k] += acceleration[k] * (dt_last / 2);
+    }
+
+    // tightly bound, isolated pairs (binaries) move as their centers of mass in the step, while their relative
+    // motion is integrated in KS coordinates, so their orbits do not set the step
+    vector<BinaryPair> binaries;
+    ReducedSystem reduced;
+    if (ks_regularization) {
+        vector<bool> excluded(n);
+        for (unsigned k = 0; k < n; ++k) excluded[k] = objects[index[k]].COLLISION;
+        findBinaries(temp_pos, vel, mass, radius, n_active, excluded, last_ids, binaries);
+        if (!binaries.empty()) reduceBinaries(temp_pos, vel, mass, radius, n_active, binaries, reduced);
+    }
 
-        // calculate the acceleration of object i
-        for (unsigned j = start_index; j < end_index; ++j) {
-            if (j == i) continue;
-            Vector3d distance = pos[j] - pos[i];
-            acceleration[i] += distance.normalized() * (G_para * objects[j].mass / distance.squaredNorm());
+    // choose the step: a fraction of the shortest dynamical time, within bounds;
+    // it shrinks at once but grows smoothly (block steps subdivide the largest step for each body themselves)
+    if (adaptive_dt) {
+        double target = integrator == BLOCK_HERMITE4 ? dt_max
+                        : binaries.empty() ? dt_accuracy * shortestTimescale(temp_pos, vel, mass, radius, n_active)
+                        : dt_accuracy * shortestTimescale(reduced.pos, reduced.vel, reduced.mass, reduced.radius,
+                                                          reduced.n_active);
+        if (!(target >= dt_min)) target = dt_min;   // also catches NaN
+        if (target > dt_max) target = dt_max;
+        if (target > dt_adaptive) target = dt_adaptive + (target - dt_adaptive) * (1 - dt_smoothing);
+        dt_adaptive = target;
+        dt = std::min(target, max_step);
+    }
+
+    auto storeVelocityState = [&]() {
+        for (unsigned k = 0; k < n; ++k) {
+            Vector3d next_pos_last = temp_pos[k] - vel[k] * dt;
+            Object& object = objects[index[k]];
+            object.translateX_last = next_pos_last.x();
+            object.translateY_last = next_pos_last.y();
+            object.translateZ_last = next_pos_last.z();
+            object.translateX = temp_pos[k].x();
+            object.translateY = temp_pos[k].y();
+            object.translateZ = temp_pos[k].z();
+        }
+        last_step_verlet = false;
+    };
+    if (!binaries.empty()) {
+        regularizedStep(temp_pos, vel, mass, binaries, reduced, step, dt);
+        storeVelocityState();
+        return dt;
+    }
+    if (step != NULL) {
+        if (step(temp_pos, vel, mass, n_active, dt)) {
+            storeVelocityState();
+            return dt;
         }
+        // otherwise (e.g. a close encounter for Wisdom-Holman) integrate this step directly
     }
+
+    // calculate the acceleration of every object from the active objects, where the collisions have left them
+    last_step_verlet = true;
+    accelerate();
     
     // calculate the next positions for each object
-    for(unsigned i = start_index; i < end_index; ++i) {
-        pos[i] = temp_pos[i];
-        pos_last[i] = temp_pos_last[i];
+    for(unsigned k = 0; k < n; ++k) {
+        pos[k] = temp_pos[k];
+        pos_last[k] = temp_pos_last[k];
+        if (!from_verlet || dt != dt_last) {
+            // the last position of a Verlet step of the new size through pos with the velocity at pos
+            pos_last[k] = pos[k] - vel[k] * dt + acceleration[k] * (dt * dt / 2);
+        }
 
         Vector3d next_pos;
-        next_pos = pos[i] * 2 - pos_last[i] + acceleration[i] * (dt * dt); // Verlet Algorithm
+        next_pos = pos[k] * 2 - pos_last[k] + acceleration[k] * (dt * dt); // Verlet Algorithm
 
         // write result
-        objects[i].translateX_last = pos[i].x();
-        objects[i].translateY_last = pos[i].y();
-        objects[i].translateZ_last = pos[i].z();
-        objects[i].translateX = next_pos.x();
-        objects[i].translateY = next_pos.y();
-        objects[i].translateZ = next_pos.z();
-    }
-}
\ No newline at end of file
+        Object& object = objects[index[k]];
+        object.translateX_last = pos[k].x();
+        object.translateY_last = pos[k].y();
+        object.translateZ_last = pos[k].z();
+        object.translateX = next_pos.x();
+        object.translateY = next_pos.y();
+        object.translateZ = next_pos.z();
+    }
+    return dt;
+}
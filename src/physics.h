@@ -0,0 +1,229 @@
+#pragma once
+
+#include "common_header.h"
+#include "object_class.h"
+#include "octree.h"
+#include "force_kernels.h"
+
+// Time integration schemes
+enum integrator_t {
+    VERLET,            // position Verlet on the whole system
+    WISDOM_HOLMAN,     // Wisdom-Holman map for systems dominated by one central body
+    HERMITE4,          // 4th order Hermite predictor-corrector (uses the jerk)
+    YOSHIDA4,          // 4th order symplectic Yoshida composition of leapfrog steps
+    YOSHIDA6,          // 6th order symplectic Yoshida composition of leapfrog steps
+    BLOCK_HERMITE4,    // 4th order Hermite with hierarchical power of two steps per body
+    RESPA,             // leapfrog with the far part of the gravity applied only every few steps
+    N_INTEGRATORS
+};
+
+// Solvers for the gravity of all bodies (used by gravity())
+enum opening_criterion_t {
+    OPENING_ANGLE,     // Barnes-Hut: node size / distance below the opening angle
+    OPENING_BMAX,      // Salmon-Warren: largest distance of a body from the center of mass / distance below the angle
+    OPENING_RELATIVE   // estimated error of the node's force below a fraction of the body's acceleration
+};
+
+enum gravity_solver_t {
+    DIRECT_SUM,        // exact sum over all pairs
+    PARTICLE_MESH,     // mass on a grid, potential by FFT; fast for very many bodies but blurs close interactions
+    BARNES_HUT,        // octree walk; distant groups of bodies act as point masses
+    TREE_PM,           // long range from the particle mesh, short range from a tree walk cut off after a few cells
+    FAST_MULTIPOLE,    // expansions of node pairs in the tree (FMM); O(n), accuracy set by the expansion order
+    N_GRAVITY_SOLVERS
+};
+
+// What happens when two bodies touch
+enum collision_mode_t {
+    ELASTIC_COLLISIONS, // they bounce off each other, keeping their kinetic energy
+    MERGING_COLLISIONS, // they merge into one body with their total mass, momentum and volume (accretion)
+    N_COLLISION_MODES
+};
+
+// Mass assignment schemes of the particle-mesh solver
+enum mass_assignment_t {
+    CIC,               // cloud in cell (2x2x2 nodes)
+    TSC,               // triangular shaped cloud (3x3x3 nodes)
+    N_MASS_ASSIGNMENTS
+};
+
+extern integrator_t integrator;    // Integrator used by physics()
+extern gravity_solver_t gravity_solver;  // Solver used by gravity()
+extern double G_para;              // Gravity parameter
+extern double dt;                  // Time step (of the last step when adaptive; the stored last positions belong to it)
+extern double passive_mass_ratio;  // Bodies lighter than this fraction of the total mass are passive (test particles)
+extern bool adaptive_dt;           // Choose each step from the shortest free-fall / crossing time of the system
+extern double dt_min, dt_max;      // Bounds of the adaptive step
+extern double dt_accuracy;         // Adaptive step as a fraction of the shortest free-fall / crossing time
+extern double dt_smoothing;        // How slowly the adaptive step grows (0: at once, towards 1: slower); it shrinks at once
+extern double dt_adaptive;         // Adaptive step before it is shortened to fit the time left in advance()
+extern unsigned respa_far_interval; // RESPA: steps per evaluation of the far part of the gravity
+extern double respa_split_radius;  // RESPA: distance beyond which gravity belongs entirely to the far part
+extern unsigned pm_grid_size;      // Particle mesh: grid nodes per side (a power of two)
+extern mass_assignment_t pm_assignment;  // Particle mesh: mass assignment (and interpolation) scheme
+extern bool pm_periodic;           // Particle mesh: periodic box instead of isolated (zero-padded) boundaries
+extern double pm_box_size;         // Particle mesh: side of the periodic box, centered at the origin
+extern double tree_opening_angle;  // Tree: largest node size / distance at which a node acts through its moments
+extern opening_criterion_t tree_opening_criterion;  // Tree: when a node is opened
+extern double tree_force_accuracy; // Tree: largest error of one node's force / acceleration (relative criterion)
+extern unsigned tree_multipole_order;  // Tree: 1 monopole, 2 quadrupole, 3 octupole
+extern double treepm_split_cells;  // TreePM: scale r_s of the Gaussian force split, in mesh cells
+extern double treepm_cutoff;       // TreePM: distance (in r_s) beyond which the tree walk ignores the short-range force
+extern unsigned fmm_order;         // FMM: order of the multipole and local expansions (1 ~ 8)
+extern double fmm_opening_angle;   // FMM: largest (radius of node A + radius of node B) / distance for an expansion
+extern unsigned body_sort_interval; // Steps between re-sorts of the bodies into Morton order (0: never)
+extern double body_sort_disorder;  // Re-sort sooner once the mean distance between bodies next to each other
+                                   // in objects has grown by this factor since the last re-sort
+extern unsigned long long n_body_sorts;  // Number of re-sorts of the bodies
+extern double tree_rebuild_overlap; // Rebuild a refitted tree once the overlap of its nodes has grown by this factor
+extern unsigned long long body_generation;  // Changes whenever the set or order of the simulated bodies changes
+extern unsigned long long n_tree_builds;    // Number of full builds of the trees kept between steps
+extern unsigned long long n_tree_refits;    // Number of refits of the trees kept between steps
+extern bool reproducible_forces;   // Direct sum: the same bits on any number of threads, at a small cost
+extern bool mixed_precision_forces; // Direct sum and tree leaves: pairs in float about double tile origins (force_kernels.h)
+extern softening_t softening;      // Force law of the direct sum, the tree walks, the FMM pairs and the jerk
+extern double softening_length;    // Softening length eps (Plummer; spline: the same central potential)
+extern collision_mode_t collision_mode;  // What physics() does with bodies that touch
+extern unsigned long long n_merged_bodies;  // Number of bodies merged into others (and removed from objects)
+extern bool ks_regularization;     // Integrate the relative motion of tightly bound, isolated pairs in KS coordinates
+extern double ks_perturbation;     // KS: largest tidal acceleration on a pair, relative to its own, for it to be regularized
+extern unsigned long long n_force_evaluations;  // Number of bodies whose gravity has been computed (one per body per pass)
+extern bool last_step_verlet;      // Whether the last physics() step was a position Verlet step (also after a fallback)
+
+// Physics simulation on objects range [start_index ~ end_index) over one step; returns the step taken.
+// (Objects with index out of the range don't participate in physics simulation.)
+// With adaptive_dt the step is chosen from the current state, at most max_step.
+// With MERGING_COLLISIONS, bodies merged away are removed from the range first (see mergeCollisions());
+// the objects after it move down by the growth of n_merged_bodies.
+double physics(unsigned start_index, unsigned end_index, double max_step = HUGE_VAL);
+
+// Advance the simulation by the given time, in as many (adaptive) steps as needed; returns the number of steps.
+// Before every step the bodies may be re-sorted (see sortBodies()).
+unsigned advance(unsigned start_index, unsigned end_index, double duration);
+
+// Time at which two spheres moving along straight lines over a step (from last to now) first touch, as a
+// fraction of the step, or HUGE_VAL if they do not. Unless merging, only contacts while approaching count.
+double sweptImpact(const Vector3d& last_i, const Vector3d& now_i, double radius_i,
+                   const Vector3d& last_j, const Vector3d& now_j, double radius_j, bool merging = false);
+
+// Merge every group of bodies of objects[start_index ~ end_index) that touched in the last step (a sweep from
+// the last position to the current one) into its most massive body, with the total mass, momentum and volume
+// at the center of mass; the density is the total mass over the total volume (the original one if they had
+// the same). The merged bodies are removed in one pass that keeps the order of the others;
+// returns their number.
+unsigned mergeCollisions(unsigned start_index, unsigned end_index);
+
+// Counts a step and, every body_sort_interval steps or when they have become too disordered, re-sorts
+// objects[start_index ~ end_index) into Morton order, so bodies close in space are close in memory for the
+// tree walks and the collision pass. Returns whether the objects were permuted (indices into objects change,
+// their ids and handles do not).
+bool sortBodies(unsigned start_index, unsigned end_index);
+
+// Bring a tree kept between steps up to date with the first n bodies: refit it in place if it was built
+// over the same bodies (body_generation) and its overlap has not grown by tree_rebuild_overlap since, else rebuild it
+void updateTree(Octree& tree, const vector<Vector3d>& pos, const vector<double>& mass, unsigned n,
+                unsigned leaf_size = OCTREE_LEAF_SIZE, const vector<double>* radius = NULL);
+
+// Gravitational acceleration of every body from the active bodies (gravity sources), by the current solver.
+// The first n_active entries of pos/mass are the active bodies; passive bodies follow them.
+void gravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+             vector<Vector3d>& acceleration);
+// The same by direct summation over all pairs (in parallel; bitwise reproducible with reproducible_forces,
+// like the other solvers, which sum each body's acceleration on one thread in a fixed order).
+// With radius and first_overlap it also finds the collision broad phase's first overlapping body of each body
+// (the lowest index, or pos.size() if none) in the same pass.
+void directGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                   vector<Vector3d>& acceleration, const vector<double>* radius = NULL,
+                   vector<unsigned>* first_overlap = NULL);
+// The same by the particle-mesh method; returns the grid cell size.
+// With split_cells > 0 only the long-range part is computed: the Gaussian-filtered force with
+// split scale r_s = split_cells * cell size (what remains is the short-range part erfc(r / 2 r_s)).
+double particleMeshGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                           vector<Vector3d>& acceleration, double split_cells = 0.0);
+// The same by a Barnes-Hut tree walk
+void barnesHutGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                      vector<Vector3d>& acceleration);
+// The same by TreePM: the particle mesh for the long-range part, a truncated tree walk for the short-range part
+void treePMGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                   vector<Vector3d>& acceleration);
+// The same by the fast multipole method
+void fastMultipoleGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                          vector<Vector3d>& acceleration);
+
+// Acceleration and its time derivative (jerk) of every body, summed over the active bodies
+void gravityJerk(const vector<Vector3d>& pos, const vector<Vector3d>& vel, const vector<double>& mass,
+                 unsigned n_active, vector<Vector3d>& acceleration, vector<Vector3d>& jerk);
+
+// Name of a gravity solver for display, and the short name used in scene files
+const char* gravitySolverName(gravity_solver_t solver);
+const char* gravitySolverKeyword(gravity_solver_t solver);
+bool gravitySolverFromKeyword(const string& keyword, gravity_solver_t& solver);
+
+// Name of a collision mode for display, and the short name used in scene files
+const char* collisionModeName(collision_mode_t mode);
+const char* collisionModeKeyword(collision_mode_t mode);
+bool collisionModeFromKeyword(const string& keyword, collision_mode_t& mode);
+
+// Name of a particle mesh mass assignment for display, and the short name used in scene files
+const char* massAssignmentName(mass_assignment_t assignment);
+const char* massAssignmentKeyword(mass_assignment_t assignment);
+bool massAssignmentFromKeyword(const string& keyword, mass_assignment_t& assignment);
+
+// Name of a softening for display, and the short name used in scene files
+const char* softeningName(softening_t softening);
+const char* softeningKeyword(softening_t softening);
+bool softeningFromKeyword(const string& keyword, softening_t& softening);
+
+// Name of an integrator for display, and the short name used in scene files
+const char* integratorName(integrator_t integrator);
+const char* integratorKeyword(integrator_t integrator);
+// Look up an integrator by its scene file keyword; returns false if there is none
+bool integratorFromKeyword(const string& keyword, integrator_t& integrator);
+
+// A velocity-based integrator: advances positions/velocities (active bodies first) by one step of size h.
+// Returns false, leaving the state untouched, if it cannot handle the current configuration;
+// physics() then takes a position Verlet step instead.
+typedef bool (*integrator_step_t)(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                                  unsigned n_active, double h);
+// The step function of an integrator (NULL for position Verlet, which works on the (pos, pos_last) state)
+integrator_step_t integratorStep(integrator_t integrator);
+
+// One Wisdom-Holman step; fails if there is no dominant central body or during close encounters.
+bool wisdomHolmanStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                      unsigned n_active, double h);
+// One block of hierarchical Hermite steps; every body subdivides h as its own dynamical time needs.
+bool blockHermiteStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                      unsigned n_active, double h);
+// One inner RESPA step with the near part of the gravity; the far part kicks every respa_far_interval steps.
+bool respaStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+               unsigned n_active, double h);
+
+// A tightly bound pair of active bodies (indices in simulation order) whose relative motion is integrated in
+// Kustaanheimo-Stiefel (KS) coordinates, and the tidal field of the other bodies at its center of mass
+// (the acceleration on j minus the one on i is about tidal (pos[j] - pos[i]))
+struct BinaryPair {
+    unsigned i, j;
+    Eigen::Matrix3d tidal;
+};
+// The bodies of a step with binaries, every binary replaced by its center of mass (active bodies first):
+// origin[k] is the body of entry k, or n + p for the center of mass of binaries[p]
+struct ReducedSystem {
+    vector<Vector3d> pos, vel;
+    vector<double> mass, radius;   // a center of mass has the radius of the sphere holding the pair
+    unsigned n_active;
+    vector<unsigned> origin;
+};
+// Find the binaries to regularize (with ks_regularization, without softening): pairs of active bodies that pull
+// hardest on each other, are bound, stay clear of contact, have no other body within KS_ISOLATION apocenters
+// and feel tidal accelerations below ks_perturbation of their mutual one. Bodies marked excluded (in a
+// collision) are left out; pairs (by object id) regularized in the last step are kept with looser limits.
+void findBinaries(const vector<Vector3d>& pos, const vector<Vector3d>& vel, const vector<double>& mass,
+                  const vector<double>& radius, unsigned n_active, const vector<bool>& excluded,
+                  const vector<unsigned>& ids, vector<BinaryPair>& binaries);
+void reduceBinaries(const vector<Vector3d>& pos, const vector<Vector3d>& vel, const vector<double>& mass,
+                    const vector<double>& radius, unsigned n_active, const vector<BinaryPair>& binaries,
+                    ReducedSystem& reduced);
+// Advance pos/vel by h with the binaries regularized: the reduced system by step (a leapfrog step if that is
+// NULL or fails), the relative motion of every binary in KS coordinates in its tidal field (held constant)
+void regularizedStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                     const vector<BinaryPair>& binaries, ReducedSystem& reduced, integrator_step_t step, double h);
@@ -0,0 +1,312 @@
+#include "physics.h"
+#include "parallel.h"
+#include <algorithm>
+
+#define KS_ISOLATION        4.0    // no other body may be closer to a binary than this many times its apocenter
+#define KS_HYSTERESIS       2.0    // a binary regularized in the last step keeps it up to this factor over the limits
+#define KS_MAX_ACTIVE       4096   // active bodies above which no binaries are searched for (the tidal field of
+                                   // each isolated pair is summed over all bodies)
+#define KS_INDEX_MIN_BODIES 64     // bodies above which the partners and the isolation are searched in an octree
+#define KS_STEPS_PER_ORBIT  128    // Runge-Kutta steps per orbit of the relative motion in fictitious time
+#define KS_TIME_ITERATIONS  4      // steps that close in on the end of the physical time step
+#define PARALLEL_MIN_BODIES 256    // bodies per thread below which the search for binaries runs on one thread
+
+bool ks_regularization = false;
+double ks_perturbation = 0.05;
+
+using Eigen::Vector4d;
+using Eigen::Matrix4d;
+using Eigen::Matrix3d;
+
+// The KS matrix L(u): x = L(u) u, with the fourth component 0 (Stiefel & Scheifele 1971)
+static Matrix4d ksMatrix(const Vector4d& u) {
+    Matrix4d L;
+    L << u[0], -u[1], -u[2],  u[3],
+         u[1],  u[0], -u[3], -u[2],
+         u[2],  u[3],  u[0],  u[1],
+         u[3], -u[2],  u[1], -u[0];
+    return L;
+}
+
+// State of the relative motion in KS coordinates: u, its derivative w = du/ds in the fictitious time s
+// (dt = r ds), the energy per unit reduced mass and the physical time
+struct KSState {
+    Vector4d u, w;
+    double energy, time;
+};
+
+// d/ds of the state: u'' = energy / 2 u + r / 2 L(u)^T P, energy' = 2 w . L(u)^T P, t' = r = |u|^2,
+// with the perturbing acceleration P = T x of the relative motion x in the tidal field T
+static KSState ksDerivative(const KSState& state, const Matrix3d& tidal) {
+    Matrix4d L = ksMatrix(state.u);
+    Vector4d perturbation = Vector4d::Zero();
+    perturbation.head<3>() = tidal * (L * state.u).head<3>();
+    Vector4d force = L.transpose() * perturbation;
+    double r = state.u.squaredNorm();
+    KSState derivative;
+    derivative.u = state.w;
+    derivative.w = state.energy / 2 * state.u + r / 2 * force;
+    derivative.energy = 2 * state.w.dot(force);
+    derivative.time = r;
+    return derivative;
+}
+
+static KSState ksAdd(const KSState& state, const KSState& derivative, double ds) {
+    KSState result;
+    result.u = state.u + derivative.u * ds;
+    result.w = state.w + derivative.w * ds;
+    result.energy = state.energy + derivative.energy * ds;
+    result.time = state.time + derivative.time * ds;
+    return result;
+}
+
+// One classical Runge-Kutta step in fictitious time
+static KSState ksStep(const KSState& state, const Matrix3d& tidal, double ds) {
+    KSState k1 = ksDerivative(state, tidal);
+    KSState k2 = ksDerivative(ksAdd(state, k1, ds / 2), tidal);
+    KSState k3 = ksDerivative(ksAdd(state, k2, ds / 2), tidal);
+    KSState k4 = ksDerivative(ksAdd(state, k3, ds), tidal);
+    KSState result = state;
+    result.u += (k1.u + 2 * k2.u + 2 * k3.u + k4.u) * (ds / 6);
+    result.w += (k1.w + 2 * k2.w + 2 * k3.w + k4.w) * (ds / 6);
+    result.energy += (k1.energy + 2 * k2.energy + 2 * k3.energy + k4.energy) * (ds / 6);
+    result.time += (k1.time + 2 * k2.time + 2 * k3.time + k4.time) * (ds / 6);
+    return result;
+}
+
+// Advance the relative position x and velocity v of a pair (gravitational parameter mu) by time h in a
+// constant tidal field, in KS coordinates: the Kepler problem becomes a harmonic oscillator
+// in u with the frequency sqrt(-energy / 2), which has no singularity at r = 0, so the steps are a fixed
+// fraction of an orbit however eccentric it is.
+static void keplerKS(Vector3d& x, Vector3d& v, double mu, const Matrix3d& tidal, double h) {
+    KSState state;
+    double r = x.norm();
+    if (x.x() >= 0) {
+        state.u[0] = std::sqrt((r + x.x()) / 2);
+        state.u[1] = x.y() / (2 * state.u[0]);
+        state.u[2] = x.z() / (2 * state.u[0]);
+        state.u[3] = 0.0;
+    } else {
+        state.u[1] = std::sqrt((r - x.x()) / 2);
+        state.u[0] = x.y() / (2 * state.u[1]);
+        state.u[2] = 0.0;
+        state.u[3] = x.z() / (2 * state.u[1]);
+    }
+    state.w = ksMatrix(state.u).transpose() * Vector4d(v.x(), v.y(), v.z(), 0.0) / 2;
+    state.energy = v.squaredNorm() / 2 - mu / r;
+    state.time = 0.0;
+
+    // x goes around once while u turns by pi
+    auto stepSize = [&](const KSState& s) {
+        double scale = s.energy < 0 ? std::sqrt(-2 / s.energy) : 2 * std::sqrt(s.u.squaredNorm() / mu);
+        return PI / KS_STEPS_PER_ORBIT * scale;
+    };
+    for (;;) {
+        KSState next = ksStep(state, tidal, stepSize(state));
+        if (next.time >= h) break;
+        state = next;
+    }
+    for (unsigned iteration = 0; iteration < KS_TIME_ITERATIONS; ++iteration) {
+        double left = h - state.time;
+        if (std::fabs(left) <= 1E-14 * h) break;
+        state = ksStep(state, tidal, left / state.u.squaredNorm());
+    }
+
+    Matrix4d L = ksMatrix(state.u);
+    r = state.u.squaredNorm();
+    x = (L * state.u).head<3>();
+    v = (L * state.w).head<3>() * (2 / r);
+}
+
+// Pairs regularized in the last step, by object id
+static vector<pair<unsigned, unsigned> > last_binaries;
+
+void findBinaries(const vector<Vector3d>& pos, const vector<Vector3d>& vel, const vector<double>& mass,
+                  const vector<double>& radius, unsigned n_active, const vector<bool>& excluded,
+                  const vector<unsigned>& ids, vector<BinaryPair>& binaries) {
+    binaries.clear();
+    vector<pair<unsigned, unsigned> > found;
+    if (!ks_regularization || softening != NO_SOFTENING || n_active < 2 || n_active > KS_MAX_ACTIVE) {
+        last_binaries.clear();
+        return;
+    }
+    unsigned n = pos.size();
+
+    // the active body pulling hardest on each active body (the lowest index of the equally strong ones); above
+    // KS_INDEX_MIN_BODIES it is searched in an octree, skipping the nodes where even the heaviest active body,
+    // at the distance of the node, would pull weaker than the strongest pull found so far
+    bool indexed = n > KS_INDEX_MIN_BODIES;
+    static Octree tree;
+    vector<double> heaviest;   // of the active bodies of each node, bottom-up (children come after their parents)
+    if (indexed) {
+        updateTree(tree, pos, mass, n, OCTREE_LEAF_SIZE);
+        heaviest.assign(tree.nodes.size(), 0.0);
+        for (unsigned a = tree.nodes.size(); a-- > 0; ) {
+            const OctreeNode& node = tree.nodes[a];
+            for (unsigned c = node.first_child; c < node.first_child + node.n_children; ++c) {
+                heaviest[a] = std::max(heaviest[a], heaviest[c]);
+            }
+            if (node.n_children > 0) continue;
+            for (unsigned b = node.body_begin; b < node.body_end; ++b) {
+                if (tree.bodies[b] < n_active) heaviest[a] = std::max(heaviest[a], mass[tree.bodies[b]]);
+            }
+        }
+    }
+    vector<unsigned> partner(n_active);
+    parallelFor(n_active, PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+        unsigned stack[8 * (OCTREE_MAX_DEPTH + 1)];
+        for (unsigned i = begin; i < end; ++i) {
+            double strongest = 0.0;
+            partner[i] = i;
+            auto test = [&](unsigned j) {
+                if (j == i || j >= n_active) return;
+                double pull = mass[j] / (pos[j] - pos[i]).squaredNorm();
+                if (pull > strongest || (pull == strongest && j < partner[i])) {
+                    strongest = pull;
+                    partner[i] = j;
+                }
+            };
+            if (!indexed) {
+                for (unsigned j = 0; j < n_active; ++j) test(j);
+                continue;
+            }
+            unsigned top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                unsigned a = stack[--top];
+                const OctreeNode& node = tree.nodes[a];
+                // distance to the node: to its sphere or its cube, whichever is farther
+                Vector3d outside = ((pos[i] - node.center).cwiseAbs().array() - node.half_size).max(0.0).matrix();
+                double d = std::max((node.center_of_mass - pos[i]).norm() - node.radius, outside.norm());
+                if (heaviest[a] < strongest * d * d) continue;
+                if (node.n_children > 0) {
+                    // the nearest child on top, so a strong pull is found early and prunes the rest
+                    unsigned first = top;
+                    for (unsigned c = node.first_child; c < node.first_child + node.n_children; ++c) {
+                        double c2 = (tree.nodes[c].center_of_mass - pos[i]).squaredNorm();
+                        unsigned k = top++;
+                        while (k > first && (tree.nodes[stack[k - 1]].center_of_mass - pos[i]).squaredNorm() < c2) {
+                            stack[k] = stack[k - 1];
+                            --k;
+                        }
+                        stack[k] = c;
+                    }
+                } else {
+                    for (unsigned b = node.body_begin; b < node.body_end; ++b) test(tree.bodies[b]);
+                }
+            }
+        }
+    });
+
+    for (unsigned i = 0; i < n_active; ++i) {
+        unsigned j = partner[i];
+        if (j <= i || partner[j] != i || excluded[i] || excluded[j]) continue;
+        double mu = G_para * (mass[i] + mass[j]);
+        Vector3d x = pos[j] - pos[i], v = vel[j] - vel[i];
+        double r = x.norm();
+        double energy = v.squaredNorm() / 2 - mu / r;
+        if (!(energy < 0)) continue;
+        // the orbit must stay clear of contact, which the KS steps would pass through
+        double L2 = x.cross(v).squaredNorm();
+        double e = std::sqrt(std::max(0.0, 1 + 2 * energy * L2 / (mu * mu)));
+        double pericenter = L2 / (mu * (1 + e)), apocenter = -mu / energy - pericenter;
+        if (pericenter <= radius[i] + radius[j]) continue;
+
+        pair<unsigned, unsigned> id(ids[i], ids[j]);
+        double slack = std::find(last_binaries.begin(), last_binaries.end(), id) != last_binaries.end()
+                       ? KS_HYSTERESIS : 1.0;
+        Vector3d center = (mass[i] * pos[i] + mass[j] * pos[j]) / (mass[i] + mass[j]);
+        double isolation = KS_ISOLATION / slack * apocenter;
+        bool isolated = true;
+        auto test = [&](unsigned k) {
+            if (k != i && k != j && (pos[k] - center).squaredNorm() <= isolation * isolation) isolated = false;
+        };
+        if (indexed) {
+            tree.overlapping(center, isolation, test);
+        } else {
+            for (unsigned k = 0; k < n; ++k) test(k);
+        }
+        if (!isolated) continue;
+        // the tidal field of the other bodies at the center of mass: their acceleration at center + x is
+        // about their acceleration at the center plus T x
+        Matrix3d tidal = Matrix3d::Zero();
+        for (unsigned k = 0; k < n_active; ++k) {
+            if (k == i || k == j) continue;
+            Vector3d d = pos[k] - center;
+            double d2 = d.squaredNorm();
+            double Gm_d3 = G_para * mass[k] / (d2 * std::sqrt(d2));
+            tidal += Gm_d3 * (3 * d * d.transpose() / d2 - Matrix3d::Identity());
+        }
+        if ((tidal * x).norm() * r * r > ks_perturbation * slack * mu) continue;
+
+        BinaryPair binary = { i, j, tidal };
+        binaries.push_back(binary);
+        found.push_back(id);
+    }
+    last_binaries.swap(found);
+}
+
+void reduceBinaries(const vector<Vector3d>& pos, const vector<Vector3d>& vel, const vector<double>& mass,
+                    const vector<double>& radius, unsigned n_active, const vector<BinaryPair>& binaries,
+                    ReducedSystem& reduced) {
+    unsigned n = pos.size();
+    vector<bool> paired(n, false);
+    for (const BinaryPair& binary : binaries) paired[binary.i] = paired[binary.j] = true;
+    reduced.pos.clear();
+    reduced.vel.clear();
+    reduced.mass.clear();
+    reduced.radius.clear();
+    reduced.origin.clear();
+    auto add = [&](const Vector3d& p, const Vector3d& v, double m, double r, unsigned origin) {
+        reduced.pos.push_back(p);
+        reduced.vel.push_back(v);
+        reduced.mass.push_back(m);
+        reduced.radius.push_back(r);
+        reduced.origin.push_back(origin);
+    };
+    for (unsigned k = 0; k < n_active; ++k) {
+        if (!paired[k]) add(pos[k], vel[k], mass[k], radius[k], k);
+    }
+    for (unsigned p = 0; p < binaries.size(); ++p) {
+        unsigned i = binaries[p].i, j = binaries[p].j;
+        double m = mass[i] + mass[j];
+        Vector3d center = (mass[i] * pos[i] + mass[j] * pos[j]) / m;
+        double extent = std::max((pos[i] - center).norm() + radius[i], (pos[j] - center).norm() + radius[j]);
+        add(center, (mass[i] * vel[i] + mass[j] * vel[j]) / m, m, extent, n + p);
+    }
+    reduced.n_active = reduced.pos.size();
+    for (unsigned k = n_active; k < n; ++k) add(pos[k], vel[k], mass[k], radius[k], k);
+}
+
+void regularizedStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                     const vector<BinaryPair>& binaries, ReducedSystem& reduced, integrator_step_t step, double h) {
+    unsigned n = pos.size();
+    if (step == NULL || !step(reduced.pos, reduced.vel, reduced.mass, reduced.n_active, h)) {
+        // drift-kick-drift leapfrog, the velocity form of position Verlet
+        vector<Vector3d> acceleration(reduced.pos.size());
+        for (unsigned k = 0; k < reduced.pos.size(); ++k) reduced.pos[k] += reduced.vel[k] * (h / 2);
+        gravity(reduced.pos, reduced.mass, reduced.n_active, acceleration);
+        for (unsigned k = 0; k < reduced.pos.size(); ++k) {
+            reduced.vel[k] += acceleration[k] * h;
+            reduced.pos[k] += reduced.vel[k] * (h / 2);
+        }
+    }
+
+    for (unsigned k = 0; k < reduced.pos.size(); ++k) {
+        unsigned origin = reduced.origin[k];
+        if (origin < n) {
+            pos[origin] = reduced.pos[k];
+            vel[origin] = reduced.vel[k];
+            continue;
+        }
+        const BinaryPair& binary = binaries[origin - n];
+        unsigned i = binary.i, j = binary.j;
+        Vector3d x = pos[j] - pos[i], v = vel[j] - vel[i];
+        keplerKS(x, v, G_para * (mass[i] + mass[j]), binary.tidal, h);
+        double share_i = mass[j] / (mass[i] + mass[j]), share_j = mass[i] / (mass[i] + mass[j]);
+        pos[i] = reduced.pos[k] - x * share_i;
+        vel[i] = reduced.vel[k] - v * share_i;
+        pos[j] = reduced.pos[k] + x * share_j;
+        vel[j] = reduced.vel[k] + v * share_j;
+    }
+}
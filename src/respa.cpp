@@ -0,0 +1,138 @@
+#include "physics.h"
+#include "parallel.h"
+#include <algorithm>
+
+#define RESPA_SWITCH_START   0.7   // the force moves from near to far between this fraction of the split radius and the split radius
+#define PARALLEL_MIN_BODIES  32    // bodies per thread below which forces are computed on one thread
+
+unsigned respa_far_interval = 4;
+double respa_split_radius = 20.0;
+
+// Smooth switch from 0 (near) to 1 (far) with continuous derivative
+static double farFraction(double r) {
+    double r_in = RESPA_SWITCH_START * respa_split_radius;
+    if (r <= r_in) return 0.0;
+    if (r >= respa_split_radius) return 1.0;
+    double x = (r - r_in) / (respa_split_radius - r_in);
+    return x * x * (3 - 2 * x);
+}
+
+// Key of the grid cell (of size respa_split_radius) containing a position
+static unsigned long long cellKey(long long cx, long long cy, long long cz) {
+    const unsigned long long mask = (1ull << 21) - 1;
+    return (cx & mask) << 42 | (cy & mask) << 21 | (cz & mask);
+}
+
+static long long cellCoordinate(double x) {
+    return (long long)std::floor(x / respa_split_radius);
+}
+
+// Near (short range) part of the gravity, summed over the active bodies in the neighboring grid cells
+static void nearGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                        vector<Vector3d>& acceleration) {
+    // cell list of the gravity sources: (cell key, body) sorted by key
+    vector<pair<unsigned long long, unsigned> > cells(n_active);
+    for (unsigned j = 0; j < n_active; ++j) {
+        cells[j] = std::make_pair(cellKey(cellCoordinate(pos[j].x()), cellCoordinate(pos[j].y()),
+                                          cellCoordinate(pos[j].z())), j);
+    }
+    std::sort(cells.begin(), cells.end());
+
+    double r_split2 = square(respa_split_radius);
+    parallelFor(pos.size(), PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; ++i) {
+            Vector3d acc = Vector3d::Zero();
+            long long cx = cellCoordinate(pos[i].x()), cy = cellCoordinate(pos[i].y()), cz = cellCoordinate(pos[i].z());
+            for (int dx = -1; dx <= 1; ++dx) for (int dy = -1; dy <= 1; ++dy) for (int dz = -1; dz <= 1; ++dz) {
+                unsigned long long key = cellKey(cx + dx, cy + dy, cz + dz);
+                auto it = std::lower_bound(cells.begin(), cells.end(), std::make_pair(key, 0u));
+                for (; it != cells.end() && it->first == key; ++it) {
+                    unsigned j = it->second;
+                    if (j == i) continue;
+                    Vector3d distance = pos[j] - pos[i];
+                    double r2 = distance.squaredNorm();
+                    if (r2 == 0.0 || r2 >= r_split2) continue;
+                    double r = std::sqrt(r2);
+                    acc += distance * (G_para * mass[j] / (r2 * r) * (1 - farFraction(r)));
+                }
+            }
+            acceleration[i] = acc;
+        }
+    });
+    n_force_evaluations += pos.size();
+}
+
+// Far (long range) part of the gravity, summed over all active bodies
+static void farGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                       vector<Vector3d>& acceleration) {
+    double r_in2 = square(RESPA_SWITCH_START * respa_split_radius);
+    parallelFor(pos.size(), PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; ++i) {
+            Vector3d acc = Vector3d::Zero();
+            for (unsigned j = 0; j < n_active; ++j) {
+                Vector3d distance = pos[j] - pos[i];
+                double r2 = distance.squaredNorm();
+                if (j == i || r2 <= r_in2) continue;
+                double r = std::sqrt(r2);
+                acc += distance * (G_para * mass[j] / (r2 * r) * farFraction(r));
+            }
+            acceleration[i] = acc;
+        }
+    });
+    n_force_evaluations += pos.size();
+}
+
+// The state between steps: an outer (far) step spans respa_far_interval inner steps, so the far force
+// and the near force at the end of a step are kept for the next step if the bodies have not been changed
+static vector<Vector3d> respa_pos;        // positions at the end of the last step
+static vector<double> respa_mass;
+static vector<Vector3d> respa_far, respa_near;
+static unsigned respa_inner_steps = 0;    // inner steps taken in the current outer step
+static double respa_elapsed = 0.0;        // time of the current outer step so far
+static double respa_opening_kick = 0.0;   // duration the far force was applied for at the start of the outer step
+
+// One inner step of reversible RESPA (Tuckerman, Berne & Martyna 1992): the far force kicks for half an outer
+// step at the start and the end of every outer step; in between, the near force is integrated with
+// kick-drift-kick leapfrog steps. If the bodies were changed between steps (collisions, new objects),
+// the current outer step is closed with the far force at the new positions and a new one starts.
+bool respaStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+               unsigned n_active, double h) {
+    unsigned n = pos.size();
+    bool unchanged = respa_pos == pos && respa_mass == mass;
+
+    if (!unchanged) {
+        respa_far.resize(n);
+        respa_near.resize(n);
+        farGravity(pos, mass, n_active, respa_far);
+        nearGravity(pos, mass, n_active, respa_near);
+        if (respa_inner_steps > 0 && respa_pos.size() == n) {
+            for (unsigned k = 0; k < n; ++k) vel[k] += respa_far[k] * (respa_elapsed - respa_opening_kick);
+        }
+        respa_inner_steps = 0;
+    }
+    if (respa_inner_steps == 0) {
+        respa_elapsed = 0.0;
+        respa_opening_kick = respa_far_interval * h / 2;
+        for (unsigned k = 0; k < n; ++k) vel[k] += respa_far[k] * respa_opening_kick;
+    }
+
+    // inner leapfrog step with the near force
+    for (unsigned k = 0; k < n; ++k) {
+        vel[k] += respa_near[k] * (h / 2);
+        pos[k] += vel[k] * h;
+    }
+    nearGravity(pos, mass, n_active, respa_near);
+    for (unsigned k = 0; k < n; ++k) vel[k] += respa_near[k] * (h / 2);
+    respa_elapsed += h;
+
+    // closing far kick
+    if (++respa_inner_steps >= respa_far_interval) {
+        farGravity(pos, mass, n_active, respa_far);
+        for (unsigned k = 0; k < n; ++k) vel[k] += respa_far[k] * (respa_elapsed - respa_opening_kick);
+        respa_inner_steps = 0;
+    }
+
+    respa_pos = pos;
+    respa_mass = mass;
+    return true;
+}
@@ -5,18 +5,34 @@
 const GLchar* vertex_shader = 
 R"GLSL(
             #version 150 core
-                    in vec3 position_m;
-                    in vec3 normal_m;
-                    in vec2 texCoords;
+                    in vec3 position_q;   // quantized position, normalized to the mesh bounding box
+                    in vec2 normal_oct;   // octahedral-encoded normal
+                    in vec2 texCoords_q;  // quantized texture coords
                     out vec3 position_w;
                     out vec3 normal_w;
                     out vec2 texCoords_;
                     uniform vec3 TR, RO, barycenter;
                     uniform float SC;
                     uniform mat4 M_view, M_projection;
+                    uniform vec3 bounds_min, bounds_extent;
+                    uniform vec2 tex_min, tex_extent;
+
+                    vec3 decodeOctahedral(vec2 e)
+                    {
+                        vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+                        if (n.z < 0.0) {
+                            n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+                        }
+                        return normalize(n);
+                    }
 
                     void main()
                     {
+                        // Dequantize vertex attributes
+                        vec3 position_m = bounds_min + position_q * bounds_extent;
+                        vec3 normal_m = decodeOctahedral(normal_oct);
+                        vec2 texCoords = tex_min + texCoords_q * tex_extent;
+
                         mat4 M_TR = mat4(1.0, 0.0, 0.0, 0.0,   // NOTE to self: This is the first COLUMN, not row!!!
                                          0.0, 1.0, 0.0, 0.0,
                                          0.0, 0.0, 1.0, 0.0,
@@ -62,18 +78,34 @@ R"GLSL(
 const GLchar* vertex_shader_HUD = 
 R"GLSL(
             #version 150 core
-                    in vec3 position_m;
-                    in vec3 normal_m;
-                    in vec2 texCoords;
+                    in vec3 position_q;   // quantized position, normalized to the mesh bounding box
+                    in vec2 normal_oct;   // octahedral-encoded normal
+                    in vec2 texCoords_q;  // quantized texture coords
                     out vec3 position_w;
                     out vec3 normal_w;
                     out vec2 texCoords_;
                     uniform vec3 TR, RO, barycenter;
                     uniform float SC;
                     uniform mat4 M_view, M_projection;
+                    uniform vec3 bounds_min, bounds_extent;
+                    uniform vec2 tex_min, tex_extent;
+
+                    vec3 decodeOctahedral(vec2 e)
+                    {
+                        vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+                        if (n.z < 0.0) {
+                            n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+                        }
+                        return normalize(n);
+                    }
 
                     void main()
                     {
+                        // Dequantize vertex attributes
+                        vec3 position_m = bounds_min + position_q * bounds_extent;
+                        vec3 normal_m = decodeOctahedral(normal_oct);
+                        vec2 texCoords = tex_min + texCoords_q * tex_extent;
+
                         mat4 M_TR = mat4(1.0, 0.0, 0.0, 0.0,   // NOTE to self: This is the first COLUMN, not row!!!
                                          0.0, 1.0, 0.0, 0.0,
                                          0.0, 0.0, 1.0, 0.0,
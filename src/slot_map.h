@@ -0,0 +1,152 @@
+#pragma once
+
+#include "common_header.h"
+
+// Reference to an element of a SlotMap that stays valid however the elements move in storage,
+// and becomes invalid for good once the element is erased. A default handle refers to nothing.
+struct SlotHandle {
+    unsigned slot;
+    unsigned generation;
+
+    SlotHandle() : slot(~0u), generation(0) {}
+    SlotHandle(unsigned slot, unsigned generation) : slot(slot), generation(generation) {}
+    bool operator==(const SlotHandle& other) const { return slot == other.slot && generation == other.generation; }
+    bool operator!=(const SlotHandle& other) const { return !(*this == other); }
+};
+
+// Elements packed in a vector (in no particular order, so iteration is by index over contiguous memory), plus
+// a table of slots that maps handles to their current indices. Inserting appends and erasing moves the last
+// element into the hole, both O(1), and only the slots of the elements moved are updated. Each slot counts
+// generations: erasing an element bumps its slot's, so a handle to it no longer matches when the slot is reused.
+// Indices change whenever elements move (erase(), eraseMarked(), reorder()); handles do not.
+template<class T> class SlotMap {
+public:
+    typedef typename vector<T>::iterator iterator;
+    typedef typename vector<T>::const_iterator const_iterator;
+
+    unsigned size() const { return dense.size(); }
+    bool empty() const { return dense.empty(); }
+    T& operator[](unsigned index) { return dense[index]; }
+    const T& operator[](unsigned index) const { return dense[index]; }
+    iterator begin() { return dense.begin(); }
+    iterator end() { return dense.end(); }
+    const_iterator begin() const { return dense.begin(); }
+    const_iterator end() const { return dense.end(); }
+
+    void reserve(unsigned n) {
+        dense.reserve(n);
+        owner.reserve(n);
+    }
+
+    // Append an element; returns its handle
+    SlotHandle insert(const T& value) {
+        dense.push_back(value);
+        owner.push_back(newSlot(size() - 1));
+        return handle(size() - 1);
+    }
+    // Append the elements [first, last) with one growth of the storage; returns the index of the first
+    template<class Iterator> unsigned insert(Iterator first, Iterator last) {
+        unsigned begin = size();
+        dense.insert(dense.end(), first, last);
+        owner.reserve(dense.size());
+        for (unsigned index = begin; index < size(); ++index) owner.push_back(newSlot(index));
+        return begin;
+    }
+
+    // Erase the element of the handle (if it is still there); the last element takes its place
+    bool erase(SlotHandle handle) {
+        if (!contains(handle)) return false;
+        unsigned index = slots[handle.slot].index;
+        if (index + 1 != size()) {
+            dense[index] = std::move(dense.back());
+            owner[index] = owner.back();
+            slots[owner[index]].index = index;
+        }
+        dense.pop_back();
+        owner.pop_back();
+        freeSlot(handle.slot);
+        return true;
+    }
+    // Erase, in one pass, the elements of [begin, end) whose removed[index - begin] is set, keeping the order
+    // of the others (and of the elements after end); returns their number
+    unsigned eraseMarked(unsigned begin, unsigned end, const vector<bool>& removed) {
+        unsigned kept = begin;
+        for (unsigned index = begin; index < size(); ++index) {
+            if (index < end && removed[index - begin]) {
+                freeSlot(owner[index]);
+                continue;
+            }
+            if (kept != index) {
+                dense[kept] = std::move(dense[index]);
+                owner[kept] = owner[index];
+                slots[owner[kept]].index = kept;
+            }
+            ++kept;
+        }
+        unsigned count = size() - kept;
+        dense.erase(dense.begin() + kept, dense.end());
+        owner.resize(kept);
+        return count;
+    }
+    // Erase every element
+    void clear() {
+        for (unsigned index = 0; index < size(); ++index) freeSlot(owner[index]);
+        dense.clear();
+        owner.clear();
+    }
+
+    // Permute the elements [begin, begin + order.size()): the one at begin + k becomes the one that was at
+    // begin + order[k]
+    void reorder(unsigned begin, const vector<unsigned>& order) {
+        vector<T> moved;
+        vector<unsigned> moved_owner;
+        moved.reserve(order.size());
+        moved_owner.reserve(order.size());
+        for (unsigned k = 0; k < order.size(); ++k) {
+            moved.push_back(std::move(dense[begin + order[k]]));
+            moved_owner.push_back(owner[begin + order[k]]);
+        }
+        for (unsigned k = 0; k < order.size(); ++k) {
+            dense[begin + k] = std::move(moved[k]);
+            owner[begin + k] = moved_owner[k];
+            slots[owner[begin + k]].index = begin + k;
+        }
+    }
+
+    bool contains(SlotHandle handle) const {
+        return handle.slot < slots.size() && slots[handle.slot].generation == handle.generation;
+    }
+    // The element of the handle, or NULL if it was erased
+    T* get(SlotHandle handle) { return contains(handle) ? &dense[slots[handle.slot].index] : NULL; }
+    const T* get(SlotHandle handle) const { return contains(handle) ? &dense[slots[handle.slot].index] : NULL; }
+    // Index of the element of a valid handle
+    unsigned indexOf(SlotHandle handle) const { return slots[handle.slot].index; }
+    // Handle of the element at index
+    SlotHandle handle(unsigned index) const { return SlotHandle(owner[index], slots[owner[index]].generation); }
+
+private:
+    struct Slot {
+        unsigned index;        // of its element in dense (while it has one)
+        unsigned generation;   // bumped whenever its element is erased
+    };
+    vector<T> dense;
+    vector<unsigned> owner;        // slot of each element of dense
+    vector<Slot> slots;
+    vector<unsigned> free_slots;   // slots without an element, reused last in, first out
+
+    unsigned newSlot(unsigned index) {
+        if (free_slots.empty()) {
+            Slot slot = { index, 0 };
+            slots.push_back(slot);
+            return slots.size() - 1;
+        }
+        unsigned slot = free_slots.back();
+        free_slots.pop_back();
+        slots[slot].index = index;
+        return slot;
+    }
+    void freeSlot(unsigned slot) {
+        ++slots[slot].generation;
+        free_slots.push_back(slot);
+    }
+};
@@ -0,0 +1,251 @@
+#include "physics.h"
+#include "multipole.h"
+#include "parallel.h"
+#include "fft.h"
+#include "force_kernels.h"
+
+#define PARALLEL_MIN_BODIES 64   // bodies per thread below which the tree walk runs on one thread
+#define SPLIT_TABLE_SIZE   1024   // entries of the short-range factor table
+#define SPLIT_TABLE_RANGE  8.0    // the table covers r / 2 r_s in [0, SPLIT_TABLE_RANGE); the factor is ~1E-27 beyond
+#define ESTIMATE_OPENING_ANGLE 1.0   // relative criterion: opening angle of the walk that estimates the accelerations
+#define RELATIVE_GUARD     1.2    // relative criterion: nodes are always opened within this many half sizes of their center
+
+double tree_opening_angle = 0.5;
+opening_criterion_t tree_opening_criterion = OPENING_ANGLE;
+double tree_force_accuracy = 0.0025;
+unsigned tree_multipole_order = 1;
+double treepm_split_cells = 1.25;
+double treepm_cutoff = 4.5;
+
+// Fraction of the Newtonian force that belongs to the short-range part of the Gaussian split with scale r_s,
+// erfc(r / 2 r_s) + r / (r_s sqrt(pi)) exp(-r^2 / 4 r_s^2), interpolated from a table (erfc and exp are slow)
+static inline double shortRangeFactor(double r, double r_s) {
+    static const vector<double> table = [] {
+        vector<double> values(SPLIT_TABLE_SIZE + 1);
+        for (unsigned k = 0; k <= SPLIT_TABLE_SIZE; ++k) {
+            double x = SPLIT_TABLE_RANGE * k / SPLIT_TABLE_SIZE;
+            values[k] = std::erfc(x) + 2 * x / std::sqrt(PI_D) * std::exp(-x * x);
+        }
+        return values;
+    }();
+    double u = r / (2 * r_s) * (SPLIT_TABLE_SIZE / SPLIT_TABLE_RANGE);
+    if (u >= SPLIT_TABLE_SIZE) return 0.0;
+    unsigned k = unsigned(u);
+    double f = u - k;
+    return table[k] * (1 - f) + table[k + 1] * f;
+}
+
+// How a walk opens nodes and what it sums
+struct TreeWalk {
+    opening_criterion_t criterion;
+    double opening_angle;
+    double force_accuracy;            // relative criterion: alpha
+    unsigned order;                   // highest multipole order: 1 monopole, 2 quadrupole, 3 octupole
+    const vector<double>* moments;    // multipoleTerms(order) raw moments sum m d^k per node (order >= 2)
+    const vector<Vector3d>* estimate; // relative criterion: estimated acceleration of each body
+    double r_s, r_cut;                // short-range part only, within r_cut (r_s > 0)
+    const SourceTiles<OCTREE_LEAF_SIZE>* leaf_tiles;  // mixed precision: the bodies of leaf n about its center
+    const vector<unsigned>* first_tile;               // of mass are tiles first_tile[n] ~ first_tile[n + 1]
+};
+
+// Acceleration at offset r = body - center of mass from the quadrupole (and octupole) moments of a node,
+// written out from -grad of the multipole series with the second moments S_ij = sum m d_i d_j
+// and the third moments T_ijk = sum m d_i d_j d_k (in multi-index order, as in multipole.h)
+static Vector3d multipoleAcceleration(const double* raw, unsigned order, const Vector3d& r) {
+    double x = r.x(), y = r.y(), z = r.z();
+    double inverse_r2 = 1.0 / r.squaredNorm();
+    double inverse_r5 = inverse_r2 * inverse_r2 * std::sqrt(inverse_r2), inverse_r7 = inverse_r5 * inverse_r2;
+
+    // quadrupole: 3 S r / r^5 + 3/2 tr(S) r / r^5 - 15/2 (r S r) r / r^7
+    double Sxx = raw[4], Sxy = raw[5], Sxz = raw[6], Syy = raw[7], Syz = raw[8], Szz = raw[9];
+    Vector3d Sr(Sxx * x + Sxy * y + Sxz * z, Sxy * x + Syy * y + Syz * z, Sxz * x + Syz * y + Szz * z);
+    Vector3d acc = (3 * inverse_r5) * Sr + (1.5 * (Sxx + Syy + Szz) * inverse_r5 - 7.5 * r.dot(Sr) * inverse_r7) * r;
+
+    // octupole: -1/6 (105 (T:rrr) r / r^9 - 45 ((t.r) r + T:rr) / r^7 + 9 t / r^5), t_i = T_ikk
+    if (order >= 3) {
+        double Txxx = raw[10], Txxy = raw[11], Txxz = raw[12], Txyy = raw[13], Txyz = raw[14];
+        double Txzz = raw[15], Tyyy = raw[16], Tyyz = raw[17], Tyzz = raw[18], Tzzz = raw[19];
+        Vector3d Trr(Txxx * x * x + Txyy * y * y + Txzz * z * z + 2 * (Txxy * x * y + Txxz * x * z + Txyz * y * z),
+                     Txxy * x * x + Tyyy * y * y + Tyzz * z * z + 2 * (Txyy * x * y + Txyz * x * z + Tyyz * y * z),
+                     Txxz * x * x + Tyyz * y * y + Tzzz * z * z + 2 * (Txyz * x * y + Txzz * x * z + Tyzz * y * z));
+        Vector3d t(Txxx + Txyy + Txzz, Txxy + Tyyy + Tyzz, Txxz + Tyyz + Tzzz);
+        double inverse_r9 = inverse_r7 * inverse_r2;
+        acc -= (105 * r.dot(Trr) * inverse_r9 - 45 * t.dot(r) * inverse_r7) / 6 * r
+               + (-45 * inverse_r7 / 6) * Trr + (9 * inverse_r5 / 6) * t;
+    }
+    return acc * G_para;
+}
+
+// Whether a node may act through its moments on body i at squared distance r2 from its center of mass:
+// Barnes-Hut compares the node size with the distance, Salmon-Warren the largest distance of a body
+// from the center of mass (b_max), and the relative criterion (as in GADGET-2) the size of the
+// first neglected multipole term with the estimated acceleration of the body
+static bool acceptable(const TreeWalk& walk, const OctreeNode& node, unsigned i, double r2) {
+    double size = 2 * node.half_size;
+    switch (walk.criterion) {
+    case OPENING_BMAX:
+        return square(node.radius) < square(walk.opening_angle) * r2;
+    case OPENING_RELATIVE: {
+        double ratio = std::pow(size * size / r2, 0.5 * (std::max(walk.order, 1u) + 1));
+        return G_para * node.mass / r2 * ratio <= walk.force_accuracy * (*walk.estimate)[i].norm();
+    }
+    default:
+        return size * size < square(walk.opening_angle) * r2;
+    }
+}
+
+// Acceleration of one body by walking the tree from the root. A node whose moments are acceptable
+// for the body and which does not contain it acts through its moments; otherwise it is opened.
+// With r_s > 0 only the short-range part is summed (with the monopole), and nodes farther than r_cut are skipped.
+// The monopoles and the pairs in the leaves follow the softening; the leaves are summed in the given precision.
+template<class Softening, class Precision>
+static Vector3d treeWalk(const Octree& tree, const TreeWalk& walk, const Softening& softening,
+                         const vector<Vector3d>& pos, const vector<double>& mass, unsigned i) {
+    Vector3d acc = Vector3d::Zero();
+    unsigned stack[8 * 64];
+    unsigned top = 0;
+    stack[top++] = 0;
+    double guard = walk.criterion == OPENING_RELATIVE ? RELATIVE_GUARD : 1.0;
+    unsigned n_moments = multipoleTerms(walk.order);
+    while (top > 0) {
+        unsigned n = stack[--top];
+        const OctreeNode& node = tree.nodes[n];
+        if (node.mass == 0.0) continue;
+        Vector3d offset = (pos[i] - node.center).cwiseAbs();
+        if (walk.r_s > 0 && (offset - Vector3d::Constant(node.half_size)).cwiseMax(0.0).squaredNorm() > square(walk.r_cut)) {
+            continue;   // beyond the cutoff
+        }
+
+        bool inside = offset.maxCoeff() <= guard * node.half_size;
+        Vector3d distance = node.center_of_mass - pos[i];
+        double r2 = distance.squaredNorm();
+        if (!inside && acceptable(walk, node, i, r2)) {
+            if (walk.r_s > 0) {
+                acc += distance * (G_para * node.mass * softening.factor(r2) * shortRangeFactor(std::sqrt(r2), walk.r_s));
+            } else {
+                acc += distance * (G_para * node.mass * softening.factor(r2));
+                if (walk.order >= 2) acc += multipoleAcceleration(&(*walk.moments)[n * n_moments], walk.order, -distance);
+            }
+        } else if (node.n_children > 0) {
+            for (unsigned c = 0; c < node.n_children; ++c) stack[top++] = node.first_child + c;
+        } else if (Precision::mixed) {
+            for (unsigned t = (*walk.first_tile)[n]; t < (*walk.first_tile)[n + 1]; ++t) {
+                acc += walk.leaf_tiles->template acceleration<Softening, false>(t, pos[i], softening);
+            }
+        } else {
+            for (unsigned b = node.body_begin; b < node.body_end; ++b) {
+                unsigned j = tree.bodies[b];
+                Vector3d d = pos[j] - pos[i];
+                double d2 = d.squaredNorm();
+                if (j == i || d2 == 0.0) continue;
+                double factor = walk.r_s > 0 ? shortRangeFactor(std::sqrt(d2), walk.r_s) : 1.0;
+                acc += d * (G_para * mass[j] * softening.factor(d2) * factor);
+            }
+        }
+    }
+    return acc;
+}
+
+// The walks of all bodies, as a force kernel for runForceKernel(); base (if given) is added to the results
+struct TreeWalks {
+    const Octree& tree;
+    const TreeWalk& walk;
+    const vector<Vector3d>& pos;
+    const vector<double>& mass;
+    const vector<Vector3d>* base;
+    vector<Vector3d>& out;
+
+    template<class Softening, class Precision> void run(const Softening& softening) const {
+        parallelFor(pos.size(), PARALLEL_MIN_BODIES, [&](unsigned begin, unsigned end) {
+            for (unsigned i = begin; i < end; ++i) {
+                out[i] = treeWalk<Softening, Precision>(tree, walk, softening, pos, mass, i);
+                if (base != NULL) out[i] += (*base)[i];
+            }
+        });
+    }
+};
+
+// Tree gravity of every body from the active bodies; with r_s > 0 only the short-range part within r_cut.
+// For the relative criterion the accelerations are first estimated with a coarse monopole walk (plus base, if given).
+static void treeGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                        vector<Vector3d>& acceleration, double r_s, double r_cut, const vector<Vector3d>* base = NULL) {
+    static Octree tree;   // kept between calls and refitted while the bodies stay the same
+    updateTree(tree, pos, mass, n_active);
+
+    TreeWalk walk;
+    walk.criterion = tree_opening_criterion;
+    walk.opening_angle = tree_opening_angle;
+    walk.force_accuracy = tree_force_accuracy;
+    walk.order = r_s > 0 ? 1 : std::max(1u, std::min(tree_multipole_order, 3u));
+    walk.r_s = r_s;
+    walk.r_cut = r_cut;
+    walk.estimate = NULL;
+
+    // mixed precision leaves (not for the short-range part, whose factor depends on each pair's distance)
+    bool mixed = mixed_precision_forces && r_s == 0;
+    SourceTiles<OCTREE_LEAF_SIZE> leaf_tiles;
+    vector<unsigned> first_tile;
+    walk.leaf_tiles = NULL;
+    walk.first_tile = NULL;
+    if (mixed) {
+        first_tile.resize(tree.nodes.size() + 1);
+        for (unsigned n = 0; n < tree.nodes.size(); ++n) {
+            const OctreeNode& node = tree.nodes[n];
+            first_tile[n] = leaf_tiles.size();
+            if (node.n_children > 0) continue;
+            leaf_tiles.add(pos, mass, G_para, &tree.bodies[node.body_begin], node.body_end - node.body_begin,
+                           node.center_of_mass);
+        }
+        first_tile[tree.nodes.size()] = leaf_tiles.size();
+        walk.leaf_tiles = &leaf_tiles;
+        walk.first_tile = &first_tile;
+    }
+
+    // multipole moments of the nodes; children come after their parent, so a backward pass works upwards.
+    // The walk uses them as raw moments sum m d^k (without the 1 / k!).
+    MultiIndices index(walk.order);
+    vector<double> moments;
+    if (walk.order >= 2) {
+        unsigned n_moments = index.size();
+        moments.resize(tree.nodes.size() * n_moments);
+        for (unsigned n = tree.nodes.size(); n-- > 0; ) {
+            if (tree.nodes[n].n_children == 0) leafMoments(index, tree, n, pos, mass, &moments[n * n_moments]);
+            else shiftedMoments(index, tree, n, moments, &moments[n * n_moments]);
+        }
+        for (unsigned n = 0; n < tree.nodes.size(); ++n) {
+            for (unsigned k = 0; k < n_moments; ++k) moments[n * n_moments + k] /= index.inverse_factorial[k];
+        }
+    }
+    walk.moments = &moments;
+
+    vector<Vector3d> estimate;
+    if (walk.criterion == OPENING_RELATIVE) {
+        TreeWalk coarse = walk;
+        coarse.criterion = OPENING_ANGLE;
+        coarse.opening_angle = ESTIMATE_OPENING_ANGLE;
+        coarse.order = 1;
+        estimate.resize(pos.size());
+        TreeWalks estimate_walks = { tree, coarse, pos, mass, base, estimate };
+        runForceKernel(estimate_walks, softening, softening_length, mixed);
+        walk.estimate = &estimate;
+    }
+
+    TreeWalks walks = { tree, walk, pos, mass, NULL, acceleration };
+    runForceKernel(walks, softening, softening_length, mixed);
+    n_force_evaluations += pos.size();
+}
+
+void barnesHutGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                      vector<Vector3d>& acceleration) {
+    treeGravity(pos, mass, n_active, acceleration, 0.0, 0.0);
+}
+
+void treePMGravity(const vector<Vector3d>& pos, const vector<double>& mass, unsigned n_active,
+                   vector<Vector3d>& acceleration) {
+    double h = particleMeshGravity(pos, mass, n_active, acceleration, treepm_split_cells);
+    double r_s = treepm_split_cells * h;
+    vector<Vector3d> short_range(pos.size());
+    treeGravity(pos, mass, n_active, short_range, r_s, treepm_cutoff * r_s, &acceleration);
+    for (unsigned k = 0; k < pos.size(); ++k) acceleration[k] += short_range[k];
+    n_force_evaluations -= pos.size();   // one evaluation, in two parts
+}
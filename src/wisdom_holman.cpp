@@ -0,0 +1,148 @@
+#include "physics.h"
+
+#define WH_MIN_CENTRAL_MASS_RATIO 20.0 // the central body must outweigh all other active bodies by this factor
+#define WH_ENCOUNTER_HILL_RADII   3.0  // bodies closer than this many Hill radii are in a close encounter
+
+// Stumpff functions c2(z) and c3(z) of the universal variable formulation
+static void stumpff(double z, double& c2, double& c3) {
+    if (std::fabs(z) < 0.1) {
+        c2 = 1.0 / 2 - z * (1.0 / 24 - z * (1.0 / 720 - z * (1.0 / 40320 - z / 3628800)));
+        c3 = 1.0 / 6 - z * (1.0 / 120 - z * (1.0 / 5040 - z * (1.0 / 362880 - z / 39916800)));
+    } else if (z > 0) {
+        double s = std::sqrt(z);
+        c2 = (1 - std::cos(s)) / z;
+        c3 = (s - std::sin(s)) / (z * s);
+    } else {
+        double s = std::sqrt(-z);
+        c2 = (std::cosh(s) - 1) / -z;
+        c3 = (std::sinh(s) - s) / (-z * s);
+    }
+}
+
+// Advance a two-body orbit (relative position r and velocity v around gravitational parameter mu)
+// analytically by time h, using universal variables and the Laguerre-Conway iteration.
+// Works for elliptic, parabolic and hyperbolic orbits.
+static void keplerDrift(Vector3d& r, Vector3d& v, double mu, double h) {
+    double r0 = r.norm();
+    double sqrtMu = std::sqrt(mu);
+    double rv = r.dot(v) / sqrtMu;        // r0 * radial velocity / sqrt(mu)
+    double alpha = 2.0 / r0 - v.squaredNorm() / mu;   // inverse semi-major axis
+
+    // solve the universal Kepler equation for the universal anomaly X
+    double X = sqrtMu * h * (alpha > 0 ? alpha : 1.0 / r0);
+    double c2, c3;
+    for (unsigned iteration = 0; iteration < 50; ++iteration) {
+        double z = alpha * X * X;
+        stumpff(z, c2, c3);
+        double f = rv * X * X * c2 + (1 - alpha * r0) * X * X * X * c3 + r0 * X - sqrtMu * h;
+        double df = rv * X * (1 - z * c3) + (1 - alpha * r0) * X * X * c2 + r0;
+        double ddf = rv * (1 - z * c2) + (1 - alpha * r0) * X * (1 - z * c3);
+        double root = std::sqrt(std::fabs(16 * df * df - 20 * f * ddf));
+        double dX = 5 * f / (df + (df > 0 ? root : -root));
+        X -= dX;
+        if (std::fabs(dX) <= 1E-15 * std::max(1.0, std::fabs(X))) break;
+    }
+
+    // Lagrange coefficients
+    double z = alpha * X * X;
+    stumpff(z, c2, c3);
+    double f = 1 - X * X * c2 / r0;
+    double g = h - X * X * X * c3 / sqrtMu;
+    Vector3d r_new = f * r + g * v;
+    double r1 = r_new.norm();
+    double df = sqrtMu / (r1 * r0) * X * (z * c3 - 1);
+    double dg = 1 - X * X * c2 / r1;
+    v = df * r + dg * v;
+    r = r_new;
+}
+
+// One step of the Wisdom-Holman map in democratic heliocentric coordinates
+// (kick - jump - Kepler drift - jump - kick).
+// The Keplerian motion around the most massive body is advanced analytically,
+// the interactions between the other bodies are applied as kicks.
+// Returns false without touching the state if the system is not dominated by one central body,
+// or if two bodies are in a close encounter; the caller should integrate directly then.
+bool wisdomHolmanStep(vector<Vector3d>& pos, vector<Vector3d>& vel, const vector<double>& mass,
+                      unsigned n_active, double h) {
+    unsigned n = pos.size();
+    if (n_active < 1 || n < 2) return false;
+
+    // central body
+    unsigned c = 0;
+    double total_mass = 0.0;
+    for (unsigned i = 0; i < n; ++i) {
+        total_mass += mass[i];
+        if (i < n_active && mass[i] > mass[c]) c = i;
+    }
+    double M = mass[c];
+    if (M < WH_MIN_CENTRAL_MASS_RATIO * (total_mass - M)) return false;
+
+    // barycenter
+    Vector3d R_cm = Vector3d::Zero(), V_cm = Vector3d::Zero();
+    for (unsigned i = 0; i < n; ++i) {
+        R_cm += mass[i] * pos[i];
+        V_cm += mass[i] * vel[i];
+    }
+    R_cm /= total_mass;
+    V_cm /= total_mass;
+
+    // heliocentric positions and barycentric velocities of the other bodies,
+    // kept in the same order (active bodies first) without the central body
+    unsigned m = n - 1;
+    vector<Vector3d> Q(m), U(m), acceleration(m);
+    vector<double> Qmass(m);
+    for (unsigned i = 0, k = 0; i < n; ++i) {
+        if (i == c) continue;
+        Q[k] = pos[i] - pos[c];
+        U[k] = vel[i] - V_cm;
+        Qmass[k] = mass[i];
+        ++k;
+    }
+    unsigned m_active = n_active - 1;
+
+    // close encounter check: separations in units of Hill radii
+    for (unsigned i = 0; i < m_active; ++i) {
+        double hill_i = Q[i].norm() * std::cbrt(Qmass[i] / (3 * M));
+        for (unsigned j = i + 1; j < m; ++j) {
+            double hill = std::max(hill_i, Q[j].norm() * std::cbrt(Qmass[j] / (3 * M)));
+            if ((Q[j] - Q[i]).squaredNorm() < square(WH_ENCOUNTER_HILL_RADII * hill)) return false;
+        }
+    }
+
+    double mu = G_para * M;
+
+    // half interaction kick
+    gravity(Q, Qmass, m_active, acceleration);
+    for (unsigned k = 0; k < m; ++k) U[k] += acceleration[k] * (h / 2);
+    // half jump (motion of the central body relative to the barycenter)
+    Vector3d P_sum = Vector3d::Zero();
+    for (unsigned k = 0; k < m; ++k) P_sum += Qmass[k] * U[k];
+    for (unsigned k = 0; k < m; ++k) Q[k] += P_sum * (h / 2 / M);
+    // Kepler drift
+    for (unsigned k = 0; k < m; ++k) keplerDrift(Q[k], U[k], mu, h);
+    // half jump
+    P_sum = Vector3d::Zero();
+    for (unsigned k = 0; k < m; ++k) P_sum += Qmass[k] * U[k];
+    for (unsigned k = 0; k < m; ++k) Q[k] += P_sum * (h / 2 / M);
+    // half interaction kick
+    gravity(Q, Qmass, m_active, acceleration);
+    for (unsigned k = 0; k < m; ++k) U[k] += acceleration[k] * (h / 2);
+
+    // back to inertial coordinates; the barycenter moves uniformly
+    R_cm += V_cm * h;
+    Vector3d weighted_Q = Vector3d::Zero();
+    P_sum = Vector3d::Zero();
+    for (unsigned k = 0; k < m; ++k) {
+        weighted_Q += Qmass[k] * Q[k];
+        P_sum += Qmass[k] * U[k];
+    }
+    pos[c] = R_cm - weighted_Q / total_mass;
+    vel[c] = V_cm - P_sum / M;
+    for (unsigned i = 0, k = 0; i < n; ++i) {
+        if (i == c) continue;
+        pos[i] = Q[k] + pos[c];
+        vel[i] = U[k] + V_cm;
+        ++k;
+    }
+    return true;
+}